@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "caps.h"
+#include "caps-defs.h"
+#include "clargs.h"
+
+using namespace std;
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+#define ALIGN8(v) (((v) + 7) & ~7)
+
+static void print_prompt(const char* progname) {
+	static const char* form = "caps序列化性能测试\n\n"
+		"USAGE: %s [options]\n"
+		"options:\n"
+		"\t--help        打印此帮助信息\n"
+		"\t--repeat=*    测试重复次数\n"
+		"\t--members=*   每个对象的成员数量\n";
+	printf(form, progname);
+}
+
+// 基准实现: 与改为扁平记录数组之前的CapsWriter相同, 每个成员单独分配,
+// 序列化时逐个调用虚函数. 输出的数据与CapsWriter(flags 0)逐字节一致
+// 仅支持此测试用到的成员类型
+class BaselineWriter {
+private:
+	struct WritePointer {
+		char* mdecls;
+		int32_t* ivalues;
+		int64_t* lvalues;
+		uint32_t* bin_sizes;
+		uint32_t* str_sizes;
+		int8_t* bin_section;
+		char* str_section;
+		uint32_t cur_strp;
+		uint32_t cur_binp;
+	};
+
+	class Member {
+	public:
+		virtual ~Member() = default;
+
+		virtual void do_serialize(WritePointer* wp) const = 0;
+	};
+
+	class IntegerMember : public Member {
+	public:
+		void do_serialize(WritePointer* wp) const {
+			*wp->mdecls-- = 'i';
+			*wp->ivalues++ = value;
+		}
+
+		int32_t value;
+	};
+
+	class LongMember : public Member {
+	public:
+		void do_serialize(WritePointer* wp) const {
+			*wp->mdecls-- = 'l';
+			memcpy(wp->lvalues++, &value, sizeof(value));
+		}
+
+		int64_t value;
+	};
+
+	class DoubleMember : public Member {
+	public:
+		void do_serialize(WritePointer* wp) const {
+			*wp->mdecls-- = 'd';
+			memcpy(wp->lvalues++, &value, sizeof(value));
+		}
+
+		double value;
+	};
+
+	class StringMember : public Member {
+	public:
+		void do_serialize(WritePointer* wp) const {
+			*wp->mdecls-- = 'S';
+			*wp->str_sizes++ = value.length();
+			memcpy(wp->str_section + wp->cur_strp, value.c_str(), value.length() + 1);
+			wp->cur_strp += value.length() + 1;
+		}
+
+		string value;
+	};
+
+	class BinaryMember : public Member {
+	public:
+		void do_serialize(WritePointer* wp) const {
+			*wp->mdecls-- = 'B';
+			*wp->bin_sizes++ = value.length();
+			if (value.length() > 0) {
+				memcpy(wp->bin_section + wp->cur_binp, value.data(), value.length());
+				wp->cur_binp += ALIGN8(value.length());
+			}
+		}
+
+		string value;
+	};
+
+public:
+	~BaselineWriter() {
+		size_t i;
+		for (i = 0; i < members.size(); ++i)
+			delete members[i];
+	}
+
+	void write(int32_t v) {
+		IntegerMember* m = new IntegerMember();
+		m->value = v;
+		members.push_back(m);
+		++number_member_number;
+	}
+
+	void write(int64_t v) {
+		LongMember* m = new LongMember();
+		m->value = v;
+		members.push_back(m);
+		++long_member_number;
+	}
+
+	void write(double v) {
+		DoubleMember* m = new DoubleMember();
+		m->value = v;
+		members.push_back(m);
+		++long_member_number;
+	}
+
+	void write(const char* v) {
+		StringMember* m = new StringMember();
+		m->value = v;
+		members.push_back(m);
+		++string_member_number;
+		string_section_size += m->value.length() + 1;
+	}
+
+	void write(const vector<uint8_t>& v) {
+		BinaryMember* m = new BinaryMember();
+		m->value.assign(reinterpret_cast<const char*>(v.data()), v.size());
+		members.push_back(m);
+		++binary_member_number;
+		binary_section_size += ALIGN8(v.size());
+	}
+
+	int32_t serialize(void* buf, uint32_t bufsize) const {
+		uint32_t total = ALIGN8(bin_section_offset() + binary_section_size
+				+ string_section_size + members.size()
+				+ rokid::caps_count_size(members.size()));
+		if (buf == nullptr || bufsize < total)
+			return total;
+		rokid::Header* header = reinterpret_cast<rokid::Header*>(buf);
+		WritePointer wp;
+		char* decls = reinterpret_cast<char*>(buf) + total;
+		uint32_t n = members.size();
+		uint8_t c;
+		size_t i;
+
+		header->magic[0] = CAPS_MAGIC0;
+		header->magic[1] = 'A';
+		header->magic[2] = 'P';
+		header->magic[3] = CAPS_VERSION;
+		header->length = total;
+		wp.lvalues = reinterpret_cast<int64_t*>(header + 1);
+		wp.ivalues = reinterpret_cast<int32_t*>(wp.lvalues + long_member_number);
+		wp.bin_sizes = reinterpret_cast<uint32_t*>(wp.ivalues + number_member_number);
+		wp.str_sizes = wp.bin_sizes + binary_member_number;
+		wp.bin_section = reinterpret_cast<int8_t*>(buf) + bin_section_offset();
+		wp.str_section = reinterpret_cast<char*>(wp.bin_section + binary_section_size);
+		wp.cur_strp = 0;
+		wp.cur_binp = 0;
+		// 成员数量(varint, 从后向前)
+		do {
+			c = n & 0x7f;
+			n >>= 7;
+			if (n)
+				c |= 0x80;
+			*--decls = c;
+		} while (n);
+		wp.mdecls = decls - 1;
+		for (i = 0; i < members.size(); ++i)
+			members[i]->do_serialize(&wp);
+		return total;
+	}
+
+private:
+	uint32_t bin_section_offset() const {
+		return ALIGN8(sizeof(rokid::Header) + long_member_number * sizeof(int64_t)
+				+ number_member_number * sizeof(uint32_t)
+				+ binary_member_number * sizeof(uint32_t)
+				+ string_member_number * sizeof(uint32_t));
+	}
+
+private:
+	vector<Member*> members;
+	uint32_t number_member_number = 0;
+	uint32_t long_member_number = 0;
+	uint32_t binary_member_number = 0;
+	uint32_t string_member_number = 0;
+	uint32_t binary_section_size = 0;
+	uint32_t string_section_size = 0;
+};
+
+template <typename W>
+static void build_message(W& w, int32_t members, const vector<uint8_t>& bin) {
+	int32_t i;
+	for (i = 0; i < members; ++i) {
+		switch (i % 5) {
+			case 0:
+				w.write((int32_t)i);
+				break;
+			case 1:
+				w.write((int64_t)i);
+				break;
+			case 2:
+				w.write((double)i);
+				break;
+			case 3:
+				w.write("rokid caps benchmark");
+				break;
+			case 4:
+				w.write(bin);
+				break;
+		}
+	}
+}
+
+// 返回每个对象的耗时(ns)
+template <typename W>
+static double bench_write(int32_t repeat, int32_t members,
+		const vector<uint8_t>& bin, vector<int8_t>& buf, int64_t& total) {
+	steady_clock::time_point tp = steady_clock::now();
+	int32_t i;
+	int32_t size;
+	total = 0;
+	for (i = 0; i < repeat; ++i) {
+		W w;
+		build_message(w, members, bin);
+		size = w.serialize(nullptr, 0);
+		if ((int32_t)buf.size() < size)
+			buf.resize(size);
+		total += w.serialize(buf.data(), size);
+	}
+	return (double)duration_cast<nanoseconds>(steady_clock::now() - tp).count()
+		/ repeat;
+}
+
+// Caps::new_instance创建的CapsWriter
+class CurrentWriter {
+public:
+	template <typename T>
+	void write(const T& v) {
+		caps->write(v);
+	}
+
+	int32_t serialize(void* buf, uint32_t bufsize) const {
+		return caps->serialize(buf, bufsize, 0);
+	}
+
+	shared_ptr<Caps> caps = Caps::new_instance();
+};
+
+int main(int argc, char** argv) {
+	clargs_h h = clargs_parse(argc, argv);
+	uint32_t clsize = clargs_size(h);
+	uint32_t cl_i;
+	const char* clkey;
+	const char* clvalue;
+	int32_t repeat = 100000;
+	int32_t members = 50;
+	for (cl_i = 0; cl_i < clsize; ++cl_i) {
+		clargs_get(h, cl_i, &clkey, &clvalue);
+		if (clkey && strcmp(clkey, "help") == 0) {
+			print_prompt(argv[0]);
+			clargs_destroy(h);
+			return 1;
+		}
+		if (clkey && strcmp(clkey, "repeat") == 0) {
+			if (clargs_get_integer(h, cl_i, &clkey, &repeat) < 0 || repeat <= 0)
+				repeat = 100000;
+		}
+		if (clkey && strcmp(clkey, "members") == 0) {
+			if (clargs_get_integer(h, cl_i, &clkey, &members) < 0
+					|| members <= 0 || members > 255)
+				members = 50;
+		}
+	}
+	clargs_destroy(h);
+
+	vector<uint8_t> bin(64, 0x5a);
+	vector<int8_t> buf;
+	int32_t i;
+	int32_t size;
+	int64_t total;
+
+	// 基准实现与CapsWriter输出须一致, 否则两者的耗时没有可比性
+	{
+		BaselineWriter bw;
+		CurrentWriter cw;
+		build_message(bw, members, bin);
+		build_message(cw, members, bin);
+		size = cw.serialize(nullptr, 0);
+		vector<int8_t> expected(size, 0);
+		buf.assign(size, 0);
+		if (bw.serialize(nullptr, 0) != size
+				|| cw.serialize(expected.data(), size) != size
+				|| bw.serialize(buf.data(), size) != size
+				|| memcmp(buf.data(), expected.data(), size) != 0) {
+			printf("baseline writer output mismatch\n");
+			return 1;
+		}
+	}
+
+	double ns = bench_write<BaselineWriter>(repeat, members, bin, buf, total);
+	printf("write + serialize (baseline, per-member alloc): %d objects, "
+			"%d members, %lld bytes, %.1f ns/object\n", repeat, members,
+			(long long)total, ns);
+	ns = bench_write<CurrentWriter>(repeat, members, bin, buf, total);
+	printf("write + serialize: %d objects, %d members, %lld bytes, "
+			"%.1f ns/object\n", repeat, members, (long long)total, ns);
+
+	shared_ptr<Caps> rcaps;
+	int32_t iv;
+	int64_t lv;
+	double dv;
+	const char* sv;
+	const void* bv;
+	uint32_t bl;
+	CurrentWriter w;
+	build_message(w, members, bin);
+	size = w.serialize(buf.data(), buf.size());
+	steady_clock::time_point tp = steady_clock::now();
+	for (i = 0; i < repeat; ++i) {
+		Caps::parse(buf.data(), size, rcaps, false);
+		while (rcaps->next_type() != CAPS_ERR_EOO) {
+			switch (rcaps->next_type()) {
+				case CAPS_MEMBER_TYPE_INTEGER:
+					rcaps->read(iv);
+					break;
+				case CAPS_MEMBER_TYPE_LONG:
+					rcaps->read(lv);
+					break;
+				case CAPS_MEMBER_TYPE_DOUBLE:
+					rcaps->read(dv);
+					break;
+				case CAPS_MEMBER_TYPE_STRING:
+					rcaps->read(sv);
+					break;
+				case CAPS_MEMBER_TYPE_BINARY:
+					rcaps->read(bv, bl);
+					break;
+			}
+		}
+	}
+	ns = (double)duration_cast<nanoseconds>(steady_clock::now() - tp).count()
+		/ repeat;
+	printf("parse + read: %d objects, %d members, %.1f ns/object\n",
+			repeat, members, ns);
+	return 0;
+}
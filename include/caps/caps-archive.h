@@ -0,0 +1,113 @@
+#ifndef ROKID_MUTILS_CAPS_ARCHIVE_H
+#define ROKID_MUTILS_CAPS_ARCHIVE_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "caps.h"
+
+// caps记录文件, 只追加写入, 用于保存及回放caps数据
+//
+// 文件格式(本机字节序):
+//   文件头: magic "CAPA", 版本, 保留字段, 共16字节
+//   记录: int64 timestamp + caps序列化数据, 每条记录按8字节对齐
+// 稀疏索引存放于'<path>.idx', 每'index_interval'条记录一项:
+//   uint64 记录偏移, int64 timestamp, uint32 记录序号, uint32 保留
+// 索引可能落后于记录文件(未flush或异常退出), 打开时扫描索引之后的记录
+
+#define CAPS_ARCHIVE_INDEX_INTERVAL 64
+#define CAPS_ARCHIVE_BATCH_SIZE (64 * 1024)
+
+typedef struct {
+  uint64_t offset;
+  int64_t timestamp;
+  uint32_t seq;
+  uint32_t reserved;
+} CapsArchiveIndex;
+
+class CapsArchiveWriter {
+public:
+  ~CapsArchiveWriter();
+
+  // 打开记录文件, 文件已存在时在其末尾追加
+  // 末尾不完整的记录(异常退出时未写完)被截断
+  // 'batch_size': 缓存的记录达到此长度时写入文件
+  int32_t open(const char* path,
+      uint32_t index_interval = CAPS_ARCHIVE_INDEX_INTERVAL,
+      uint32_t batch_size = CAPS_ARCHIVE_BATCH_SIZE);
+
+  // 追加一条记录, 以本机字节序直接序列化到写缓存中
+  // 序列化失败时返回其错误码, 不追加记录
+  int32_t append(const Caps& caps, int64_t timestamp);
+
+  // 追加一条已序列化的记录, 数据原样写入(不转换字节序)
+  int32_t append(const void* data, uint32_t length, int64_t timestamp);
+
+  // 将缓存的记录及索引写入文件
+  int32_t flush();
+
+  void close();
+
+  // 记录总数(包括未flush的记录)
+  inline uint32_t size() const { return count; }
+
+private:
+  int8_t* reserve(uint32_t length, int64_t timestamp);
+
+private:
+  int fd = -1;
+  int index_fd = -1;
+  uint32_t interval = CAPS_ARCHIVE_INDEX_INTERVAL;
+  uint32_t batch = CAPS_ARCHIVE_BATCH_SIZE;
+  uint32_t count = 0;
+  // 下一条记录的文件偏移
+  uint64_t offset = 0;
+  std::vector<int8_t> buffer;
+  std::vector<CapsArchiveIndex> pending_index;
+};
+
+class CapsArchiveReader {
+public:
+  ~CapsArchiveReader();
+
+  // mmap记录文件并加载索引
+  int32_t open(const char* path);
+
+  void close();
+
+  // 记录总数
+  inline uint32_t size() const { return count; }
+
+  // 读取当前记录, 读取位置移动到下一条记录
+  // 'caps'直接parse(duplicate = false)映射的文件内存, 不拷贝,
+  // 在此reader close之前有效
+  // 'caps'为上次读取得到的对象且无其它引用时, 复用此对象
+  // 没有更多记录时返回CAPS_ERR_EOO
+  int32_t next(std::shared_ptr<Caps>& caps, int64_t* timestamp = nullptr);
+
+  // 移动读取位置到第'index'条记录, index == size()时移动到末尾
+  int32_t seek(uint32_t index);
+
+  // 移动读取位置到第一条timestamp不小于'timestamp'的记录
+  // 要求记录的timestamp单调不减
+  int32_t seek_time(int64_t timestamp);
+
+  // 当前读取位置的记录序号
+  inline uint32_t tell() const { return current; }
+
+private:
+  uint64_t next_offset(uint64_t off) const;
+
+private:
+  const int8_t* data = nullptr;
+  uint64_t data_size = 0;
+  // 完整记录的结束位置
+  uint64_t end = 0;
+  uint32_t count = 0;
+  std::vector<CapsArchiveIndex> index;
+  uint64_t offset = 0;
+  uint32_t current = 0;
+};
+
+#endif // ROKID_MUTILS_CAPS_ARCHIVE_H
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "caps.h"
+
+// CapsWriter/CapsReader内联实现及caps_schema所需的数据格式定义及字节序工具
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CAPS_HOST_NET_BYTEORDER 1
+#else
+#define CAPS_HOST_NET_BYTEORDER 0
+#endif
+
+// magic[0]低5位, 高位为CAPS_FLAG_NET_BYTEORDER及CAPS_FLAG_DEDUP_STRINGS
+#define CAPS_MAGIC0 0x1e
+#define CAPS_MAGIC_MASK 0x1f
+// 可parse的最低版本
+#define CAPS_MIN_VERSION 3
+
+// v5起binary section起始位置及其中每项数据(相对对象起始)均按8字节对齐,
+// 保证64位数组及子对象的long section对齐
+#define CAPS_ALIGN8_VERSION 5
+
+// v7起binary sizes之后为string sizes, 每个字符串成员一项,
+// 记录不含结束符的长度, 读取及跳过字符串无需strlen
+// string sizes与number section, binary sizes相邻, 可一次转换字节序
+#define CAPS_STRLEN_VERSION 7
+
+// v8起magic[0]可标记CAPS_FLAG_DEDUP_STRINGS: string sizes之后为string offsets,
+// 每个字符串成员一项, 为其相对string section起始的偏移,
+// 相同的字符串在string section中只存放一次
+#define CAPS_DEDUP_VERSION 8
+
+// v6起成员数量以varint形式存放于数据末尾, 从后向前读取:
+// 最后一个字节为最低7位, 字节最高位为1表示其前一字节仍属于成员数量
+// v3 - v5成员数量为1字节
+#define CAPS_VARINT_COUNT_VERSION 6
+#define CAPS_MAX_COUNT_SIZE 5
+
+namespace rokid {
+
+typedef struct {
+  // magic[0]: 0x1e | FLAG_NET_BYTEORDER(0x80) | FLAG_DEDUP_STRINGS(0x40)
+  // magic[1]: 'A'
+  // magic[2]: 'P'
+  // magic[3]: CAPS_VERSION
+  char magic[4];
+  uint32_t length;
+} Header;
+
+typedef struct {
+  const int32_t* number_values;
+  const int64_t* long_values;
+  const uint32_t* bin_sizes;
+  const int8_t* binary_section;
+  const char* string_section;
+  const uint32_t* str_sizes;
+  // 字符串去重的数据为每个字符串相对string section的偏移, 否则为nullptr
+  // 此时string_section始终为string section起始
+  const uint32_t* str_offsets;
+  uint32_t current_read_member;
+} CapsReaderRecord;
+
+// 成员在各数据区的偏移, 用于CapsReader随机读取
+typedef struct {
+  uint32_t number_index;
+  uint32_t long_index;
+  uint32_t bin_index;
+  uint32_t binary_offset;
+  uint32_t string_offset;
+  uint32_t string_index;
+} MemberOffset;
+
+
+// 'flags'指定网络字节序, 且本机为小端时需要交换字节序
+inline bool caps_need_swap(uint32_t flags) {
+  return !CAPS_HOST_NET_BYTEORDER && (flags & CAPS_FLAG_NET_BYTEORDER);
+}
+
+template <bool Swap>
+inline uint32_t caps_order32(uint32_t v) {
+  return Swap ? __builtin_bswap32(v) : v;
+}
+
+template <bool Swap>
+inline uint64_t caps_order64(uint64_t v) {
+  return Swap ? __builtin_bswap64(v) : v;
+}
+
+inline uint32_t caps_order32(uint32_t v, bool swap) {
+  return swap ? __builtin_bswap32(v) : v;
+}
+
+inline uint64_t caps_order64(uint64_t v, bool swap) {
+  return swap ? __builtin_bswap64(v) : v;
+}
+
+inline uint32_t caps_count_size(uint32_t n) {
+  uint32_t r = 1;
+  while (n >= 0x80) {
+    n >>= 7;
+    ++r;
+  }
+  return r;
+}
+
+// object子对象最大嵌套层数, validate及visit时超出视为数据不正确
+#define CAPS_MAX_DEPTH 64
+
+// binary section中每项数据的对齐, v5起为8字节, v3/v4为4字节
+inline uint32_t caps_bin_align(uint32_t v, bool align8) {
+  return align8 ? (v + 7) & ~7 : (v + 3) & ~3;
+}
+
+// v5起子对象在父对象中按8字节对齐, 但v3/v4数据及parse(dup = false)时
+// 调用者的缓冲区只保证4字节对齐, 64位数据使用memcpy读写
+inline int64_t caps_load64(const void* p) {
+  int64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline void caps_store64(void* p, int64_t v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+} // namespace rokid
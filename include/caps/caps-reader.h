@@ -0,0 +1,620 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "caps-defs.h"
+#include "caps.h"
+
+namespace rokid {
+
+// read_fields参数类型对应的成员类型
+template <typename T>
+struct CapsFieldType;
+
+#define CAPS_FIELD_TYPE(T, t) \
+template <> struct CapsFieldType<T> { static const char value = t; }
+
+CAPS_FIELD_TYPE(int32_t, 'i');
+CAPS_FIELD_TYPE(uint32_t, 'i');
+CAPS_FIELD_TYPE(float, 'f');
+CAPS_FIELD_TYPE(int64_t, 'l');
+CAPS_FIELD_TYPE(uint64_t, 'l');
+CAPS_FIELD_TYPE(double, 'd');
+CAPS_FIELD_TYPE(const char*, 'S');
+CAPS_FIELD_TYPE(std::string, 'S');
+CAPS_FIELD_TYPE(std::vector<uint8_t>, 'B');
+CAPS_FIELD_TYPE(std::vector<int32_t>, 'I');
+CAPS_FIELD_TYPE(std::vector<float>, 'F');
+CAPS_FIELD_TYPE(std::vector<int64_t>, 'L');
+CAPS_FIELD_TYPE(std::vector<double>, 'D');
+CAPS_FIELD_TYPE(std::shared_ptr<Caps>, 'O');
+
+#undef CAPS_FIELD_TYPE
+
+class CapsWriter;
+
+// CapsVisitor::on_object_begin返回此值时不遍历子对象的成员
+#define CAPS_VISIT_SKIP 1
+
+// CapsReader::visit的回调, 派生类只需定义要处理的方法(同名隐藏, 非虚函数)
+// 定义on_array时须定义全部重载, 或using CapsVisitor::on_array
+// 返回CAPS_SUCCESS继续遍历, 其它值中止遍历并由visit返回
+class CapsVisitor {
+public:
+  int32_t on_integer(int32_t v) { return CAPS_SUCCESS; }
+  int32_t on_float(float v) { return CAPS_SUCCESS; }
+  int32_t on_long(int64_t v) { return CAPS_SUCCESS; }
+  int32_t on_double(double v) { return CAPS_SUCCESS; }
+  int32_t on_string(const char* v, uint32_t len) { return CAPS_SUCCESS; }
+  int32_t on_binary(const void* v, uint32_t len) { return CAPS_SUCCESS; }
+  int32_t on_array(const int32_t* v, uint32_t count) { return CAPS_SUCCESS; }
+  int32_t on_array(const float* v, uint32_t count) { return CAPS_SUCCESS; }
+  int32_t on_array(const int64_t* v, uint32_t count) { return CAPS_SUCCESS; }
+  int32_t on_array(const double* v, uint32_t count) { return CAPS_SUCCESS; }
+  int32_t on_void() { return CAPS_SUCCESS; }
+  // 'data'为子对象的完整数据, 'len'为0时为空对象
+  // 返回CAPS_SUCCESS时遍历其成员, 之后调用on_object_end
+  int32_t on_object_begin(const void* data, uint32_t len) {
+    return CAPS_VISIT_SKIP;
+  }
+  int32_t on_object_end() { return CAPS_SUCCESS; }
+};
+
+// parse得到的各数据区位置, parse之后不再改变
+// 由CapsReader及CapsView(多个CapsCursor共享)使用
+struct CapsLayout {
+  const Header* header = nullptr;
+  const char* member_declarations = nullptr;
+  uint32_t num_members = 0;
+  uint32_t data_length = 0;
+  // 数据为网络字节序且与本机字节序不同
+  bool swap = false;
+  // v5起binary section数据按8字节对齐
+  bool align8 = false;
+  // 第一个成员的读取位置
+  CapsReaderRecord origin = CapsReaderRecord();
+  // build_index建立, num_members + 1项, 最后一项为对象末尾
+  std::vector<MemberOffset> member_index;
+  const int8_t* bin_data = nullptr;
+
+  // 检查header及各数据区边界并记录其位置, 不拷贝'b'
+  // 失败时清空
+  int32_t parse(const int8_t* b, uint32_t datasize);
+
+  // 建立成员偏移索引, 用于seek
+  void build_index();
+
+  void clear();
+
+private:
+  int32_t parse_sections(const int8_t* b, uint32_t datasize);
+};
+
+// 读取位置及读取操作, CapsReader与CapsCursor共用
+// 只记录读取位置, 数据区位置由调用者传入的CapsLayout提供
+class CapsCursorCore {
+public:
+  inline bool end_of_object(const CapsLayout& l) const {
+    return l.num_members <= pos.current_read_member;
+  }
+
+  inline int8_t current_member_type(const CapsLayout& l) const {
+    if (end_of_object(l))
+      return '\0';
+    return l.member_declarations[-(int32_t)pos.current_read_member];
+  }
+
+  inline int32_t check(const CapsLayout& l, char type) const {
+    if (end_of_object(l))
+      return CAPS_ERR_EOO;
+    if (current_member_type(l) != type)
+      return CAPS_ERR_INCORRECT_TYPE;
+    return CAPS_SUCCESS;
+  }
+
+  int32_t next_type(const CapsLayout& l) const;
+
+  // 以下next_*读取当前成员, 不检查成员类型, 由调用者预先检查
+  inline int32_t next32(const CapsLayout& l) {
+    int32_t r = caps_order32(pos.number_values[0], l.swap);
+    ++pos.number_values;
+    ++pos.current_read_member;
+    return r;
+  }
+
+  inline int64_t next64(const CapsLayout& l) {
+    int64_t r = caps_order64(caps_load64(pos.long_values), l.swap);
+    ++pos.long_values;
+    ++pos.current_read_member;
+    return r;
+  }
+
+  const char* next_string(const CapsLayout& l, uint32_t& len) {
+    const char* r = pos.string_section;
+    if (pos.str_sizes) {
+      len = caps_order32(pos.str_sizes[0], l.swap);
+      ++pos.str_sizes;
+    } else {
+      len = strlen(r);
+    }
+    if (pos.str_offsets) {
+      r += caps_order32(pos.str_offsets[0], l.swap);
+      ++pos.str_offsets;
+    } else {
+      pos.string_section += len + 1;
+    }
+    ++pos.current_read_member;
+    return r;
+  }
+
+  // binary, object及数组成员
+  const int8_t* next_binary(const CapsLayout& l, uint32_t& len) {
+    const int8_t* r = pos.binary_section;
+    len = caps_order32(pos.bin_sizes[0], l.swap);
+    pos.binary_section += caps_bin_align(len, l.align8);
+    ++pos.bin_sizes;
+    ++pos.current_read_member;
+    return r;
+  }
+
+  inline int32_t read32(const CapsLayout& l, int32_t* r, char type) {
+    int32_t code = check(l, type);
+    if (code != CAPS_SUCCESS)
+      return code;
+    *r = next32(l);
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t read64(const CapsLayout& l, int64_t* r, char type) {
+    int32_t code = check(l, type);
+    if (code != CAPS_SUCCESS)
+      return code;
+    *r = next64(l);
+    return CAPS_SUCCESS;
+  }
+
+  int32_t read_string(const CapsLayout& l, const char*& r, uint32_t& len);
+  int32_t read(const CapsLayout& l, std::string& r);
+  // 'type'为'B'或'O', 不拷贝
+  int32_t read_binary(const CapsLayout& l, char type, const void*& r,
+      uint32_t& len);
+  int32_t read(const CapsLayout& l, std::vector<uint8_t>& r);
+  int32_t read_void(const CapsLayout& l);
+
+  // 'ref'为true时数据字节序必须与本机相同, 且按元素大小对齐
+  // (否则返回CAPS_ERR_INVAL)
+  // 长度不是元素大小的整数倍时返回CAPS_ERR_CORRUPTED, 不读取此成员
+  int32_t read_array(const CapsLayout& l, const void*& r, uint32_t& length,
+      char type, bool ref);
+
+  // 不拷贝, 数据字节序与本机不同时返回CAPS_ERR_BYTEORDER,
+  // 未按元素大小对齐时返回CAPS_ERR_INVAL
+  template <typename T>
+  int32_t read_array(const CapsLayout& l, const T*& r, uint32_t& count) {
+    const void* p;
+    uint32_t length;
+    int32_t code = read_array(l, p, length,
+        CapsFieldType<std::vector<T> >::value, true);
+    if (code != CAPS_SUCCESS)
+      return code;
+    r = reinterpret_cast<const T*>(p);
+    count = length / sizeof(T);
+    return CAPS_SUCCESS;
+  }
+
+  // 拷贝并转换为本机字节序
+  template <typename T>
+  int32_t read_array(const CapsLayout& l, std::vector<T>& r) {
+    const void* p;
+    uint32_t length;
+    char type = CapsFieldType<std::vector<T> >::value;
+    int32_t code = read_array(l, p, length, type, false);
+    if (code != CAPS_SUCCESS)
+      return code;
+    r.resize(length / sizeof(T));
+    if (length > 0)
+      copy_array(l, type, r.data(), p, length);
+    return CAPS_SUCCESS;
+  }
+
+  // 'l'的成员索引须已建立
+  int32_t seek(const CapsLayout& l, uint32_t index);
+  int32_t skip(const CapsLayout& l, uint32_t n);
+
+public:
+  CapsReaderRecord pos = CapsReaderRecord();
+
+private:
+  static void copy_array(const CapsLayout& l, char type, void* dst,
+      const void* src, uint32_t length);
+};
+
+// 可直接在栈上构造并parse, 通过CapsReader类型调用时编译器可内联数值成员的读取
+class CapsReader final : public Caps {
+public:
+  ~CapsReader() noexcept;
+
+  CapsReader& operator = (const Caps& o);
+
+  // 同Caps::parse, 'dup'为false时不拷贝'data'
+  int32_t parse(const void* data, uint32_t datasize, bool dup = true);
+
+  // 'data'位于'store'中, 不拷贝数据, 共享'store'所有权
+  int32_t parse(const void* data, uint32_t datasize,
+      const std::shared_ptr<int8_t>& store);
+
+  // 将'w'以本机字节序序列化到此对象的缓冲区中, 只拷贝一次, read无需转换
+  // 缓冲区与此对象上次parse的缓冲区交替使用, 'w'可引用上次parse的数据
+  int32_t parse(const CapsWriter& w);
+
+  // 与'o'共享数据(Caps::convert), 读取位置为第一个成员
+  // 'o'引用调用者内存(parse时dup = false)时拷贝数据
+  void share_from(const CapsReader& o);
+
+  // 对象的序列化数据. parse(dup = true)时为转换为本机字节序的拷贝,
+  // header不再标记网络字节序, 与parse的原始数据不一定相同;
+  // 数据含义不变, 可直接写入或再次parse
+  inline const void* binary_data() const { return layout.bin_data; }
+
+  // 检查此对象数据的完整结构(同Caps::validate)
+  int32_t validate() const;
+
+  // 清除parse的数据, 保留此对象独占的缓冲区, 再次parse(dup = true)时复用
+  void reset();
+
+  // override from 'Caps'
+  int32_t write(int32_t v) { return CAPS_ERR_RDONLY; }
+  int32_t write(uint32_t v) { return CAPS_ERR_RDONLY; }
+  int32_t write(float v) { return CAPS_ERR_RDONLY; }
+  int32_t write(int64_t v) { return CAPS_ERR_RDONLY; }
+  int32_t write(uint64_t v) { return CAPS_ERR_RDONLY; }
+  int32_t write(double v) { return CAPS_ERR_RDONLY; }
+  int32_t write(const char* v) { return CAPS_ERR_RDONLY; }
+  int32_t write(const std::string& v) { return CAPS_ERR_RDONLY; }
+  int32_t write(const void* v, uint32_t len) { return CAPS_ERR_RDONLY; }
+  int32_t write(const std::vector<uint8_t>& v) { return CAPS_ERR_RDONLY; }
+  int32_t write(std::string&& v) { return CAPS_ERR_RDONLY; }
+  int32_t write(std::vector<uint8_t>&& v) { return CAPS_ERR_RDONLY; }
+  int32_t write_string(const char* v, uint32_t len) { return CAPS_ERR_RDONLY; }
+  int32_t write(std::shared_ptr<Caps>& v) { return CAPS_ERR_RDONLY; }
+  int32_t write_ref(const char* v) { return CAPS_ERR_RDONLY; }
+  int32_t write_ref(const void* v, uint32_t len) { return CAPS_ERR_RDONLY; }
+  int32_t write_array(const int32_t* v, uint32_t count) { return CAPS_ERR_RDONLY; }
+  int32_t write_array(const float* v, uint32_t count) { return CAPS_ERR_RDONLY; }
+  int32_t write_array(const int64_t* v, uint32_t count) { return CAPS_ERR_RDONLY; }
+  int32_t write_array(const double* v, uint32_t count) { return CAPS_ERR_RDONLY; }
+  int32_t write() { return CAPS_ERR_RDONLY; }
+  int32_t serialize(void* buf, uint32_t size, uint32_t flags) const { return CAPS_ERR_RDONLY; }
+  int32_t serialize_iov(std::vector<struct iovec>& iov, std::string& buf,
+      uint32_t flags, uint32_t threshold) const { return CAPS_ERR_RDONLY; }
+  int32_t serialize_append(std::string& buf, uint32_t flags) const { return CAPS_ERR_RDONLY; }
+  int32_t serialize_append(std::vector<uint8_t>& buf, uint32_t flags) const { return CAPS_ERR_RDONLY; }
+
+  inline int32_t read(int32_t& r) {
+    return read32(&r, 'i');
+  }
+
+  inline int32_t read(uint32_t& r) {
+    return read32(reinterpret_cast<int32_t*>(&r), 'i');
+  }
+
+  inline int32_t read(float& r) {
+    return read32(reinterpret_cast<int32_t*>(&r), 'f');
+  }
+
+  inline int32_t read(int64_t& r) {
+    return read64(&r, 'l');
+  }
+
+  inline int32_t read(uint64_t& r) {
+    return read64(reinterpret_cast<int64_t*>(&r), 'l');
+  }
+
+  inline int32_t read(double& r) {
+    return read64(reinterpret_cast<int64_t*>(&r), 'd');
+  }
+
+  int32_t read(std::string& r);
+  int32_t read(std::vector<uint8_t>& r);
+  int32_t read_string(std::string& r);
+  int32_t read_binary(std::string& r);
+  int32_t read(std::shared_ptr<Caps>& r);
+  int32_t read();
+  int32_t read_array(const int32_t*& r, uint32_t& count);
+  int32_t read_array(const float*& r, uint32_t& count);
+  int32_t read_array(const int64_t*& r, uint32_t& count);
+  int32_t read_array(const double*& r, uint32_t& count);
+  int32_t read_array(std::vector<int32_t>& r);
+  int32_t read_array(std::vector<float>& r);
+  int32_t read_array(std::vector<int64_t>& r);
+  int32_t read_array(std::vector<double>& r);
+  int32_t next_type() const;
+  int32_t seek(uint32_t index);
+  int32_t skip(uint32_t n);
+
+  // read string & binary without memcpy
+  int32_t read(const char*& r);
+  int32_t read_string(const char*& r, uint32_t& len);
+  int32_t read(const void*& r, uint32_t& len);
+
+  // 由此对象object成员的数据(如CapsVisitor::on_object_begin的参数)创建子对象,
+  // 同read(std::shared_ptr<Caps>&): 共享此对象的数据, 'len'为0时'r'为空
+  int32_t sub_object(const void* data, uint32_t len,
+      std::shared_ptr<Caps>& r) const;
+
+  // c api: 读取object或binary类型成员(caps_write_object写入binary类型)
+  // 子对象直接parse此对象的数据, 不拷贝, 共享数据所有权
+  // 成员数据长度为0时'r'为nullptr
+  int32_t read_object(CapsReader*& r);
+
+  // c api: 按'fmt'批量读取(格式见caps_read_fmt)
+  // 先一次检查所有成员类型, 读取所有object成员及检查数组长度,
+  // 失败时不读取任何成员, 也不输出任何子对象
+  int32_t read_fmt(const char* fmt, va_list ap);
+
+  // 批量读取, 参数类型见CapsFieldType
+  // 先一次检查所有成员类型, 之后数值及字符串成员不再逐个检查
+  template <typename T, typename... Args>
+  int32_t read_fields(T& v, Args&... args) {
+    static const char types[] = {
+      CapsFieldType<T>::value, CapsFieldType<Args>::value..., '\0'
+    };
+    int32_t r = check_types(types, sizeof...(Args) + 1, false);
+    if (r != CAPS_SUCCESS)
+      return r;
+    int32_t rs[] = {
+      r = get(v), (r == CAPS_SUCCESS ? (r = get(args)) : r)...
+    };
+    (void)rs;
+    return r;
+  }
+
+  // 从当前读取位置遍历剩余成员, 读取位置移动到对象末尾
+  // 'v'的回调见CapsVisitor, 静态分派, 每个成员只判断一次类型
+  // 字符串, binary及数组(与本机字节序相同且已对齐时)直接引用此对象的数据,
+  // 子对象在栈上递归遍历, 不创建CapsReader对象
+  template <typename V>
+  inline int32_t visit(V& v) {
+    return visit(v, 0);
+  }
+
+  int32_t type() const { return CAPS_TYPE_READER; }
+  uint32_t binary_size() const;
+  inline uint32_t size() const { return layout.num_members; }
+
+  inline int8_t current_member_type() const {
+    return cur.current_member_type(layout);
+  }
+
+  inline bool end_of_object() const {
+    return cur.end_of_object(layout);
+  }
+
+  // 保存/恢复读取位置, 多线程读取同一数据时应使用CapsView/CapsCursor
+  void record(CapsReaderRecord& rec) const;
+  void rollback(const CapsReaderRecord& rec);
+
+private:
+  // 共享此对象parse得到的数据区位置
+  friend class CapsView;
+
+  int32_t parse_buffer(const int8_t* b, uint32_t datasize);
+
+  // 释放store, 仅被此对象引用时保留为spare
+  void recycle_store();
+
+  // 检查从当前位置开始的'n'个成员类型与'types'一致
+  // 'c_api'为true时'O'可匹配binary成员, 数组须与本机字节序相同
+  int32_t check_types(const char* types, uint32_t n, bool c_api) const;
+
+  // read_fmt: 预先读取'fmt'中的所有object成员并检查数组长度, 读取位置不变
+  // 失败时释放已读取的子对象
+  int32_t read_fmt_prepare(const char* fmt, std::vector<CapsReader*>& subs);
+
+  // 以下next_*读取当前成员, 不检查成员类型, 由调用者预先检查
+  inline int32_t next32() {
+    return cur.next32(layout);
+  }
+
+  inline int64_t next64() {
+    return cur.next64(layout);
+  }
+
+  inline const char* next_string(uint32_t& len) {
+    return cur.next_string(layout, len);
+  }
+
+  inline const int8_t* next_binary(uint32_t& len) {
+    return cur.next_binary(layout, len);
+  }
+
+  inline int32_t read32(int32_t* r, char type) {
+    return cur.read32(layout, r, type);
+  }
+
+  inline int32_t read64(int64_t* r, char type) {
+    return cur.read64(layout, r, type);
+  }
+
+  // read_fields读取单个成员, 类型已检查
+  inline int32_t get(int32_t& r) {
+    r = next32();
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t get(uint32_t& r) {
+    r = next32();
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t get(float& r) {
+    int32_t v = next32();
+    memcpy(&r, &v, sizeof(r));
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t get(int64_t& r) {
+    r = next64();
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t get(uint64_t& r) {
+    r = next64();
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t get(double& r) {
+    caps_store64(&r, next64());
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t get(const char*& r) {
+    uint32_t len;
+    r = next_string(len);
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t get(std::string& r) {
+    uint32_t len;
+    const char* s = next_string(len);
+    r.assign(s, len);
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t get(std::vector<uint8_t>& r) {
+    uint32_t len;
+    const int8_t* p = next_binary(len);
+    r.assign(p, p + len);
+    return CAPS_SUCCESS;
+  }
+
+  template <typename T>
+  inline int32_t get(std::vector<T>& r) {
+    return read_array(r);
+  }
+
+  inline int32_t get(std::shared_ptr<Caps>& r) {
+    return read(r);
+  }
+
+  // 'depth'为子对象嵌套层数
+  template <typename V>
+  int32_t visit(V& v, uint32_t depth) {
+    int32_t r = CAPS_SUCCESS;
+    const char* s;
+    const int8_t* p;
+    uint32_t len;
+    float fv;
+    double dv;
+
+    while (r == CAPS_SUCCESS && !end_of_object()) {
+      switch (layout.member_declarations[-(int32_t)cur.pos.current_read_member]) {
+        case 'i':
+          r = v.on_integer(next32());
+          break;
+        case 'f':
+          get(fv);
+          r = v.on_float(fv);
+          break;
+        case 'l':
+          r = v.on_long(next64());
+          break;
+        case 'd':
+          get(dv);
+          r = v.on_double(dv);
+          break;
+        case 'S':
+          s = next_string(len);
+          r = v.on_string(s, len);
+          break;
+        case 'B':
+          p = next_binary(len);
+          r = v.on_binary(p, len);
+          break;
+        case 'O':
+          p = next_binary(len);
+          r = visit_object(v, p, len, depth);
+          break;
+        case 'V':
+          ++cur.pos.current_read_member;
+          r = v.on_void();
+          break;
+        case 'I':
+          r = visit_array<int32_t>(v);
+          break;
+        case 'F':
+          r = visit_array<float>(v);
+          break;
+        case 'L':
+          r = visit_array<int64_t>(v);
+          break;
+        case 'D':
+          r = visit_array<double>(v);
+          break;
+        default:
+          return CAPS_ERR_CORRUPTED;
+      }
+    }
+    return r;
+  }
+
+  template <typename V>
+  int32_t visit_object(V& v, const int8_t* p, uint32_t len, uint32_t depth) {
+    int32_t r = v.on_object_begin(p, len);
+    if (r == CAPS_VISIT_SKIP)
+      return CAPS_SUCCESS;
+    if (r != CAPS_SUCCESS)
+      return r;
+    if (len > 0) {
+      if (depth >= CAPS_MAX_DEPTH || len <= sizeof(Header))
+        return CAPS_ERR_CORRUPTED;
+      CapsReader sub;
+      r = sub.parse_buffer(p, len);
+      if (r == CAPS_SUCCESS)
+        r = sub.visit(v, depth + 1);
+      if (r != CAPS_SUCCESS)
+        return r;
+    }
+    return v.on_object_end();
+  }
+
+  // 字节序与本机不同或未按元素大小对齐时拷贝
+  template <typename T, typename V>
+  int32_t visit_array(V& v) {
+    if (layout.swap || (uintptr_t)cur.pos.binary_section % sizeof(T)) {
+      std::vector<T> a;
+      int32_t r = read_array(a);
+      if (r != CAPS_SUCCESS)
+        return r;
+      return v.on_array(a.data(), a.size());
+    }
+    if (cur.pos.bin_sizes[0] % sizeof(T))
+      return CAPS_ERR_CORRUPTED;
+    uint32_t len;
+    const T* p = reinterpret_cast<const T*>(next_binary(len));
+    return v.on_array(p, len / sizeof(T));
+  }
+
+private:
+  // parse得到的数据区位置, 可由share_from/CapsView共享
+  CapsLayout layout;
+  CapsCursorCore cur;
+
+  // parse(dup = true)时分配, 由此对象及其子对象共享
+  // 为空时bin_data指向调用者内存
+  std::shared_ptr<int8_t> store;
+  // store由此对象分配时为其长度, 否则为0
+  uint32_t store_size = 0;
+  // 此对象独占的空闲缓冲区
+  std::shared_ptr<int8_t> spare;
+  uint32_t spare_size = 0;
+};
+
+// 不拷贝parse, 'caps'为无其它引用的CapsReader时复用此对象
+// 失败时'caps'被置空
+int32_t caps_parse_reuse(const void* data, uint32_t length,
+    std::shared_ptr<Caps>& caps);
+
+} // namespace rokid
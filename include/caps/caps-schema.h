@@ -0,0 +1,618 @@
+#ifndef ROKID_MUTILS_CAPS_SCHEMA_H
+#define ROKID_MUTILS_CAPS_SCHEMA_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "caps-defs.h"
+
+// 编译期定义结构体的caps schema, 不经过Caps虚接口及Member对象直接序列化/反序列化
+// 各数据区的偏移在编译期确定, 生成的数据与Caps完全兼容:
+// 可由Caps::parse读取, 也可parse Caps序列化的数据(成员类型须一致)
+//
+// 支持的成员类型:
+//   int32_t uint32_t float        -- 'i' 'f'
+//   int64_t uint64_t double       -- 'l' 'd'
+//   std::string                   -- 'S'
+//   std::vector<uint8_t>          -- 'B'
+//   std::vector<int32_t/float/int64_t/double> -- 'I' 'F' 'L' 'D'
+//   定义了schema的结构体          -- 'O'
+//
+// 示例(CAPS_SCHEMA须在全局命名空间中使用, 最多32个成员):
+//   struct Point {
+//     int32_t x;
+//     std::string name;
+//     std::vector<float> feature;
+//   };
+//   CAPS_SCHEMA(Point, x, name, feature)
+//
+//   std::vector<int64_t> buf(caps_schema::binary_size(p) / 8);
+//   caps_schema::serialize(p, buf.data(), buf.size() * 8);
+//   caps_schema::parse(buf.data(), buf.size() * 8, p);
+
+namespace caps_schema {
+
+template <typename T>
+struct Schema {
+  static const bool defined = false;
+};
+
+template <typename... Ts>
+struct TypeList {
+  static const uint32_t size = sizeof...(Ts);
+};
+
+enum {
+  SECTION_NUMBER,
+  SECTION_LONG,
+  SECTION_BINARY,
+  SECTION_STRING,
+};
+
+template <typename T, typename Enable = void>
+struct Field;
+
+#define CAPS_SCHEMA_FIELD(T, t, s) \
+template <> struct Field<T> { \
+  static const char type = t; \
+  static const int section = s; \
+}
+
+CAPS_SCHEMA_FIELD(int32_t, 'i', SECTION_NUMBER);
+CAPS_SCHEMA_FIELD(uint32_t, 'i', SECTION_NUMBER);
+CAPS_SCHEMA_FIELD(float, 'f', SECTION_NUMBER);
+CAPS_SCHEMA_FIELD(int64_t, 'l', SECTION_LONG);
+CAPS_SCHEMA_FIELD(uint64_t, 'l', SECTION_LONG);
+CAPS_SCHEMA_FIELD(double, 'd', SECTION_LONG);
+CAPS_SCHEMA_FIELD(std::string, 'S', SECTION_STRING);
+CAPS_SCHEMA_FIELD(std::vector<uint8_t>, 'B', SECTION_BINARY);
+CAPS_SCHEMA_FIELD(std::vector<int32_t>, 'I', SECTION_BINARY);
+CAPS_SCHEMA_FIELD(std::vector<float>, 'F', SECTION_BINARY);
+CAPS_SCHEMA_FIELD(std::vector<int64_t>, 'L', SECTION_BINARY);
+CAPS_SCHEMA_FIELD(std::vector<double>, 'D', SECTION_BINARY);
+
+#undef CAPS_SCHEMA_FIELD
+
+template <typename T>
+struct Field<T, typename std::enable_if<Schema<T>::defined>::type> {
+  static const char type = 'O';
+  static const int section = SECTION_BINARY;
+};
+
+template <int S, typename L>
+struct SectionCount;
+
+template <int S>
+struct SectionCount<S, TypeList<> > {
+  static const uint32_t value = 0;
+};
+
+template <int S, typename T, typename... Ts>
+struct SectionCount<S, TypeList<T, Ts...> > {
+  static const uint32_t value = (Field<T>::section == S ? 1 : 0)
+    + SectionCount<S, TypeList<Ts...> >::value;
+};
+
+// 成员声明字符串, 按成员顺序排列
+template <typename L>
+struct Declarations;
+
+template <typename... Ts>
+struct Declarations<TypeList<Ts...> > {
+  static const char value[sizeof...(Ts) + 1];
+};
+
+template <typename... Ts>
+const char Declarations<TypeList<Ts...> >::value[sizeof...(Ts) + 1] = {
+  Field<Ts>::type..., '\0'
+};
+
+template <typename T>
+struct Layout {
+  typedef typename Schema<T>::types types;
+  static const uint32_t members = types::size;
+  static const uint32_t numbers = SectionCount<SECTION_NUMBER, types>::value;
+  static const uint32_t longs = SectionCount<SECTION_LONG, types>::value;
+  static const uint32_t binaries = SectionCount<SECTION_BINARY, types>::value;
+  static const uint32_t strings = SectionCount<SECTION_STRING, types>::value;
+  // header + long section + number section + binary sizes + string sizes
+  static const uint32_t fixed_size = 8 + longs * 8 + numbers * 4
+    + binaries * 4 + strings * 4;
+};
+
+namespace detail {
+
+inline uint32_t align8(uint32_t v) { return rokid::caps_bin_align(v, true); }
+
+template <bool Swap, typename T>
+inline void store(void* p, T v) {
+  if (sizeof(T) == 8) {
+    uint64_t u;
+    memcpy(&u, &v, 8);
+    if (Swap)
+      u = __builtin_bswap64(u);
+    memcpy(p, &u, 8);
+  } else {
+    uint32_t u;
+    memcpy(&u, &v, 4);
+    if (Swap)
+      u = __builtin_bswap32(u);
+    memcpy(p, &u, 4);
+  }
+}
+
+template <bool Swap, typename T>
+inline T load(const void* p) {
+  T v;
+  if (sizeof(T) == 8) {
+    uint64_t u;
+    memcpy(&u, p, 8);
+    if (Swap)
+      u = __builtin_bswap64(u);
+    memcpy(&v, &u, 8);
+  } else {
+    uint32_t u;
+    memcpy(&u, p, 4);
+    if (Swap)
+      u = __builtin_bswap32(u);
+    memcpy(&v, &u, 4);
+  }
+  return v;
+}
+
+template <bool Swap>
+inline void swap_array(uint8_t*, size_t) {
+}
+
+template <bool Swap, typename T>
+inline void swap_array(T* p, size_t n) {
+  size_t i;
+  if (!Swap)
+    return;
+  for (i = 0; i < n; ++i)
+    p[i] = load<true, T>(p + i);
+}
+
+template <typename T>
+uint32_t object_size(const T& o);
+
+template <bool Swap, typename T>
+void write_object(const T& o, int8_t* b, uint32_t total, uint8_t magic0);
+
+template <typename T, typename V>
+inline void visit(T& o, V& v) {
+  Schema<typename std::remove_const<T>::type>::visit(o, v);
+}
+
+// 计算binary section及string section长度
+struct SizeVisitor {
+  uint32_t bin = 0;
+  uint32_t str = 0;
+
+  template <typename T>
+  typename std::enable_if<Field<T>::section == SECTION_NUMBER
+    || Field<T>::section == SECTION_LONG>::type
+  operator()(T) {
+  }
+
+  void operator()(const std::string& v) {
+    str += v.length() + 1;
+  }
+
+  template <typename E>
+  typename std::enable_if<Field<std::vector<E> >::section == SECTION_BINARY>::type
+  operator()(const std::vector<E>& v) {
+    bin += align8(v.size() * sizeof(E));
+  }
+
+  template <typename O>
+  typename std::enable_if<Schema<O>::defined>::type operator()(const O& v) {
+    bin += align8(object_size(v));
+  }
+};
+
+template <bool Swap>
+struct WriteVisitor {
+  int8_t* lvalues;
+  int8_t* ivalues;
+  int8_t* bin_sizes;
+  int8_t* str_sizes;
+  int8_t* bin;
+  char* str;
+  uint8_t magic0;
+
+  template <typename T>
+  typename std::enable_if<Field<T>::section == SECTION_NUMBER>::type
+  operator()(T v) {
+    store<Swap>(ivalues, v);
+    ivalues += 4;
+  }
+
+  template <typename T>
+  typename std::enable_if<Field<T>::section == SECTION_LONG>::type
+  operator()(T v) {
+    store<Swap>(lvalues, v);
+    lvalues += 8;
+  }
+
+  void operator()(const std::string& v) {
+    store<Swap>(str_sizes, (uint32_t)v.length());
+    str_sizes += 4;
+    memcpy(str, v.c_str(), v.length() + 1);
+    str += v.length() + 1;
+  }
+
+  template <typename E>
+  typename std::enable_if<Field<std::vector<E> >::section == SECTION_BINARY>::type
+  operator()(const std::vector<E>& v) {
+    uint32_t length = v.size() * sizeof(E);
+    store<Swap>(bin_sizes, length);
+    bin_sizes += 4;
+    memcpy(bin, v.data(), length);
+    swap_array<Swap>(reinterpret_cast<E*>(bin), v.size());
+    memset(bin + length, 0, align8(length) - length);
+    bin += align8(length);
+  }
+
+  template <typename O>
+  typename std::enable_if<Schema<O>::defined>::type operator()(const O& v) {
+    uint32_t length = object_size(v);
+    store<Swap>(bin_sizes, length);
+    bin_sizes += 4;
+    write_object<Swap>(v, bin, length, magic0);
+    bin += align8(length);
+  }
+};
+
+template <bool Swap>
+struct ReadVisitor {
+  const int8_t* lvalues;
+  const int8_t* ivalues;
+  const int8_t* bin_sizes;
+  // v7之前的数据为nullptr, 以'\0'查找字符串结束
+  const int8_t* str_sizes;
+  // 字符串去重的数据(v8)为string offsets, 否则为nullptr
+  const int8_t* str_offsets;
+  const int8_t* bin;
+  const char* str;
+  const char* str_end;
+  bool align8;
+  int32_t result = CAPS_SUCCESS;
+
+  template <typename T>
+  typename std::enable_if<Field<T>::section == SECTION_NUMBER>::type
+  operator()(T& v) {
+    v = load<Swap, T>(ivalues);
+    ivalues += 4;
+  }
+
+  template <typename T>
+  typename std::enable_if<Field<T>::section == SECTION_LONG>::type
+  operator()(T& v) {
+    v = load<Swap, T>(lvalues);
+    lvalues += 8;
+  }
+
+  void operator()(std::string& v) {
+    const char* e;
+    if (str_offsets) {
+      // 'str'为string section起始, 不移动
+      uint32_t length = load<Swap, uint32_t>(str_sizes);
+      uint32_t off = load<Swap, uint32_t>(str_offsets);
+      str_sizes += 4;
+      str_offsets += 4;
+      if (off >= (size_t)(str_end - str)
+          || length >= (size_t)(str_end - str) - off
+          || str[off + length] != '\0') {
+        result = CAPS_ERR_CORRUPTED;
+        return;
+      }
+      v.assign(str + off, length);
+      return;
+    }
+    if (str_sizes) {
+      uint32_t length = load<Swap, uint32_t>(str_sizes);
+      str_sizes += 4;
+      if (length >= (size_t)(str_end - str) || str[length] != '\0') {
+        result = CAPS_ERR_CORRUPTED;
+        return;
+      }
+      e = str + length;
+    } else {
+      e = reinterpret_cast<const char*>(memchr(str, '\0', str_end - str));
+    }
+    if (e == nullptr) {
+      result = CAPS_ERR_CORRUPTED;
+      return;
+    }
+    v.assign(str, e - str);
+    str = e + 1;
+  }
+
+  // binary section长度已在parse时检查
+  const int8_t* next_binary(uint32_t& length) {
+    const int8_t* p = bin;
+    length = load<Swap, uint32_t>(bin_sizes);
+    bin_sizes += 4;
+    bin += rokid::caps_bin_align(length, align8);
+    return p;
+  }
+
+  template <typename E>
+  typename std::enable_if<Field<std::vector<E> >::section == SECTION_BINARY>::type
+  operator()(std::vector<E>& v) {
+    uint32_t length;
+    // 长度不是元素大小的整数倍时数据已损坏
+    if (load<Swap, uint32_t>(bin_sizes) % sizeof(E)) {
+      result = CAPS_ERR_CORRUPTED;
+      return;
+    }
+    const int8_t* p = next_binary(length);
+    v.resize(length / sizeof(E));
+    if (length == 0)
+      return;
+    memcpy(v.data(), p, length);
+    swap_array<Swap>(v.data(), v.size());
+  }
+
+  template <typename O>
+  typename std::enable_if<Schema<O>::defined>::type operator()(O& v);
+};
+
+template <typename T>
+uint32_t object_size(const T& o) {
+  typedef Layout<T> L;
+  SizeVisitor sv;
+  visit(o, sv);
+  return align8(align8(L::fixed_size) + sv.bin + sv.str + L::members
+      + rokid::caps_count_size(L::members));
+}
+
+template <bool Swap, typename T>
+void write_object(const T& o, int8_t* b, uint32_t total, uint8_t magic0) {
+  typedef Layout<T> L;
+  WriteVisitor<Swap> wv;
+  SizeVisitor sv;
+  uint32_t n = L::members;
+  char* decls = reinterpret_cast<char*>(b) + total;
+  uint32_t i;
+  uint8_t c;
+
+  visit(o, sv);
+  b[0] = magic0;
+  b[1] = 'A';
+  b[2] = 'P';
+  b[3] = CAPS_VERSION;
+  store<Swap>(b + 4, total);
+  wv.lvalues = b + 8;
+  wv.ivalues = wv.lvalues + L::longs * 8;
+  wv.bin_sizes = wv.ivalues + L::numbers * 4;
+  wv.str_sizes = wv.bin_sizes + L::binaries * 4;
+  wv.bin = b + align8(L::fixed_size);
+  wv.str = reinterpret_cast<char*>(wv.bin) + sv.bin;
+  wv.magic0 = magic0;
+  // 对齐填充置0
+  memset(wv.str_sizes + L::strings * 4, 0,
+      wv.bin - wv.str_sizes - L::strings * 4);
+  memset(wv.str + sv.str, 0, total - (wv.str - reinterpret_cast<char*>(b))
+      - sv.str - L::members - rokid::caps_count_size(L::members));
+  // 成员数量(varint, 从后向前)及逆序排列的成员声明
+  do {
+    c = n & 0x7f;
+    n >>= 7;
+    if (n)
+      c |= 0x80;
+    *--decls = c;
+  } while (n);
+  for (i = 0; i < L::members; ++i)
+    *--decls = Declarations<typename L::types>::value[i];
+  visit(o, wv);
+}
+
+template <bool Swap, typename T>
+int32_t read_object(const int8_t* b, uint32_t datasize, uint8_t version,
+    T& o) {
+  typedef Layout<T> L;
+  ReadVisitor<Swap> rv;
+  const char* decls = reinterpret_cast<const char*>(b) + datasize;
+  uint32_t limit = datasize - 8;
+  uint32_t n = 0;
+  uint32_t csize = 0;
+  uint32_t bin_sec_size = 0;
+  uint32_t i;
+  uint8_t c;
+
+  if (version >= CAPS_VARINT_COUNT_VERSION) {
+    do {
+      if (csize >= limit || csize >= CAPS_MAX_COUNT_SIZE)
+        return CAPS_ERR_CORRUPTED;
+      c = decls[-1 - (int32_t)csize];
+      n |= (uint32_t)(c & 0x7f) << (7 * csize);
+      ++csize;
+    } while (c & 0x80);
+  } else {
+    n = (uint8_t)decls[-1];
+    csize = 1;
+  }
+  if (n != L::members)
+    return n > limit - csize ? CAPS_ERR_CORRUPTED : CAPS_ERR_INCORRECT_TYPE;
+  // 成员声明只检查一次, 之后按编译期确定的偏移直接读取
+  decls -= csize;
+  for (i = 0; i < L::members; ++i) {
+    if (decls[-1 - (int32_t)i] != Declarations<typename L::types>::value[i])
+      return CAPS_ERR_INCORRECT_TYPE;
+  }
+  rv.align8 = version >= CAPS_ALIGN8_VERSION;
+  rv.lvalues = b + 8;
+  rv.ivalues = rv.lvalues + L::longs * 8;
+  rv.bin_sizes = rv.ivalues + L::numbers * 4;
+  rv.str_offsets = nullptr;
+  if ((uint8_t)b[0] & CAPS_FLAG_DEDUP_STRINGS) {
+    rv.str_sizes = rv.bin_sizes + L::binaries * 4;
+    rv.str_offsets = rv.str_sizes + L::strings * 4;
+    rv.bin = b + rokid::caps_bin_align(L::fixed_size + L::strings * 4,
+        rv.align8);
+  } else if (version >= CAPS_STRLEN_VERSION) {
+    rv.str_sizes = rv.bin_sizes + L::binaries * 4;
+    rv.bin = b + rokid::caps_bin_align(L::fixed_size, rv.align8);
+  } else {
+    rv.str_sizes = nullptr;
+    rv.bin = b + rokid::caps_bin_align(L::fixed_size - L::strings * 4,
+        rv.align8);
+  }
+  rv.str_end = decls - L::members;
+  if (reinterpret_cast<const char*>(rv.bin) > rv.str_end)
+    return CAPS_ERR_CORRUPTED;
+  for (i = 0; i < L::binaries; ++i) {
+    uint32_t length = load<Swap, uint32_t>(rv.bin_sizes + i * 4);
+    uint32_t remain = rv.str_end - reinterpret_cast<const char*>(rv.bin)
+      - bin_sec_size;
+    if (length > remain || rokid::caps_bin_align(length, rv.align8) > remain)
+      return CAPS_ERR_CORRUPTED;
+    bin_sec_size += rokid::caps_bin_align(length, rv.align8);
+  }
+  rv.str = reinterpret_cast<const char*>(rv.bin) + bin_sec_size;
+  visit(o, rv);
+  return rv.result;
+}
+
+} // namespace detail
+
+// 序列化后的数据长度(8字节对齐)
+template <typename T>
+inline uint32_t binary_size(const T& o) {
+  return detail::object_size(o);
+}
+
+// 与Caps::serialize相同, 'bufsize'不足时返回所需长度, 不写入数据
+// 'buf'须8字节对齐, 'flags'中的CAPS_FLAG_DEDUP_STRINGS被忽略
+template <typename T>
+int32_t serialize(const T& o, void* buf, uint32_t bufsize,
+    uint32_t flags = CAPS_FLAG_NET_BYTEORDER) {
+  uint32_t total = detail::object_size(o);
+  uint8_t magic0 = CAPS_MAGIC0 | (flags & CAPS_FLAG_NET_BYTEORDER);
+  if (buf == nullptr || bufsize < total)
+    return total;
+  if (rokid::caps_need_swap(flags))
+    detail::write_object<true>(o, reinterpret_cast<int8_t*>(buf), total, magic0);
+  else
+    detail::write_object<false>(o, reinterpret_cast<int8_t*>(buf), total, magic0);
+  return total;
+}
+
+// 成员数量或类型与schema不一致时返回CAPS_ERR_INCORRECT_TYPE
+// 数组长度不是元素大小的整数倍时返回CAPS_ERR_CORRUPTED
+// 长度为0的object成员(空对象)对应的嵌套结构体为其默认值O()
+template <typename T>
+int32_t parse(const void* data, uint32_t length, T& o) {
+  const int8_t* b = reinterpret_cast<const int8_t*>(data);
+  uint32_t datasize;
+
+  if (data == nullptr || length <= 8)
+    return CAPS_ERR_INVAL;
+  if ((b[0] & CAPS_MAGIC_MASK) != CAPS_MAGIC0
+      || b[1] != 'A' || b[2] != 'P')
+    return CAPS_ERR_CORRUPTED;
+  if (b[3] < CAPS_MIN_VERSION || b[3] > CAPS_VERSION)
+    return CAPS_ERR_VERSION_UNSUPP;
+  if (((uint8_t)b[0] & CAPS_FLAG_DEDUP_STRINGS)
+      && b[3] < CAPS_DEDUP_VERSION)
+    return CAPS_ERR_CORRUPTED;
+  bool swap = rokid::caps_need_swap((uint8_t)b[0]);
+  if (swap)
+    datasize = detail::load<true, uint32_t>(b + 4);
+  else
+    datasize = detail::load<false, uint32_t>(b + 4);
+  if (datasize != length)
+    return CAPS_ERR_CORRUPTED;
+  if (swap)
+    return detail::read_object<true>(b, datasize, b[3], o);
+  return detail::read_object<false>(b, datasize, b[3], o);
+}
+
+namespace detail {
+
+template <bool Swap>
+template <typename O>
+typename std::enable_if<Schema<O>::defined>::type
+ReadVisitor<Swap>::operator()(O& v) {
+  uint32_t length;
+  const int8_t* p = next_binary(length);
+  // 空对象(write空的shared_ptr<Caps>)读取为默认值
+  if (length == 0) {
+    v = O();
+    return;
+  }
+  int32_t r = caps_schema::parse(p, length, v);
+  if (r != CAPS_SUCCESS)
+    result = r;
+}
+
+} // namespace detail
+
+} // namespace caps_schema
+
+#define CAPS_SCHEMA_ARG_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, \
+    _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, \
+    _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define CAPS_SCHEMA_NARG(...) CAPS_SCHEMA_ARG_N(__VA_ARGS__, \
+    32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, \
+    16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define CAPS_SCHEMA_CAT_(a, b) a##b
+#define CAPS_SCHEMA_CAT(a, b) CAPS_SCHEMA_CAT_(a, b)
+
+// 对每个成员展开M(T, f), 以逗号分隔
+#define CAPS_SCHEMA_EACH_1(M, T, a) M(T, a)
+#define CAPS_SCHEMA_EACH_2(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_1(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_3(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_2(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_4(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_3(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_5(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_4(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_6(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_5(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_7(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_6(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_8(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_7(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_9(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_8(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_10(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_9(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_11(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_10(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_12(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_11(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_13(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_12(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_14(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_13(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_15(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_14(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_16(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_15(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_17(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_16(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_18(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_17(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_19(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_18(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_20(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_19(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_21(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_20(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_22(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_21(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_23(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_22(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_24(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_23(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_25(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_24(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_26(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_25(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_27(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_26(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_28(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_27(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_29(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_28(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_30(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_29(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_31(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_30(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH_32(M, T, a, ...) M(T, a), CAPS_SCHEMA_EACH_31(M, T, __VA_ARGS__)
+#define CAPS_SCHEMA_EACH(M, T, ...) \
+  CAPS_SCHEMA_CAT(CAPS_SCHEMA_EACH_, CAPS_SCHEMA_NARG(__VA_ARGS__))(M, T, __VA_ARGS__)
+
+#define CAPS_SCHEMA_TYPE(T, f) decltype(T::f)
+#define CAPS_SCHEMA_VISIT(o, f) v(o.f)
+
+// 定义结构体'T'的schema, 参数为成员名, 按序列化顺序排列
+#define CAPS_SCHEMA(T, ...) \
+namespace caps_schema { \
+template <> struct Schema<T> { \
+  static const bool defined = true; \
+  typedef TypeList<CAPS_SCHEMA_EACH(CAPS_SCHEMA_TYPE, T, __VA_ARGS__)> types; \
+  template <typename O, typename V> \
+  static void visit(O& o, V& v) { \
+    CAPS_SCHEMA_EACH(CAPS_SCHEMA_VISIT, o, __VA_ARGS__); \
+  } \
+}; \
+}
+
+#endif // ROKID_MUTILS_CAPS_SCHEMA_H
@@ -0,0 +1,131 @@
+#ifndef ROKID_MUTILS_CAPS_STREAM_H
+#define ROKID_MUTILS_CAPS_STREAM_H
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "caps.h"
+
+// 单个caps数据的最大长度, 超过此长度的数据视为格式错误
+#define CAPS_STREAM_MAX_FRAME_SIZE (16 * 1024 * 1024)
+
+// 从字节流中逐个解析caps数据
+// 流中为连续排列的caps序列化数据, 以header中的长度分帧
+//
+// 帧完整存放于输入数据的连续内存中时直接parse(duplicate = false), 不拷贝
+// 帧跨越输入数据块(或CircleStream内存尾端)时拷贝到内部缓冲区
+// next得到的caps对象直接引用输入数据或内部缓冲区,
+// 在下一次调用feed/next/reset之前有效, 需保存时应自行拷贝数据
+//
+// 示例:
+//   n = read(fd, buf, sizeof(buf));
+//   decoder.feed(buf, n);
+//   while (decoder.next(caps) == CAPS_SUCCESS) {
+//     ...
+//   }
+class CapsStreamDecoder {
+public:
+  explicit CapsStreamDecoder(uint32_t max_frame_size = CAPS_STREAM_MAX_FRAME_SIZE);
+
+  // 输入数据块, 不拷贝
+  // 'data'必须保持有效, 直到next返回CAPS_SUCCESS以外的值
+  // (输入数据末尾不完整的帧此时已拷贝到内部缓冲区)
+  void feed(const void* data, uint32_t length);
+
+  // 从feed输入的数据中取出下一个caps
+  // 返回CAPS_SUCCESS: 'caps'为只读caps对象
+  //                   'caps'为上次next得到的对象且无其它引用时, 复用此对象
+  // 返回CAPS_ERR_EOO: 数据不足, 需feed更多数据
+  // 返回CAPS_ERR_CORRUPTED/CAPS_ERR_VERSION_UNSUPP:
+  //   header不正确时无法继续分帧, 需reset
+  //   header正确而数据内容不正确时, 此帧被丢弃, 可继续调用next
+  int32_t next(std::shared_ptr<Caps>& caps);
+
+  // 从CircleStream(或提供相同peek/erase/size/capacity接口的类型)中取出下一个caps
+  // 帧在stream中连续时直接引用stream内存, 下一次调用next时才从stream中erase
+  // 帧跨越stream内存尾端时拷贝到内部缓冲区, 已写入的部分先行拷贝并erase,
+  // 因此帧可大于stream容量(不超过max_frame_size)
+  // 一次read系统调用写入stream的多个帧可通过多次next取出
+  template <typename Stream>
+  int32_t next(Stream& stream, std::shared_ptr<Caps>& caps) {
+    uint32_t size;
+    uint32_t length;
+    uint32_t n;
+    const void* p;
+    int32_t r;
+
+    if (stream_erase > 0) {
+      stream.erase(stream_erase);
+      stream_erase = 0;
+    }
+    release_buffer();
+    if (buffer.empty()) {
+      p = stream.peek(size);
+      if (p == nullptr || stream.size() < header_size())
+        return CAPS_ERR_EOO;
+      if (size >= header_size()) {
+        r = frame_length(p, length);
+        if (r != CAPS_SUCCESS)
+          return r;
+        if (length <= size && aligned(p)) {
+          stream_erase = length;
+          return parse_frame(p, length, caps);
+        }
+      }
+      // 帧不连续(或大于stream容量)时逐段拷贝到内部缓冲区
+    }
+    while (buffer_need() > 0) {
+      p = stream.peek(size);
+      if (p == nullptr)
+        return CAPS_ERR_EOO;
+      n = size < buffer_need() ? size : buffer_need();
+      r = append_buffer(p, n);
+      stream.erase(n);
+      if (r != CAPS_SUCCESS)
+        return r;
+    }
+    return parse_buffer(caps);
+  }
+
+  // 丢弃所有未解析的数据
+  void reset();
+
+  // 内部缓冲区中未完整的帧数据长度
+  uint32_t pending() const;
+
+private:
+  static uint32_t header_size();
+
+  static bool aligned(const void* p) {
+    return (reinterpret_cast<uintptr_t>(p) & 7) == 0;
+  }
+
+  int32_t frame_length(const void* data, uint32_t& length) const;
+
+  int32_t parse_frame(const void* data, uint32_t length,
+      std::shared_ptr<Caps>& caps);
+
+  // 内部缓冲区中的帧还需要的数据长度
+  // header不完整时为header剩余长度
+  uint32_t buffer_need() const;
+
+  int32_t append_buffer(const void* data, uint32_t length);
+
+  int32_t parse_buffer(std::shared_ptr<Caps>& caps);
+
+  // 上一次next得到的caps引用内部缓冲区, 清空缓冲区
+  void release_buffer();
+
+private:
+  const int8_t* chunk = nullptr;
+  uint32_t chunk_size = 0;
+  // 跨数据块的帧
+  std::vector<int8_t> buffer;
+  // 0: buffer中header不完整
+  uint32_t frame_size = 0;
+  bool buffer_ready = false;
+  uint32_t stream_erase = 0;
+  uint32_t max_frame_size;
+};
+
+#endif // ROKID_MUTILS_CAPS_STREAM_H
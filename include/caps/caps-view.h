@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "caps-reader.h"
+
+namespace rokid {
+
+class CapsCursor;
+
+// parse后不可变的caps数据, 可由多个线程共享
+// 读取位置由CapsCursor记录, 每个线程(或每次遍历)使用各自的cursor,
+// 无需Caps::convert或重新parse
+//
+// 示例:
+//   shared_ptr<CapsView> view;
+//   CapsView::parse(data, size, view);
+//   // 任意线程中
+//   CapsCursor cur = view->cursor();
+//   cur.read(v);
+class CapsView {
+public:
+  // 同Caps::parse, 'dup'为true时拷贝数据并转换为本机字节序
+  static int32_t parse(const void* data, uint32_t datasize,
+      std::shared_ptr<CapsView>& r, bool dup = true);
+
+  // 由已有的caps对象创建
+  // reader: 共享其数据(parse时dup = false则引用调用者内存, 须保持有效)
+  // writer: 序列化为本机字节序后创建
+  static int32_t create(const Caps& caps, std::shared_ptr<CapsView>& r);
+
+  inline uint32_t size() const { return reader.size(); }
+
+  // 同CapsReader::binary_data
+  inline const void* binary_data() const { return reader.binary_data(); }
+
+  inline uint32_t binary_size() const { return reader.binary_size(); }
+
+  // 第'index'个成员的类型, 越界时返回'\0'
+  int8_t member_type(uint32_t index) const;
+
+  // 读取位置为第一个成员
+  CapsCursor cursor() const;
+
+  // 读取位置为第'index'个成员(首次调用时建立成员索引)
+  int32_t cursor(uint32_t index, CapsCursor& r) const;
+
+private:
+  // 成员索引只建立一次, 多线程调用安全
+  void ensure_index() const;
+
+  inline const CapsLayout& layout() const { return reader.layout; }
+
+  // 子对象共享此对象的数据, 为空时引用调用者内存
+  inline const std::shared_ptr<int8_t>& store() const { return reader.store; }
+
+private:
+  // 持有数据, 只使用parse得到的数据区位置, 读取位置由CapsCursor记录
+  CapsReader reader;
+  mutable std::once_flag index_once;
+
+  friend class CapsCursor;
+};
+
+// CapsView的读取位置, 只包含数个指针, 可随意拷贝
+// 不同cursor可在不同线程中同时读取同一CapsView
+// CapsView必须在cursor使用期间保持有效
+class CapsCursor {
+public:
+  CapsCursor() = default;
+
+  inline int32_t read(int32_t& r) {
+    return cur.read32(layout(), &r, 'i');
+  }
+
+  inline int32_t read(uint32_t& r) {
+    return cur.read32(layout(), reinterpret_cast<int32_t*>(&r), 'i');
+  }
+
+  inline int32_t read(float& r) {
+    return cur.read32(layout(), reinterpret_cast<int32_t*>(&r), 'f');
+  }
+
+  inline int32_t read(int64_t& r) {
+    return cur.read64(layout(), &r, 'l');
+  }
+
+  inline int32_t read(uint64_t& r) {
+    return cur.read64(layout(), reinterpret_cast<int64_t*>(&r), 'l');
+  }
+
+  inline int32_t read(double& r) {
+    return cur.read64(layout(), reinterpret_cast<int64_t*>(&r), 'd');
+  }
+
+  int32_t read(const char*& r);
+  int32_t read_string(const char*& r, uint32_t& len);
+  int32_t read(std::string& r);
+  int32_t read(const void*& r, uint32_t& len);
+  int32_t read(std::vector<uint8_t>& r);
+  // 子对象与此对象共享数据
+  int32_t read(std::shared_ptr<CapsView>& r);
+  int32_t read();
+  // 不拷贝, 数据字节序与本机不同时返回CAPS_ERR_BYTEORDER,
+  // 未按元素大小对齐时返回CAPS_ERR_INVAL
+  int32_t read_array(const int32_t*& r, uint32_t& count);
+  int32_t read_array(const float*& r, uint32_t& count);
+  int32_t read_array(const int64_t*& r, uint32_t& count);
+  int32_t read_array(const double*& r, uint32_t& count);
+  int32_t read_array(std::vector<int32_t>& r);
+  int32_t read_array(std::vector<float>& r);
+  int32_t read_array(std::vector<int64_t>& r);
+  int32_t read_array(std::vector<double>& r);
+
+  int32_t next_type() const;
+  int32_t seek(uint32_t index);
+  int32_t skip(uint32_t n);
+
+  inline bool end_of_object() const {
+    return cur.end_of_object(layout());
+  }
+
+  inline int8_t current_member_type() const {
+    return cur.current_member_type(layout());
+  }
+
+private:
+  explicit CapsCursor(const CapsView* v) : view(v) {
+    cur.pos = v->layout().origin;
+  }
+
+  // 未关联CapsView时使用空的layout, 读取返回CAPS_ERR_EOO
+  inline const CapsLayout& layout() const {
+    return view ? view->layout() : empty_layout;
+  }
+
+private:
+  static const CapsLayout empty_layout;
+
+  const CapsView* view = nullptr;
+  // 读取操作与CapsReader相同
+  CapsCursorCore cur;
+
+  friend class CapsView;
+};
+
+} // namespace rokid
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "caps-defs.h"
+#include "caps.h"
+
+namespace rokid {
+
+// 可直接在栈上构造, 通过CapsWriter类型调用时编译器可内联数值成员的写入
+// 仍可作为Caps使用(Caps::new_instance)
+// binary_size/serialize不修改成员, 可在多个线程中同时调用,
+// 但不能与此对象(及其writer子对象)的写入同时进行
+class CapsWriter final : public Caps {
+public:
+  CapsWriter();
+
+  // 拷贝'o'的所有成员, writer子对象与'o'共享
+  CapsWriter(const CapsWriter& o);
+
+  ~CapsWriter() noexcept;
+
+  // 在此对象末尾追加'o'的所有成员(同append, 忽略错误)
+  CapsWriter& operator = (const Caps& o);
+
+  // 在此对象末尾追加'o'的所有成员, reader从当前读取位置开始,
+  // 其object成员作为与其共享数据的reader子对象写入, 不拷贝
+  // 'o'的数据不正确时返回错误码, 此对象不变
+  int32_t append(const Caps& o);
+
+  // 替换为'o'的所有成员(同拷贝构造), writer子对象与'o'共享
+  CapsWriter& operator = (const CapsWriter& o);
+
+  // 与'src'共享成员数据(Caps::convert), 不拷贝
+  // 'src'的成员数据移入共享的只读writer, 'src'内部被修改但内容不变,
+  // 此对象或'src'再次修改时才拷贝(copy on write)
+  // 之后两者可在不同线程中各自读写
+  void share_from(CapsWriter& src);
+
+  // override from 'Caps'
+  inline int32_t write(int32_t v) {
+    add_member('i').value.i = v;
+    ++number_member_number;
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t write(uint32_t v) {
+    return write((int32_t)v);
+  }
+
+  inline int32_t write(int64_t v) {
+    add_member('l').value.l = v;
+    ++long_member_number;
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t write(uint64_t v) {
+    return write((int64_t)v);
+  }
+
+  inline int32_t write(float v) {
+    add_member('f').value.f = v;
+    ++number_member_number;
+    return CAPS_SUCCESS;
+  }
+
+  inline int32_t write(double v) {
+    add_member('d').value.d = v;
+    ++long_member_number;
+    return CAPS_SUCCESS;
+  }
+
+  int32_t write(const char* v);
+  int32_t write(const std::string& v);
+  int32_t write(const void* v, uint32_t l);
+  int32_t write(const std::vector<uint8_t>& v);
+  int32_t write(std::string&& v);
+  int32_t write(std::vector<uint8_t>&& v);
+  int32_t write_string(const char* v, uint32_t len);
+  int32_t write(std::shared_ptr<Caps>& v);
+  int32_t write_ref(const char* v);
+  int32_t write_ref(const void* v, uint32_t l);
+  int32_t write_array(const int32_t* v, uint32_t count);
+  int32_t write_array(const float* v, uint32_t count);
+  int32_t write_array(const int64_t* v, uint32_t count);
+  int32_t write_array(const double* v, uint32_t count);
+  using Caps::write_array;
+  int32_t write();
+  // 清空所有成员, 保留已分配的内存, 用于复用此对象
+  void reset();
+  // c api: 将'o'序列化后作为binary成员写入, 直接序列化到arena中
+  int32_t write_binary_object(const Caps* o);
+  // c api: 按'fmt'批量写入(格式见caps_write_fmt)
+  // 'fmt'包含未知类型或参数不正确时返回CAPS_ERR_INVAL, 不写入任何成员
+  int32_t write_fmt(const char* fmt, va_list ap);
+
+  // 批量写入, 参数可为数值, 字符串, std::vector<uint8_t>,
+  // 数值std::vector(作为数组)及std::shared_ptr<Caps>
+  template <typename T, typename... Args>
+  int32_t write_fields(const T& v, const Args&... args) {
+    int32_t r = put(v);
+    int32_t rs[] = { r, (r == CAPS_SUCCESS ? (r = put(args)) : r)... };
+    (void)rs;
+    return r;
+  }
+  int32_t serialize(void* buf, uint32_t bufsize,
+      uint32_t flags = CAPS_FLAG_NET_BYTEORDER) const;
+  int32_t serialize_iov(std::vector<struct iovec>& iov, std::string& buf,
+      uint32_t flags = CAPS_FLAG_NET_BYTEORDER,
+      uint32_t threshold = CAPS_IOV_REF_THRESHOLD) const;
+  int32_t serialize_append(std::string& buf,
+      uint32_t flags = CAPS_FLAG_NET_BYTEORDER) const;
+  int32_t serialize_append(std::vector<uint8_t>& buf,
+      uint32_t flags = CAPS_FLAG_NET_BYTEORDER) const;
+  // c api: 同caps_serialize_realloc, 只计算一次长度
+  // realloc失败时返回CAPS_ERR_NOMEM, '*buf'及'*bufsize'不变
+  int32_t serialize_realloc(void** buf, uint32_t* bufsize,
+      uint32_t flags = CAPS_FLAG_NET_BYTEORDER) const;
+  // 序列化为本机字节序并创建reader(同CapsReader::parse(const CapsWriter&))
+  // 用于进程内传递, 只分配及拷贝一次
+  int32_t to_reader(std::shared_ptr<Caps>& r) const;
+
+  int32_t read(int32_t& v) { return CAPS_ERR_WRONLY; }
+  int32_t read(uint32_t& v) { return CAPS_ERR_WRONLY; }
+  int32_t read(float& v) { return CAPS_ERR_WRONLY; }
+  int32_t read(int64_t& v) { return CAPS_ERR_WRONLY; }
+  int32_t read(uint64_t& v) { return CAPS_ERR_WRONLY; }
+  int32_t read(double& v) { return CAPS_ERR_WRONLY; }
+  int32_t read(const char*& v) { return CAPS_ERR_WRONLY; }
+  int32_t read(std::string& v) { return CAPS_ERR_WRONLY; }
+  int32_t read_string(const char*& r, uint32_t& len) { return CAPS_ERR_WRONLY; }
+  int32_t read(const void*& r, uint32_t& size) { return CAPS_ERR_WRONLY; }
+  int32_t read(std::vector<uint8_t>& v) { return CAPS_ERR_WRONLY; }
+  int32_t read_string(std::string& v) { return CAPS_ERR_WRONLY; }
+  int32_t read_binary(std::string& v) { return CAPS_ERR_WRONLY; }
+  int32_t read(std::shared_ptr<Caps>& v) { return CAPS_ERR_WRONLY; }
+  int32_t read_array(const int32_t*& r, uint32_t& count) { return CAPS_ERR_WRONLY; }
+  int32_t read_array(const float*& r, uint32_t& count) { return CAPS_ERR_WRONLY; }
+  int32_t read_array(const int64_t*& r, uint32_t& count) { return CAPS_ERR_WRONLY; }
+  int32_t read_array(const double*& r, uint32_t& count) { return CAPS_ERR_WRONLY; }
+  int32_t read_array(std::vector<int32_t>& r) { return CAPS_ERR_WRONLY; }
+  int32_t read_array(std::vector<float>& r) { return CAPS_ERR_WRONLY; }
+  int32_t read_array(std::vector<int64_t>& r) { return CAPS_ERR_WRONLY; }
+  int32_t read_array(std::vector<double>& r) { return CAPS_ERR_WRONLY; }
+  int32_t read() { return CAPS_ERR_WRONLY; }
+  int32_t seek(uint32_t index) { return CAPS_ERR_WRONLY; }
+  int32_t skip(uint32_t n) { return CAPS_ERR_WRONLY; }
+
+  int32_t type() const { return CAPS_TYPE_WRITER; }
+  uint32_t binary_size() const;
+  inline uint32_t size() const {
+    return frozen ? frozen->size() : members.size();
+  }
+  int32_t next_type() const { return CAPS_ERR_WRONLY; }
+
+private:
+  class IovBuilder;
+  class StringDedup;
+  struct WritePointer;
+
+  enum {
+    MEMBER_FLAG_REF = 1,
+    MEMBER_FLAG_OWNED = 2
+  };
+
+  // 成员记录, 按写入顺序连续存放
+  // 字符串, 二进制及数组数据存放于arena中, value.offset为其偏移
+  // 数组成员的length为数据字节数
+  // 以write_ref写入的字符串及二进制数据(MEMBER_FLAG_REF), value.ref指向调用者内存
+  // 以右值写入的字符串及二进制数据(MEMBER_FLAG_OWNED)直接接管调用者的内存,
+  // value.offset为owned_strings/owned_binaries下标
+  // object成员的value.offset为sub_objects下标
+  struct MemberRecord {
+    char type;
+    uint8_t flags;
+    uint32_t length;
+    union {
+      int32_t i;
+      float f;
+      int64_t l;
+      double d;
+      uint32_t offset;
+      const void* ref;
+    } value;
+  };
+
+  void copy_from_writer(CapsWriter* dst, const CapsWriter* src);
+
+  uint32_t arena_append(const void* data, uint32_t length, bool terminate);
+
+  const void* member_data(const MemberRecord* m) const;
+
+  inline MemberRecord& add_member(char type) {
+    if (frozen)
+      unfreeze();
+    members.emplace_back();
+    members.back().type = type;
+    invalidate_size();
+    return members.back();
+  }
+
+  int32_t write_array(char type, const void* v, uint32_t count);
+
+  // write_fields写入单个成员
+  template <typename T>
+  inline int32_t put(const T& v) {
+    return write(v);
+  }
+
+  inline int32_t put(const std::vector<int32_t>& v) {
+    return write_array(v.data(), v.size());
+  }
+
+  inline int32_t put(const std::vector<float>& v) {
+    return write_array(v.data(), v.size());
+  }
+
+  inline int32_t put(const std::vector<int64_t>& v) {
+    return write_array(v.data(), v.size());
+  }
+
+  inline int32_t put(const std::vector<double>& v) {
+    return write_array(v.data(), v.size());
+  }
+
+  inline int32_t put(const std::shared_ptr<Caps>& v) {
+    std::shared_ptr<Caps> o(v);
+    return write(o);
+  }
+
+  // 将成员数据移入共享的writer并返回, 此对象之后只读取共享的数据
+  std::shared_ptr<CapsWriter> share();
+
+  // 修改前拷贝共享的数据, 不再共享
+  void unfreeze();
+
+  // binary section相对对象起始的偏移, 按8字节对齐
+  // 'dedup'为true时包含string offsets
+  uint32_t bin_section_offset(bool dedup = false) const;
+
+  // 'flags'包含CAPS_FLAG_DEDUP_STRINGS时先计算去重后各字符串的偏移
+  // 返回序列化数据长度
+  uint32_t serialized_size(uint32_t flags, StringDedup& dedup) const;
+
+  // binary_size缓存失效, 并通知所有包含此对象的父对象
+  // 如果已经dirty, 所有包含此对象的父对象必定也是dirty
+  inline void invalidate_size() {
+    if (!size_dirty)
+      invalidate_parents();
+  }
+
+  void invalidate_parents();
+
+  // parents的修改及遍历均加锁, 见writer.cc parents_mutex
+  void add_parent(CapsWriter* parent);
+
+  void remove_parent(const CapsWriter* parent);
+
+  // 解除与所有writer子对象的父子关系
+  void detach_sub_objects();
+
+  void serialize_iov(IovBuilder& builder, uint32_t total_size,
+      uint32_t flags) const;
+
+  // 'buf'长度为'total_size', 不再检查
+  void serialize_to(void* buf, uint32_t total_size, uint32_t flags,
+      const StringDedup& dedup) const;
+
+  template <typename T>
+  int32_t append_to(T& buf, uint32_t flags) const;
+
+  template <bool Swap>
+  static void serialize_object(const std::shared_ptr<Caps>& value,
+      WritePointer* wp, uint32_t flags);
+
+  static void write_header(Header* header, uint32_t total_size,
+      uint32_t flags);
+
+  // 按字节序分别生成, 每个对象只判断一次字节序
+  template <bool Swap>
+  void serialize_members(WritePointer* wp, uint32_t flags) const;
+
+  // 写入long/number section及binary/string sizes
+  template <bool Swap>
+  void serialize_fixed(Header* header) const;
+
+private:
+  std::vector<MemberRecord> members;
+  std::vector<int8_t> arena;
+  std::vector<std::string> owned_strings;
+  std::vector<std::vector<uint8_t> > owned_binaries;
+  std::vector<std::shared_ptr<Caps> > sub_objects;
+  uint32_t number_member_number = 0;
+  uint32_t long_member_number = 0;
+  uint32_t string_member_number = 0;
+  uint32_t binary_object_member_number = 0;
+  uint32_t binary_section_size = 0;
+  uint32_t string_section_size = 0;
+  // binary_size的缓存, 多个线程同时binary_size时各自计算并写入相同的值
+  mutable std::atomic<uint32_t> object_data_size{0};
+  mutable std::atomic<uint32_t> cached_size{0};
+  mutable std::atomic<bool> size_dirty{true};
+  // 以write(shared_ptr<Caps>&)包含此对象的writer
+  std::vector<CapsWriter*> parents;
+  // 不为空时成员数据由frozen保存, 与其它writer共享, 此对象自身的成员为空
+  // 此对象在frozen的parents中, 以接收其binary_size的变化
+  std::shared_ptr<CapsWriter> frozen;
+};
+
+} // namespace rokid
@@ -3,7 +3,7 @@
 
 #include <stdint.h>
 
-#define CAPS_VERSION 4
+#define CAPS_VERSION 8
 
 #define CAPS_SUCCESS 0
 #define CAPS_ERR_INVAL -1  // 参数非法
@@ -13,6 +13,10 @@
 #define CAPS_ERR_RDONLY -5  // write的caps对象不可写(通过caps_parse创建的caps对象只读)
 #define CAPS_ERR_INCORRECT_TYPE -6  // read类型不匹配
 #define CAPS_ERR_EOO -7  // 没有更多的成员变量了，read结束(End of Object)
+#define CAPS_ERR_BYTEORDER -8  // 数组数据字节序与本机不同, 不能直接引用(需拷贝读取)
+#define CAPS_ERR_IO -9  // 文件读写失败, 详见errno
+#define CAPS_ERR_UNSUPP -10  // caps对象不支持此操作(非CapsWriter/CapsReader的Caps派生类)
+#define CAPS_ERR_NOMEM -11  // 内存分配失败
 
 #define CAPS_TYPE_WRITER 0
 #define CAPS_TYPE_READER 1
@@ -25,12 +29,22 @@
 #define CAPS_MEMBER_TYPE_BINARY 'B'
 #define CAPS_MEMBER_TYPE_OBJECT 'O'
 #define CAPS_MEMBER_TYPE_VOID 'V'
+#define CAPS_MEMBER_TYPE_INTEGER_ARRAY 'I'
+#define CAPS_MEMBER_TYPE_FLOAT_ARRAY 'F'
+#define CAPS_MEMBER_TYPE_LONG_ARRAY 'L'
+#define CAPS_MEMBER_TYPE_DOUBLE_ARRAY 'D'
 
 #define CAPS_FLAG_NET_BYTEORDER 0x80
+// serialize时相同的字符串只存放一次(v8), 只作用于此对象自身的字符串成员
+#define CAPS_FLAG_DEDUP_STRINGS 0x40
+
+// serialize_iov默认参数: 不小于此长度的字符串/二进制数据直接引用, 不拷贝
+#define CAPS_IOV_REF_THRESHOLD 256
 
 typedef intptr_t caps_t;
 
 #ifdef __cplusplus
+#include <sys/uio.h>
 #include <memory>
 #include <string>
 #include <vector>
@@ -80,16 +94,148 @@ public:
   virtual int32_t write() = 0;
   virtual int32_t read() = 0;
 
+  // 以下为后续加入的接口, 均追加在虚函数表末尾且有默认实现,
+  // 不影响已有的Caps派生类; CapsWriter/CapsReader之外的派生类返回CAPS_ERR_UNSUPP
+
+  // 接管'v'的内存, 不拷贝
+  // 临时对象优先匹配以下重载, 未实现的派生类转为const&版本(拷贝)
+  virtual int32_t write(std::string&& v) {
+    return write(static_cast<const std::string&>(v));
+  }
+  virtual int32_t write(std::vector<uint8_t>&& v) {
+    return write(static_cast<const std::vector<uint8_t>&>(v));
+  }
+  // 写入长度为'len'的字符串, 不再计算strlen, 'v'中可包含'\0'
+  virtual int32_t write_string(const char* v, uint32_t len) {
+    return CAPS_ERR_UNSUPP;
+  }
+  // 以引用方式写入字符串/二进制数据, 只记录指针及长度, serialize时才拷贝
+  // 'v'指向的内存必须保持有效且内容不变, 直到最后一次serialize完成
+  virtual int32_t write_ref(const char* v) { return CAPS_ERR_UNSUPP; }
+  virtual int32_t write_ref(const void* v, uint32_t len) {
+    return CAPS_ERR_UNSUPP;
+  }
+  // 数值数组, 作为一个成员连续存储, 'count'为元素个数
+  virtual int32_t write_array(const int32_t* v, uint32_t count) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t write_array(const float* v, uint32_t count) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t write_array(const int64_t* v, uint32_t count) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t write_array(const double* v, uint32_t count) {
+    return CAPS_ERR_UNSUPP;
+  }
+  template <typename T>
+  int32_t write_array(const std::vector<T>& v) {
+    return write_array(v.data(), (uint32_t)v.size());
+  }
+  // 序列化为iovec数组, 可直接用于writev/sendmsg
+  // header, 数值区, 成员声明及小于'threshold'的数据写入'buf'
+  // 不小于'threshold'的字符串/二进制数据及reader子对象直接引用其所在内存
+  // 'iov'在'buf'被修改, 或此对象(及子对象)被修改/销毁之前有效
+  // 返回序列化数据总长度或错误码
+  virtual int32_t serialize_iov(std::vector<struct iovec>& iov,
+      std::string& buf, uint32_t flags = CAPS_FLAG_NET_BYTEORDER,
+      uint32_t threshold = CAPS_IOV_REF_THRESHOLD) const {
+    return CAPS_ERR_UNSUPP;
+  }
+  // 序列化并追加到'buf'末尾, 只计算一次长度, 'buf'长度不足时扩展
+  // 'buf'可长期复用(clear后再次追加), 避免每次分配内存
+  // 追加位置应4字节对齐, 连续追加的caps数据长度均为8的倍数
+  // 返回追加的数据长度或错误码
+  virtual int32_t serialize_append(std::string& buf,
+      uint32_t flags = CAPS_FLAG_NET_BYTEORDER) const {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t serialize_append(std::vector<uint8_t>& buf,
+      uint32_t flags = CAPS_FLAG_NET_BYTEORDER) const {
+    return CAPS_ERR_UNSUPP;
+  }
+
+  // 同时得到字符串长度(不含结束符), 字符串可包含'\0'
+  virtual int32_t read_string(const char*& r, uint32_t& len) {
+    return CAPS_ERR_UNSUPP;
+  }
+  // 读取数组, 不拷贝, 'r'指向caps数据内部, 按元素大小对齐
+  // 数据字节序与本机不同时返回CAPS_ERR_BYTEORDER, 读取位置不变
+  // (parse时duplicate = true会预先转换字节序, 不会出现此情况)
+  // parse(duplicate = false)的缓冲区未按元素大小对齐时数组可能未对齐,
+  // 返回CAPS_ERR_INVAL, 读取位置不变, 应使用拷贝的vector版本
+  virtual int32_t read_array(const int32_t*& r, uint32_t& count) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t read_array(const float*& r, uint32_t& count) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t read_array(const int64_t*& r, uint32_t& count) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t read_array(const double*& r, uint32_t& count) {
+    return CAPS_ERR_UNSUPP;
+  }
+  // 读取数组, 拷贝并转换为本机字节序
+  virtual int32_t read_array(std::vector<int32_t>& r) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t read_array(std::vector<float>& r) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t read_array(std::vector<int64_t>& r) {
+    return CAPS_ERR_UNSUPP;
+  }
+  virtual int32_t read_array(std::vector<double>& r) {
+    return CAPS_ERR_UNSUPP;
+  }
+  // 随机读取, 首次调用时建立成员偏移索引, 之后为O(1)
+  // 移动读取位置到第'index'个成员, index == size()时移动到对象末尾
+  virtual int32_t seek(uint32_t index) { return CAPS_ERR_UNSUPP; }
+  // 跳过'n'个成员
+  virtual int32_t skip(uint32_t n) { return CAPS_ERR_UNSUPP; }
+  // 读取第'index'个成员, 读取位置随之移动到下一个成员
+  template <typename... Args>
+  int32_t read_at(uint32_t index, Args&... args) {
+    int32_t r = seek(index);
+    if (r != CAPS_SUCCESS)
+      return r;
+    return read(args...);
+  }
+
   // create WRONLY Caps
   static std::shared_ptr<Caps> new_instance();
 
   // create RDONLY Caps
+  // duplicate = true: 拷贝'data', 子对象与父对象共享此拷贝
+  // duplicate = false: 不拷贝'data', 此对象直接引用'data'
+  //                    'data'必须在此对象销毁前保持有效
+  //                    read得到的子对象各自拷贝其数据, 不引用'data'
   static int32_t parse(const void* data, uint32_t length,
       std::shared_ptr<Caps>& caps, bool duplicate = true);
 
+  // 设置当前线程new_instance/parse使用的对象池容量, 默认为0(不使用对象池)
+  // 池中的对象不再被外部引用后, 由之后的new_instance/parse reset后复用,
+  // 复用reader时同时复用其拷贝数据(duplicate = true)的缓冲区
+  // 池中的对象可交给其它线程使用并在其中释放, 但不能以weak_ptr持有
+  static void set_pool_capacity(uint32_t capacity);
+
+  // 一次线性扫描检查数据的完整结构(各数据区边界, binary及数组长度,
+  // 字符串结束符, object子对象), 不分配内存
+  // 以caps header开始且长度一致的binary成员(c api写入的子对象)同样作为对象检查
+  // 用于不可信的输入: 检查通过后, parse得到的对象(含子对象, 及read_object
+  // 由binary成员得到的对象)的所有read均不会越界访问
+  static int32_t validate(const void* data, uint32_t length);
+
   // 同c api: caps_binary_info
   static int32_t binary_info(const void* data, uint32_t* version, uint32_t* length);
 
+  // caps_t与shared_ptr<Caps>互相转换, 转换结果与原对象共享数据, 不拷贝
+  // reader: 共享parse的数据, 读取位置为第一个成员
+  //         (parse时dup = false则拷贝数据)
+  // writer: 共享成员数据, 任一方再次写入时才拷贝
+  //         原对象的成员数据移入共享的只读快照(内容不变, 因此修改了原对象),
+  //         转换结果与原对象可在不同线程中各自读写
   static std::shared_ptr<Caps> convert(caps_t caps);
 
   static caps_t convert(std::shared_ptr<Caps>& caps);
@@ -104,10 +250,23 @@ caps_t caps_create();
 // parse创建的caps_t对象可读，不可写
 int32_t caps_parse(const void* data, uint32_t length, caps_t* result);
 
+// 同Caps::validate, 检查通过返回CAPS_SUCCESS
+int32_t caps_validate(const void* data, uint32_t length);
+
 // 如果serialize生成的数据长度大于'bufsize'，将返回所需的buf size，
 // 但'buf'不会写入任何数据，需外部重新分配更大的buf，再次调用serialize
 int32_t caps_serialize(caps_t caps, void* buf, uint32_t bufsize);
 
+// 序列化到'*buf', '*bufsize'不足时以realloc扩展'*buf'并更新'*bufsize'
+// '*buf'可为NULL('*bufsize'为0), 须由调用者free
+// realloc失败时返回CAPS_ERR_NOMEM, '*buf'及'*bufsize'不变
+// 返回序列化数据长度或错误码
+int32_t caps_serialize_realloc(caps_t caps, void** buf, uint32_t* bufsize);
+
+// 由create创建的'caps'生成可读的caps_t对象, 等同serialize后caps_parse,
+// 但只分配及拷贝一次, 且无需字节序转换; 'caps'不变, 仍可写入
+int32_t caps_to_reader(caps_t caps, caps_t* result);
+
 int32_t caps_write_integer(caps_t caps, int32_t v);
 
 int32_t caps_write_long(caps_t caps, int64_t v);
@@ -122,8 +281,23 @@ int32_t caps_write_binary(caps_t caps, const void* data, uint32_t length);
 
 int32_t caps_write_object(caps_t caps, caps_t v);
 
+// 以引用方式写入, 不拷贝数据
+// 'v'/'data'必须保持有效且内容不变, 直到最后一次caps_serialize完成
+int32_t caps_write_string_ref(caps_t caps, const char* v);
+
+int32_t caps_write_binary_ref(caps_t caps, const void* data, uint32_t length);
+
 int32_t caps_write_void(caps_t caps);
 
+// 数值数组, 'count'为元素个数
+int32_t caps_write_integer_array(caps_t caps, const int32_t* v, uint32_t count);
+
+int32_t caps_write_long_array(caps_t caps, const int64_t* v, uint32_t count);
+
+int32_t caps_write_float_array(caps_t caps, const float* v, uint32_t count);
+
+int32_t caps_write_double_array(caps_t caps, const double* v, uint32_t count);
+
 int32_t caps_read_integer(caps_t caps, int32_t* r);
 
 int32_t caps_read_long(caps_t caps, int64_t* r);
@@ -134,12 +308,51 @@ int32_t caps_read_double(caps_t caps, double* r);
 
 int32_t caps_read_string(caps_t caps, const char** r);
 
+int32_t caps_read_string_len(caps_t caps, const char** r, uint32_t* length);
+
+// 按'fmt'批量写入/读取多个成员, 每个字符为一个成员类型, 对应参数如下:
+//        write                        read
+// 'i'    int32_t                      int32_t*
+// 'f'    double(float参数自动提升)    float*
+// 'l'    int64_t                      int64_t*
+// 'd'    double                       double*
+// 'S'    const char*                  const char**
+// 'B'    const void*, uint32_t长度    const void**, uint32_t*长度
+// 'O'    caps_t                       caps_t*(须caps_destroy)
+// 'V'    无                           无
+// 'I'    const int32_t*, uint32_t个数 const int32_t**, uint32_t*个数
+//        ('F' 'L' 'D'同'I', 元素类型分别为float, int64_t, double)
+// caps_write_fmt先检查所有类型及参数('S'为NULL, 数据为NULL但长度不为0等),
+// 不正确时返回CAPS_ERR_INVAL, 不写入任何成员
+// caps_read_fmt先一次检查所有成员类型, 不匹配时返回CAPS_ERR_INCORRECT_TYPE
+// (数组字节序与本机不同时返回CAPS_ERR_BYTEORDER, 未按元素大小对齐时
+// 返回CAPS_ERR_INVAL), 之后读取所有'O'成员,
+// 子对象数据不正确时返回错误码; 失败时不读取任何成员, 也不输出任何caps_t
+int32_t caps_write_fmt(caps_t caps, const char* fmt, ...);
+
+int32_t caps_read_fmt(caps_t caps, const char* fmt, ...);
+
 int32_t caps_read_binary(caps_t caps, const void** r, uint32_t* length);
 
 int32_t caps_read_object(caps_t caps, caps_t* r);
 
 int32_t caps_read_void(caps_t caps);
 
+// 读取数组, 不拷贝, '*r'指向caps数据内部
+int32_t caps_read_integer_array(caps_t caps, const int32_t** r, uint32_t* count);
+
+int32_t caps_read_long_array(caps_t caps, const int64_t** r, uint32_t* count);
+
+int32_t caps_read_float_array(caps_t caps, const float** r, uint32_t* count);
+
+int32_t caps_read_double_array(caps_t caps, const double** r, uint32_t* count);
+
+// 移动读取位置到第'index'个成员
+int32_t caps_seek(caps_t caps, uint32_t index);
+
+// 跳过'n'个成员
+int32_t caps_skip(caps_t caps, uint32_t n);
+
 void caps_destroy(caps_t caps);
 
 // 'data' 必须不少于8字节
@@ -0,0 +1,371 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "caps-archive.h"
+#include "caps-reader.h"
+#include "defs.h"
+
+using namespace std;
+using namespace rokid;
+
+#define ARCHIVE_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t reserved;
+} ArchiveHeader;
+
+static const char ARCHIVE_MAGIC[4] = { 'C', 'A', 'P', 'A' };
+
+static string index_path(const char* path) {
+  return string(path) + ".idx";
+}
+
+static int32_t write_all(int fd, const void* data, size_t length) {
+  const int8_t* p = reinterpret_cast<const int8_t*>(data);
+  ssize_t r;
+  while (length > 0) {
+    r = ::write(fd, p, length);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return CAPS_ERR_IO;
+    }
+    p += r;
+    length -= r;
+  }
+  return CAPS_SUCCESS;
+}
+
+static void read_index(const char* path, vector<CapsArchiveIndex>& index) {
+  struct stat st;
+  int fd = ::open(index_path(path).c_str(), O_RDONLY);
+  index.clear();
+  if (fd < 0)
+    return;
+  if (fstat(fd, &st) == 0) {
+    index.resize(st.st_size / sizeof(CapsArchiveIndex));
+    ssize_t r = ::read(fd, index.data(), index.size() * sizeof(CapsArchiveIndex));
+    if (r < 0)
+      r = 0;
+    index.resize(r / sizeof(CapsArchiveIndex));
+  }
+  ::close(fd);
+}
+
+// 'off'处记录的长度, 记录不完整或格式不正确时返回0
+static uint64_t record_size(const int8_t* data, uint64_t size, uint64_t off) {
+  Header header;
+  uint32_t length;
+
+  if (off + sizeof(int64_t) + sizeof(Header) > size)
+    return 0;
+  memcpy(&header, data + off + sizeof(int64_t), sizeof(header));
+  if (check_header(&header, length) != CAPS_SUCCESS
+      || length <= sizeof(Header))
+    return 0;
+  uint64_t r = sizeof(int64_t) + ALIGN8((uint64_t)length);
+  if (off + r > size)
+    return 0;
+  return r;
+}
+
+// 检查索引, 并扫描最后一项索引之后的记录
+// 'end'为最后一条完整记录的结束位置
+static int32_t scan_archive(const int8_t* data, uint64_t size,
+    vector<CapsArchiveIndex>& index, uint64_t& end, uint32_t& count) {
+  const ArchiveHeader* header = reinterpret_cast<const ArchiveHeader*>(data);
+  uint64_t rsize;
+
+  if (size < sizeof(ArchiveHeader)
+      || memcmp(header->magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC))
+      || header->version != ARCHIVE_VERSION)
+    return CAPS_ERR_CORRUPTED;
+  // 丢弃指向不完整记录的索引
+  while (!index.empty()) {
+    const CapsArchiveIndex& last = index.back();
+    if (last.offset >= sizeof(ArchiveHeader) && (last.offset & 7) == 0
+        && record_size(data, size, last.offset) > 0)
+      break;
+    index.pop_back();
+  }
+  if (index.empty()) {
+    end = sizeof(ArchiveHeader);
+    count = 0;
+  } else {
+    end = index.back().offset;
+    count = index.back().seq;
+  }
+  while ((rsize = record_size(data, size, end)) > 0) {
+    end += rsize;
+    ++count;
+  }
+  return CAPS_SUCCESS;
+}
+
+CapsArchiveWriter::~CapsArchiveWriter() {
+  close();
+}
+
+int32_t CapsArchiveWriter::open(const char* path, uint32_t index_interval,
+    uint32_t batch_size) {
+  struct stat st;
+  int32_t r;
+
+  if (path == nullptr || index_interval == 0 || fd >= 0)
+    return CAPS_ERR_INVAL;
+  interval = index_interval;
+  batch = batch_size;
+  count = 0;
+  fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return CAPS_ERR_IO;
+  if (fstat(fd, &st) < 0)
+    goto io_error;
+  if (st.st_size == 0) {
+    ArchiveHeader header;
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version = ARCHIVE_VERSION;
+    header.reserved = 0;
+    if (write_all(fd, &header, sizeof(header)) != CAPS_SUCCESS)
+      goto io_error;
+    offset = sizeof(header);
+    index_fd = ::open(index_path(path).c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  } else {
+    vector<CapsArchiveIndex> index;
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      goto io_error;
+    read_index(path, index);
+    r = scan_archive(reinterpret_cast<const int8_t*>(p), st.st_size, index,
+        offset, count);
+    munmap(p, st.st_size);
+    if (r != CAPS_SUCCESS) {
+      ::close(fd);
+      fd = -1;
+      return r;
+    }
+    // 截断不完整的记录及无效的索引
+    if (ftruncate(fd, offset) < 0 || lseek(fd, offset, SEEK_SET) < 0)
+      goto io_error;
+    index_fd = ::open(index_path(path).c_str(), O_WRONLY | O_CREAT, 0644);
+    if (index_fd >= 0
+        && (ftruncate(index_fd, index.size() * sizeof(CapsArchiveIndex)) < 0
+          || lseek(index_fd, 0, SEEK_END) < 0))
+      goto io_error;
+  }
+  if (index_fd < 0)
+    goto io_error;
+  return CAPS_SUCCESS;
+
+io_error:
+  close();
+  return CAPS_ERR_IO;
+}
+
+int8_t* CapsArchiveWriter::reserve(uint32_t length, int64_t timestamp) {
+  size_t pos = buffer.size();
+  uint64_t rsize = sizeof(int64_t) + ALIGN8((uint64_t)length);
+
+  if (count % interval == 0) {
+    pending_index.emplace_back();
+    CapsArchiveIndex& idx = pending_index.back();
+    idx.offset = offset;
+    idx.timestamp = timestamp;
+    idx.seq = count;
+    idx.reserved = 0;
+  }
+  // 对齐填充置0
+  buffer.resize(pos + rsize, 0);
+  memcpy(buffer.data() + pos, &timestamp, sizeof(timestamp));
+  offset += rsize;
+  ++count;
+  return buffer.data() + pos + sizeof(int64_t);
+}
+
+int32_t CapsArchiveWriter::append(const Caps& caps, int64_t timestamp) {
+  if (fd < 0)
+    return CAPS_ERR_INVAL;
+  if (caps.type() == CAPS_TYPE_READER) {
+    const CapsReader& reader = static_cast<const CapsReader&>(caps);
+    return append(reader.binary_data(), reader.binary_size(), timestamp);
+  }
+  uint32_t length = caps.binary_size();
+  size_t pos = buffer.size();
+  size_t npending = pending_index.size();
+  uint64_t off = offset;
+  // 以本机字节序序列化, 回放时数值及数组均可直接读取
+  int32_t r = caps.serialize(reserve(length, timestamp), length, 0);
+  if (r < 0) {
+    buffer.resize(pos);
+    pending_index.resize(npending);
+    offset = off;
+    --count;
+    return r;
+  }
+  if (buffer.size() >= batch)
+    return flush();
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsArchiveWriter::append(const void* data, uint32_t length,
+    int64_t timestamp) {
+  if (fd < 0 || data == nullptr || length <= sizeof(Header))
+    return CAPS_ERR_INVAL;
+  memcpy(reserve(length, timestamp), data, length);
+  if (buffer.size() >= batch)
+    return flush();
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsArchiveWriter::flush() {
+  if (fd < 0)
+    return CAPS_ERR_INVAL;
+  // 先写入记录, 再写入索引, 索引只会落后于记录
+  if (write_all(fd, buffer.data(), buffer.size()) != CAPS_SUCCESS)
+    return CAPS_ERR_IO;
+  buffer.clear();
+  if (write_all(index_fd, pending_index.data(),
+        pending_index.size() * sizeof(CapsArchiveIndex)) != CAPS_SUCCESS)
+    return CAPS_ERR_IO;
+  pending_index.clear();
+  return CAPS_SUCCESS;
+}
+
+void CapsArchiveWriter::close() {
+  if (fd >= 0 && index_fd >= 0)
+    flush();
+  if (fd >= 0)
+    ::close(fd);
+  if (index_fd >= 0)
+    ::close(index_fd);
+  fd = -1;
+  index_fd = -1;
+  buffer.clear();
+  pending_index.clear();
+}
+
+CapsArchiveReader::~CapsArchiveReader() {
+  close();
+}
+
+int32_t CapsArchiveReader::open(const char* path) {
+  struct stat st;
+  int32_t r;
+
+  if (path == nullptr || data)
+    return CAPS_ERR_INVAL;
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return CAPS_ERR_IO;
+  if (fstat(fd, &st) < 0) {
+    ::close(fd);
+    return CAPS_ERR_IO;
+  }
+  if ((uint64_t)st.st_size < sizeof(ArchiveHeader)) {
+    ::close(fd);
+    return CAPS_ERR_CORRUPTED;
+  }
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return CAPS_ERR_IO;
+  data = reinterpret_cast<const int8_t*>(p);
+  data_size = st.st_size;
+  read_index(path, index);
+  r = scan_archive(data, data_size, index, end, count);
+  if (r != CAPS_SUCCESS) {
+    close();
+    return r;
+  }
+  offset = sizeof(ArchiveHeader);
+  current = 0;
+  return CAPS_SUCCESS;
+}
+
+void CapsArchiveReader::close() {
+  if (data)
+    munmap(const_cast<int8_t*>(data), data_size);
+  data = nullptr;
+  data_size = 0;
+  end = 0;
+  count = 0;
+  index.clear();
+  offset = 0;
+  current = 0;
+}
+
+uint64_t CapsArchiveReader::next_offset(uint64_t off) const {
+  uint64_t rsize = record_size(data, end, off);
+  return rsize ? off + rsize : end;
+}
+
+int32_t CapsArchiveReader::next(shared_ptr<Caps>& caps, int64_t* timestamp) {
+  if (current >= count || offset >= end)
+    return CAPS_ERR_EOO;
+  uint64_t off = offset;
+  uint64_t rsize = record_size(data, end, off);
+  if (rsize == 0)
+    return CAPS_ERR_CORRUPTED;
+  offset += rsize;
+  ++current;
+  if (timestamp)
+    *timestamp = *reinterpret_cast<const int64_t*>(data + off);
+  const int8_t* frame = data + off + sizeof(int64_t);
+  uint32_t length;
+  check_header(reinterpret_cast<const Header*>(frame), length);
+  return caps_parse_reuse(frame, length, caps);
+}
+
+int32_t CapsArchiveReader::seek(uint32_t idx) {
+  if (data == nullptr || idx > count)
+    return CAPS_ERR_INVAL;
+  // 最后一项序号不大于'idx'的索引
+  vector<CapsArchiveIndex>::const_iterator it = upper_bound(index.begin(),
+      index.end(), idx, [](uint32_t v, const CapsArchiveIndex& e) {
+        return v < e.seq;
+      });
+  if (it == index.begin()) {
+    offset = sizeof(ArchiveHeader);
+    current = 0;
+  } else {
+    --it;
+    offset = it->offset;
+    current = it->seq;
+  }
+  while (current < idx) {
+    offset = next_offset(offset);
+    ++current;
+  }
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsArchiveReader::seek_time(int64_t timestamp) {
+  if (data == nullptr)
+    return CAPS_ERR_INVAL;
+  // 最后一项timestamp小于'timestamp'的索引
+  vector<CapsArchiveIndex>::const_iterator it = lower_bound(index.begin(),
+      index.end(), timestamp, [](const CapsArchiveIndex& e, int64_t v) {
+        return e.timestamp < v;
+      });
+  if (it == index.begin()) {
+    offset = sizeof(ArchiveHeader);
+    current = 0;
+  } else {
+    --it;
+    offset = it->offset;
+    current = it->seq;
+  }
+  while (current < count
+      && *reinterpret_cast<const int64_t*>(data + offset) < timestamp) {
+    offset = next_offset(offset);
+    ++current;
+  }
+  return CAPS_SUCCESS;
+}
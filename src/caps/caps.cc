@@ -1,25 +1,25 @@
-#include <arpa/inet.h>
+#include <stdarg.h>
+#include <atomic>
 #include <string>
+#include <vector>
 #include "caps.h"
-#include "reader.h"
-#include "writer.h"
+#include "caps-reader.h"
+#include "caps-writer.h"
+#include "defs.h"
 
 using namespace std;
 using namespace rokid;
 
 namespace rokid {
 
-char CAPS_MAGIC[4] = { 0x1e, 'A', 'P', CAPS_VERSION };
+char CAPS_MAGIC[4] = { CAPS_MAGIC0, 'A', 'P', CAPS_VERSION };
 
 bool check_version(uint8_t version) {
-  return version > 2 && version <= CAPS_VERSION;
+  return version >= CAPS_MIN_VERSION && version <= CAPS_VERSION;
 }
 
 int32_t check_header(const Header* header, uint32_t& length) {
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    length = ntohl(header->length);
-  else
-    length = header->length;
+  length = caps_order32(header->length, caps_need_swap(header->magic[0]));
   if ((header->magic[0] & CAPS_MAGIC_MASK) != CAPS_MAGIC[0])
     return CAPS_ERR_CORRUPTED;
   if (header->magic[1] != CAPS_MAGIC[1]
@@ -27,20 +27,71 @@ int32_t check_header(const Header* header, uint32_t& length) {
     return CAPS_ERR_CORRUPTED;
   if (!check_version(header->magic[3]))
     return CAPS_ERR_VERSION_UNSUPP;
+  if (caps_dedup_strings(header) && header->magic[3] < CAPS_DEDUP_VERSION)
+    return CAPS_ERR_CORRUPTED;
   return CAPS_SUCCESS;
 }
 
+// new_instance/parse使用的线程本地对象池
+// 池中对象只被池引用(use_count() == 1)时可复用
+// 对象不能以weak_ptr持有, 否则检查use_count()之后可能重新被引用
+template <typename T>
+class CapsPool {
+public:
+  shared_ptr<T> acquire() {
+    size_t i;
+
+    if (capacity == 0)
+      return make_shared<T>();
+    for (i = 0; i < objects.size(); ++i) {
+      shared_ptr<T>& o = objects[cursor];
+      cursor = (cursor + 1) % objects.size();
+      if (o.use_count() == 1) {
+        // 对象可能由其它线程最后释放, use_count()为relaxed读取,
+        // 需与其释放时引用计数的递减同步, 才能看到其它线程对此对象的修改
+        atomic_thread_fence(memory_order_acquire);
+        o->reset();
+        return o;
+      }
+    }
+    shared_ptr<T> r = make_shared<T>();
+    if (objects.size() < capacity)
+      objects.push_back(r);
+    return r;
+  }
+
+  void set_capacity(uint32_t c) {
+    capacity = c;
+    if (objects.size() > c)
+      objects.resize(c);
+    cursor = 0;
+  }
+
+private:
+  vector<shared_ptr<T> > objects;
+  size_t cursor = 0;
+  uint32_t capacity = 0;
+};
+
+static thread_local CapsPool<CapsWriter> writer_pool;
+static thread_local CapsPool<CapsReader> reader_pool;
+
 } // namespace rokid
 
 shared_ptr<Caps> Caps::new_instance() {
-  return make_shared<CapsWriter>();
+  return writer_pool.acquire();
+}
+
+void Caps::set_pool_capacity(uint32_t capacity) {
+  writer_pool.set_capacity(capacity);
+  reader_pool.set_capacity(capacity);
 }
 
 int32_t Caps::parse(const void* data, uint32_t length,
     shared_ptr<Caps>& caps, bool duplicate) {
   if (data == nullptr || length == 0)
     return CAPS_ERR_INVAL;
-  shared_ptr<CapsReader> r = make_shared<CapsReader>();
+  shared_ptr<CapsReader> r = reader_pool.acquire();
   int32_t code = r->parse(data, length, duplicate);
   if (code != CAPS_SUCCESS)
     return code;
@@ -48,17 +99,23 @@ int32_t Caps::parse(const void* data, uint32_t length,
   return CAPS_SUCCESS;
 }
 
+int32_t Caps::validate(const void* data, uint32_t length) {
+  if (data == nullptr)
+    return CAPS_ERR_INVAL;
+  return validate_buffer(data, length, 0);
+}
+
 shared_ptr<Caps> Caps::convert(caps_t caps) {
   shared_ptr<Caps> r;
   if (caps) {
     Caps* b = reinterpret_cast<Caps*>(caps);
     if (b->type() == CAPS_TYPE_WRITER) {
       CapsWriter* w = new CapsWriter();
-      *w = *b;
+      w->share_from(*static_cast<CapsWriter*>(b));
       r.reset(w);
     } else {
       CapsReader* rd = new CapsReader();
-      *rd = *b;
+      rd->share_from(*static_cast<CapsReader*>(b));
       r.reset(rd);
     }
   }
@@ -70,11 +127,11 @@ caps_t Caps::convert(std::shared_ptr<Caps>& caps) {
     return 0;
   if (caps->type() == CAPS_TYPE_WRITER) {
     CapsWriter* w = new CapsWriter();
-    *w = *caps.get();
+    w->share_from(*static_cast<CapsWriter*>(caps.get()));
     return reinterpret_cast<caps_t>(w);
   }
   CapsReader* r = new CapsReader();
-  *r = *caps.get();
+  r->share_from(*static_cast<CapsReader*>(caps.get()));
   return reinterpret_cast<caps_t>(r);
 }
 
@@ -109,6 +166,22 @@ int32_t caps_parse(const void* data, uint32_t length, caps_t* result) {
   return CAPS_SUCCESS;
 }
 
+int32_t caps_to_reader(caps_t caps, caps_t* result) {
+  if (caps == 0 || result == nullptr)
+    return CAPS_ERR_INVAL;
+  Caps* writer = reinterpret_cast<Caps*>(caps);
+  if (writer->type() != CAPS_TYPE_WRITER)
+    return CAPS_ERR_RDONLY;
+  CapsReader* reader = new CapsReader();
+  int32_t r = reader->parse(*static_cast<CapsWriter*>(writer));
+  if (r != CAPS_SUCCESS) {
+    delete reader;
+    return r;
+  }
+  *result = reinterpret_cast<caps_t>(reader);
+  return CAPS_SUCCESS;
+}
+
 int32_t caps_serialize(caps_t caps, void* buf, uint32_t bufsize) {
   if (caps == 0)
     return CAPS_ERR_INVAL;
@@ -119,6 +192,19 @@ int32_t caps_serialize(caps_t caps, void* buf, uint32_t bufsize) {
       CAPS_FLAG_NET_BYTEORDER);
 }
 
+int32_t caps_validate(const void* data, uint32_t length) {
+  return Caps::validate(data, length);
+}
+
+int32_t caps_serialize_realloc(caps_t caps, void** buf, uint32_t* bufsize) {
+  if (caps == 0 || buf == nullptr || bufsize == nullptr)
+    return CAPS_ERR_INVAL;
+  Caps* writer = reinterpret_cast<Caps*>(caps);
+  if (writer->type() != CAPS_TYPE_WRITER)
+    return CAPS_ERR_RDONLY;
+  return static_cast<CapsWriter*>(writer)->serialize_realloc(buf, bufsize);
+}
+
 int32_t caps_write_integer(caps_t caps, int32_t v) {
   if (caps == 0)
     return CAPS_ERR_INVAL;
@@ -161,29 +247,20 @@ int32_t caps_write_object(caps_t caps, caps_t v) {
   Caps* writer = reinterpret_cast<Caps*>(caps);
   if (writer->type() != CAPS_TYPE_WRITER)
     return CAPS_ERR_RDONLY;
-  Caps* o = reinterpret_cast<Caps*>(v);
-  int8_t* data = nullptr;
-  int32_t size;
-  bool allocated = false;
-  if (o == nullptr) {
-    size = 0;
-  } else if (o->type() == CAPS_TYPE_WRITER) {
-    size = o->serialize(nullptr, 0);
-    if (size > 0) {
-      data = new int8_t[size];
-      o->serialize(data, size);
-      allocated = true;
-    } else {
-      size = 0;
-    }
-  } else {
-    size = static_cast<CapsReader*>(o)->binary_size();
-    data = (int8_t*)static_cast<CapsReader*>(o)->binary_data();
-  }
-  static_cast<CapsWriter*>(writer)->write(data, size);
-  if (allocated)
-    delete[] data;
-  return CAPS_SUCCESS;
+  return static_cast<CapsWriter*>(writer)->write_binary_object(
+      reinterpret_cast<Caps*>(v));
+}
+
+int32_t caps_write_string_ref(caps_t caps, const char* v) {
+  if (caps == 0)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->write_ref(v);
+}
+
+int32_t caps_write_binary_ref(caps_t caps, const void* v, uint32_t length) {
+  if (caps == 0)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->write_ref(v, length);
 }
 
 int32_t caps_write_void(caps_t caps) {
@@ -192,6 +269,30 @@ int32_t caps_write_void(caps_t caps) {
   return reinterpret_cast<Caps*>(caps)->write();
 }
 
+int32_t caps_write_integer_array(caps_t caps, const int32_t* v, uint32_t count) {
+  if (caps == 0)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->write_array(v, count);
+}
+
+int32_t caps_write_long_array(caps_t caps, const int64_t* v, uint32_t count) {
+  if (caps == 0)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->write_array(v, count);
+}
+
+int32_t caps_write_float_array(caps_t caps, const float* v, uint32_t count) {
+  if (caps == 0)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->write_array(v, count);
+}
+
+int32_t caps_write_double_array(caps_t caps, const double* v, uint32_t count) {
+  if (caps == 0)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->write_array(v, count);
+}
+
 int32_t caps_read_integer(caps_t caps, int32_t* r) {
   if (caps == 0 || r == nullptr)
     return CAPS_ERR_INVAL;
@@ -225,6 +326,41 @@ int32_t caps_read_string(caps_t caps, const char** r) {
   return static_cast<CapsReader*>(reader)->read(*r);
 }
 
+int32_t caps_read_string_len(caps_t caps, const char** r, uint32_t* length) {
+  if (caps == 0 || r == nullptr || length == nullptr)
+    return CAPS_ERR_INVAL;
+  Caps* reader = reinterpret_cast<Caps*>(caps);
+  if (reader->type() != CAPS_TYPE_READER)
+    return CAPS_ERR_WRONLY;
+  return static_cast<CapsReader*>(reader)->read_string(*r, *length);
+}
+
+int32_t caps_write_fmt(caps_t caps, const char* fmt, ...) {
+  if (caps == 0 || fmt == nullptr)
+    return CAPS_ERR_INVAL;
+  Caps* writer = reinterpret_cast<Caps*>(caps);
+  if (writer->type() != CAPS_TYPE_WRITER)
+    return CAPS_ERR_RDONLY;
+  va_list ap;
+  va_start(ap, fmt);
+  int32_t r = static_cast<CapsWriter*>(writer)->write_fmt(fmt, ap);
+  va_end(ap);
+  return r;
+}
+
+int32_t caps_read_fmt(caps_t caps, const char* fmt, ...) {
+  if (caps == 0 || fmt == nullptr)
+    return CAPS_ERR_INVAL;
+  Caps* reader = reinterpret_cast<Caps*>(caps);
+  if (reader->type() != CAPS_TYPE_READER)
+    return CAPS_ERR_WRONLY;
+  va_list ap;
+  va_start(ap, fmt);
+  int32_t r = static_cast<CapsReader*>(reader)->read_fmt(fmt, ap);
+  va_end(ap);
+  return r;
+}
+
 int32_t caps_read_binary(caps_t caps, const void** r, uint32_t* length) {
   if (caps == 0 || r == nullptr || length == nullptr)
     return CAPS_ERR_INVAL;
@@ -240,20 +376,10 @@ int32_t caps_read_object(caps_t caps, caps_t* r) {
   Caps* reader = reinterpret_cast<Caps*>(caps);
   if (reader->type() != CAPS_TYPE_READER)
     return CAPS_ERR_WRONLY;
-  string bin;
-  int32_t code = static_cast<CapsReader*>(reader)->read_binary(bin);
+  CapsReader* sub;
+  int32_t code = static_cast<CapsReader*>(reader)->read_object(sub);
   if (code != CAPS_SUCCESS)
     return code;
-  if (bin.length() == 0) {
-    *r = 0;
-    return CAPS_SUCCESS;
-  }
-  CapsReader* sub = new CapsReader();
-  code = sub->parse(bin.data(), bin.length(), true);
-  if (code != CAPS_SUCCESS) {
-    delete sub;
-    return code;
-  }
   *r = reinterpret_cast<caps_t>(sub);
   return CAPS_SUCCESS;
 }
@@ -264,6 +390,42 @@ int32_t caps_read_void(caps_t caps) {
   return reinterpret_cast<Caps*>(caps)->read();
 }
 
+int32_t caps_read_integer_array(caps_t caps, const int32_t** r, uint32_t* count) {
+  if (caps == 0 || r == nullptr || count == nullptr)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->read_array(*r, *count);
+}
+
+int32_t caps_read_long_array(caps_t caps, const int64_t** r, uint32_t* count) {
+  if (caps == 0 || r == nullptr || count == nullptr)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->read_array(*r, *count);
+}
+
+int32_t caps_read_float_array(caps_t caps, const float** r, uint32_t* count) {
+  if (caps == 0 || r == nullptr || count == nullptr)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->read_array(*r, *count);
+}
+
+int32_t caps_read_double_array(caps_t caps, const double** r, uint32_t* count) {
+  if (caps == 0 || r == nullptr || count == nullptr)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->read_array(*r, *count);
+}
+
+int32_t caps_seek(caps_t caps, uint32_t index) {
+  if (caps == 0)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->seek(index);
+}
+
+int32_t caps_skip(caps_t caps, uint32_t n) {
+  if (caps == 0)
+    return CAPS_ERR_INVAL;
+  return reinterpret_cast<Caps*>(caps)->skip(n);
+}
+
 void caps_destroy(caps_t caps) {
   if (caps)
     delete reinterpret_cast<Caps*>(caps);
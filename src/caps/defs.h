@@ -1,33 +1,127 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "caps-defs.h"
 
 #define ALIGN4(v) ((v) + 3 & ~3)
 #define ALIGN8(v) ((v) + 7 & ~7)
-#define CAPS_MAGIC_MASK 0x1f
 
 namespace rokid {
 
-typedef struct {
-  // magic[0]: 0x1e | FLAG_NET_BYTEORDER(0x80)
-  // magic[1]: 'A'
-  // magic[2]: 'P'
-  // magic[3]: CAPS_VERSION
-  char magic[4];
-  uint32_t length;
-} Header;
-
-typedef struct {
-  const int32_t* number_values;
-  const int64_t* long_values;
-  const uint32_t* bin_sizes;
-  const int8_t* binary_section;
-  const char* string_section;
-  uint32_t current_read_member;
-} CapsReaderRecord;
-
 int32_t check_header(const Header* header, uint32_t& length);
 
+// 检查完整的数据结构, 'depth'为当前嵌套层数
+int32_t validate_buffer(const void* data, uint32_t datasize, uint32_t depth);
+
+// 批量原地交换字节序, 支持SSSE3/NEON时每次处理16字节
+inline void caps_bswap32_array(void* data, uint32_t n) {
+  uint8_t* p = reinterpret_cast<uint8_t*>(data);
+  uint8_t* end = p + n * sizeof(uint32_t);
+  uint32_t v;
+#if defined(__SSSE3__)
+  const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+      4, 5, 6, 7, 0, 1, 2, 3);
+  for (; end - p >= 16; p += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_shuffle_epi8(x, mask));
+  }
+#elif defined(__ARM_NEON)
+  for (; end - p >= 16; p += 16)
+    vst1q_u8(p, vrev32q_u8(vld1q_u8(p)));
+#endif
+  for (; p < end; p += sizeof(v)) {
+    memcpy(&v, p, sizeof(v));
+    v = __builtin_bswap32(v);
+    memcpy(p, &v, sizeof(v));
+  }
+}
+
+inline void caps_bswap64_array(void* data, uint32_t n) {
+  uint8_t* p = reinterpret_cast<uint8_t*>(data);
+  uint8_t* end = p + n * sizeof(uint64_t);
+  uint64_t v;
+#if defined(__SSSE3__)
+  const __m128i mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+      0, 1, 2, 3, 4, 5, 6, 7);
+  for (; end - p >= 16; p += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_shuffle_epi8(x, mask));
+  }
+#elif defined(__ARM_NEON)
+  for (; end - p >= 16; p += 16)
+    vst1q_u8(p, vrev64q_u8(vld1q_u8(p)));
+#endif
+  for (; p < end; p += sizeof(v)) {
+    memcpy(&v, p, sizeof(v));
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, sizeof(v));
+  }
+}
+
+// 数组成员与binary/object成员一样, 数据存放于binary section,
+// bin_sizes中记录数据字节数
+inline bool caps_is_array(char type) {
+  return type == 'I' || type == 'F' || type == 'L' || type == 'D';
+}
+
+inline uint32_t caps_array_element_size(char type) {
+  return (type == 'L' || type == 'D') ? sizeof(int64_t) : sizeof(int32_t);
+}
+
+// 字符串去重的数据每个字符串成员在string sizes及string offsets中各占一项
+inline bool caps_dedup_strings(const Header* header) {
+  return header->magic[0] & CAPS_FLAG_DEDUP_STRINGS;
+}
+
+// 'end'指向数据末尾, 返回成员数量之前的位置(最后一个成员声明之后)
+inline char* caps_write_count(char* end, uint32_t n) {
+  uint8_t c;
+  do {
+    c = n & 0x7f;
+    n >>= 7;
+    if (n)
+      c |= 0x80;
+    *--end = c;
+  } while (n);
+  return end;
+}
+
+// 'end'指向数据末尾, 最多读取'limit'字节
+// 返回成员数量占用的字节数, 数据不正确时返回0
+inline uint32_t caps_read_count(const char* end, uint32_t limit,
+    bool varint, uint32_t& n) {
+  uint32_t i;
+  uint8_t c;
+
+  if (limit == 0)
+    return 0;
+  if (!varint) {
+    n = (uint8_t)end[-1];
+    return 1;
+  }
+  n = 0;
+  for (i = 0; i < limit && i < CAPS_MAX_COUNT_SIZE; ++i) {
+    c = end[-1 - (int32_t)i];
+    n |= (uint32_t)(c & 0x7f) << (7 * i);
+    if ((c & 0x80) == 0)
+      return i + 1;
+  }
+  return 0;
+}
+
+inline void caps_bswap_array(char type, void* data, uint32_t length) {
+  if (type == 'L' || type == 'D')
+    caps_bswap64_array(data, length / sizeof(uint64_t));
+  else
+    caps_bswap32_array(data, length / sizeof(uint32_t));
+}
+
 extern char CAPS_MAGIC[4];
 
 } // namespace rokid
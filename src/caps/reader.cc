@@ -1,18 +1,263 @@
 #include <string.h>
-#include <arpa/inet.h>
-#include "writer.h"
-#include "reader.h"
+#include <atomic>
+#include "caps-writer.h"
+#include "caps-reader.h"
+#include "defs.h"
 
 using namespace std;
 
 namespace rokid {
 
-static int64_t caps_ntohll(int64_t v) {
-  int32_t num = 42;
-  if (*(char*)&num == 42) {
-    return ((((uint64_t)ntohl(v)) << 32) + ntohl((v) >> 32));
+// 将'b'中需要交换字节序的数值区及binary sizes原地批量转换为本机字节序,
+// 并递归转换object类型子对象, 转换后header不再标记网络字节序
+// 数据格式不正确时不做转换, 由parse返回错误
+static void normalize_byteorder(int8_t* b, uint32_t datasize) {
+  Header* header = reinterpret_cast<Header*>(b);
+  uint32_t length;
+  uint32_t num_num = 0;
+  uint32_t num_long = 0;
+  uint32_t num_bin = 0;
+  uint32_t num_str = 0;
+  uint32_t num_members;
+  uint32_t count_size;
+  uint32_t i;
+
+  if (datasize <= sizeof(Header) || check_header(header, length)
+      || length != datasize)
+    return;
+  const char* mdecls = reinterpret_cast<const char*>(b + datasize);
+  count_size = caps_read_count(mdecls, datasize - sizeof(Header),
+      header->magic[3] >= CAPS_VARINT_COUNT_VERSION, num_members);
+  if (count_size == 0
+      || num_members > datasize - sizeof(Header) - count_size)
+    return;
+  mdecls -= count_size + 1;
+  for (i = 0; i < num_members; ++i) {
+    switch (mdecls[-(int32_t)i]) {
+      case 'i':
+      case 'f':
+        ++num_num;
+        break;
+      case 'l':
+      case 'd':
+        ++num_long;
+        break;
+      case 'S':
+        ++num_str;
+        break;
+      case 'B':
+      case 'O':
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        ++num_bin;
+        break;
+    }
+  }
+  if (header->magic[3] < CAPS_STRLEN_VERSION)
+    num_str = 0;
+  else if (caps_dedup_strings(header))
+    num_str *= 2;
+  int8_t* long_section = reinterpret_cast<int8_t*>(header + 1);
+  int8_t* number_section = long_section + num_long * sizeof(int64_t);
+  uint32_t* bin_sizes = reinterpret_cast<uint32_t*>(number_section + num_num * sizeof(int32_t));
+  bool align8 = header->magic[3] >= CAPS_ALIGN8_VERSION;
+  int8_t* binary_section = b + caps_bin_align(
+      reinterpret_cast<int8_t*>(bin_sizes + num_bin + num_str) - b, align8);
+  int8_t* end = b + datasize - (num_members + count_size);
+  if (binary_section > end)
+    return;
+  bool swap = caps_need_swap(header->magic[0]);
+  if (swap) {
+    caps_bswap64_array(long_section, num_long);
+    // number section, binary sizes及string sizes(offsets)相邻
+    caps_bswap32_array(number_section, num_num + num_bin + num_str);
+    header->magic[0] &= ~CAPS_FLAG_NET_BYTEORDER;
+    header->length = datasize;
+  }
+  uint32_t bin_size;
+  char type;
+  for (i = 0; i < num_members; ++i) {
+    type = mdecls[-(int32_t)i];
+    switch (type) {
+      case 'O':
+      case 'B':
+        bin_size = *bin_sizes;
+        if (binary_section > end || bin_size > (uint32_t)(end - binary_section))
+          return;
+        if (type == 'O')
+          normalize_byteorder(binary_section, bin_size);
+        binary_section += caps_bin_align(bin_size, align8);
+        ++bin_sizes;
+        break;
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        bin_size = *bin_sizes;
+        if (binary_section > end || bin_size > (uint32_t)(end - binary_section))
+          return;
+        if (swap)
+          caps_bswap_array(type, binary_section, bin_size);
+        binary_section += caps_bin_align(bin_size, align8);
+        ++bin_sizes;
+        break;
+    }
+  }
+}
+
+static inline uint32_t load32(const int8_t* p, bool swap) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return caps_order32(v, swap);
+}
+
+// 一次线性扫描检查'b'的完整结构: 各数据区边界, binary/数组长度,
+// 字符串结束符及object子对象(递归), 只读取数据, 不分配内存
+int32_t validate_buffer(const void* data, uint32_t datasize, uint32_t depth) {
+  const int8_t* b = reinterpret_cast<const int8_t*>(data);
+  Header header;
+  uint32_t length;
+  uint32_t num_members;
+  uint32_t num_num = 0;
+  uint32_t num_long = 0;
+  uint32_t num_bin = 0;
+  uint32_t num_str = 0;
+  uint32_t count_size;
+  uint32_t bin_size;
+  uint32_t i;
+  int32_t r;
+  char type;
+
+  if (data == nullptr || datasize <= sizeof(Header))
+    return CAPS_ERR_CORRUPTED;
+  if (depth > CAPS_MAX_DEPTH)
+    return CAPS_ERR_CORRUPTED;
+  memcpy(&header, b, sizeof(header));
+  r = check_header(&header, length);
+  if (r)
+    return r;
+  if (length != datasize)
+    return CAPS_ERR_CORRUPTED;
+  bool swap = caps_need_swap(header.magic[0]);
+  bool align8 = header.magic[3] >= CAPS_ALIGN8_VERSION;
+  const char* mdecls = reinterpret_cast<const char*>(b + datasize);
+  count_size = caps_read_count(mdecls, datasize - sizeof(Header),
+      header.magic[3] >= CAPS_VARINT_COUNT_VERSION, num_members);
+  if (count_size == 0
+      || num_members > datasize - sizeof(Header) - count_size)
+    return CAPS_ERR_CORRUPTED;
+  mdecls -= count_size + 1;
+  for (i = 0; i < num_members; ++i) {
+    switch (mdecls[-(int32_t)i]) {
+      case 'i':
+      case 'f':
+        ++num_num;
+        break;
+      case 'l':
+      case 'd':
+        ++num_long;
+        break;
+      case 'S':
+        ++num_str;
+        break;
+      case 'B':
+      case 'O':
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        ++num_bin;
+        break;
+      case 'V':
+        break;
+      default:
+        return CAPS_ERR_CORRUPTED;
+    }
+  }
+  // 各数据区均位于成员声明之前
+  uint64_t decl_start = datasize - count_size - num_members;
+  uint64_t offset = sizeof(Header) + (uint64_t)num_long * sizeof(int64_t)
+    + (uint64_t)num_num * sizeof(int32_t);
+  const int8_t* bin_sizes = b + offset;
+  const int8_t* str_sizes = nullptr;
+  const int8_t* str_offsets = nullptr;
+  offset += (uint64_t)num_bin * sizeof(uint32_t);
+  if (header.magic[3] >= CAPS_STRLEN_VERSION) {
+    str_sizes = b + offset;
+    offset += (uint64_t)num_str * sizeof(uint32_t);
+  }
+  if (caps_dedup_strings(&header)) {
+    str_offsets = b + offset;
+    offset += (uint64_t)num_str * sizeof(uint32_t);
+  }
+  if (offset > decl_start)
+    return CAPS_ERR_CORRUPTED;
+  offset = caps_bin_align(offset, align8);
+  for (i = 0; i < num_members; ++i) {
+    type = mdecls[-(int32_t)i];
+    if (type != 'B' && type != 'O' && !caps_is_array(type))
+      continue;
+    bin_size = load32(bin_sizes, swap);
+    bin_sizes += sizeof(uint32_t);
+    if (offset > decl_start || bin_size > decl_start - offset)
+      return CAPS_ERR_CORRUPTED;
+    if (caps_is_array(type) && bin_size % caps_array_element_size(type))
+      return CAPS_ERR_CORRUPTED;
+    if (type == 'O' && bin_size > 0) {
+      r = validate_buffer(b + offset, bin_size, depth + 1);
+      if (r)
+        return r;
+    }
+    // c api写入的子对象为binary类型, 可由read_object读取为对象,
+    // 以caps header开始且长度一致时同样检查其完整结构
+    if (type == 'B' && bin_size > sizeof(Header)) {
+      Header sub;
+      uint32_t sublen;
+      memcpy(&sub, b + offset, sizeof(sub));
+      if (check_header(&sub, sublen) == CAPS_SUCCESS && sublen == bin_size) {
+        r = validate_buffer(b + offset, bin_size, depth + 1);
+        if (r)
+          return r;
+      }
+    }
+    offset += align8 ? ALIGN8((uint64_t)bin_size) : ALIGN4((uint64_t)bin_size);
+  }
+  if (offset > decl_start)
+    return CAPS_ERR_CORRUPTED;
+  // 每个字符串在成员声明之前结束
+  const char* p = reinterpret_cast<const char*>(b + offset);
+  const char* end = reinterpret_cast<const char*>(b + decl_start);
+  const char* e;
+  uint32_t len;
+  uint32_t off;
+  for (i = 0; i < num_str; ++i) {
+    if (str_offsets) {
+      // 去重的字符串可位于string section任意位置
+      len = load32(str_sizes, swap);
+      off = load32(str_offsets, swap);
+      str_sizes += sizeof(uint32_t);
+      str_offsets += sizeof(uint32_t);
+      if (off >= (uint64_t)(end - p) || len >= (uint64_t)(end - p) - off
+          || p[off + len] != '\0')
+        return CAPS_ERR_CORRUPTED;
+      continue;
+    }
+    if (str_sizes) {
+      len = load32(str_sizes, swap);
+      str_sizes += sizeof(uint32_t);
+      if (len >= (uint64_t)(end - p) || p[len] != '\0')
+        return CAPS_ERR_CORRUPTED;
+      p += len + 1;
+      continue;
+    }
+    e = reinterpret_cast<const char*>(memchr(p, '\0', end - p));
+    if (e == nullptr)
+      return CAPS_ERR_CORRUPTED;
+    p = e + 1;
   }
-  return v;
+  return CAPS_SUCCESS;
 }
 
 static void copy_from_reader(CapsReader* dst, const CapsReader* src) {
@@ -23,62 +268,191 @@ static void copy_from_reader(CapsReader* dst, const CapsReader* src) {
   }
 }
 
-static void copy_from_writer(CapsReader* dst, const CapsWriter* src) {
-  uint32_t size = src->binary_size();
-  if (size > 0) {
-    int8_t* data = new int8_t[size];
-    if (src->serialize(data, size, 0) > 0) {
-      dst->parse(data, size, true);
-    }
-    delete[] data;
-  }
-}
-
 CapsReader& CapsReader::operator = (const Caps& o) {
   if (o.type() == CAPS_TYPE_WRITER)
-    copy_from_writer(this, static_cast<const CapsWriter*>(&o));
+    parse(static_cast<const CapsWriter&>(o));
   else
     copy_from_reader(this, static_cast<const CapsReader*>(&o));
   return *this;
 }
 
+void CapsReader::share_from(const CapsReader& o) {
+  if (&o == this)
+    return;
+  if (o.store.get() == nullptr) {
+    if (o.layout.bin_data)
+      parse(o.layout.bin_data, o.layout.data_length, true);
+    else
+      reset();
+    return;
+  }
+  // 数据已校验并转换字节序, 只拷贝各section位置, 成员索引需要时再建立
+  recycle_store();
+  store = o.store;
+  layout.header = o.layout.header;
+  layout.member_declarations = o.layout.member_declarations;
+  layout.num_members = o.layout.num_members;
+  layout.data_length = o.layout.data_length;
+  layout.swap = o.layout.swap;
+  layout.align8 = o.layout.align8;
+  layout.origin = o.layout.origin;
+  layout.bin_data = o.layout.bin_data;
+  layout.member_index.clear();
+  cur.pos = layout.origin;
+}
+
+int32_t CapsReader::validate() const {
+  if (layout.bin_data == nullptr)
+    return CAPS_ERR_INVAL;
+  return validate_buffer(layout.bin_data, layout.data_length, 0);
+}
+
+// 'p'只被调用者引用, 其内存可被覆盖或复用
+// 其它引用可能由其它线程中的reader(convert的结果或子对象)最后释放,
+// use_count()为relaxed读取, 需与其释放时引用计数的递减同步
+template <typename T>
+static bool exclusive(const shared_ptr<T>& p) {
+  if (p.use_count() != 1)
+    return false;
+  atomic_thread_fence(memory_order_acquire);
+  return true;
+}
+
+void CapsReader::recycle_store() {
+  // 子对象仍在引用时不能复用
+  if (store_size > spare_size && exclusive(store)) {
+    spare.swap(store);
+    spare_size = store_size;
+  }
+  store.reset();
+  store_size = 0;
+}
+
+void CapsReader::reset() {
+  recycle_store();
+  layout.clear();
+  cur.pos = CapsReaderRecord();
+}
+
 int32_t CapsReader::parse(const void* data, uint32_t datasize, bool dup) {
-  uint8_t num_str = 0;
-  uint8_t num_bin = 0;
-  uint8_t num_obj = 0;
-  uint8_t num_num = 0;
-  uint8_t num_long = 0;
-  uint8_t i;
-  uint8_t num_members;
-  const int8_t* b;
+  if (datasize <= sizeof(Header))
+    return CAPS_ERR_INVAL;
+  if (!dup) {
+    recycle_store();
+    return parse_buffer(reinterpret_cast<const int8_t*>(data), datasize);
+  }
+  // 'data'可能位于当前store中, 拷贝完成后再回收
+  shared_ptr<int8_t> old;
+  uint32_t old_size = store_size;
+  old.swap(store);
+  store_size = 0;
+  if (old_size >= datasize && exclusive(old)) {
+    store.swap(old);
+    store_size = old_size;
+  } else if (spare_size >= datasize) {
+    store.swap(spare);
+    store_size = spare_size;
+    spare_size = 0;
+  } else {
+    store.reset(new int8_t[datasize], default_delete<int8_t[]>());
+    store_size = datasize;
+  }
+  // 'data'也可能位于复用的缓冲区中
+  memmove(store.get(), data, datasize);
+  if (old_size > spare_size && exclusive(old)) {
+    spare.swap(old);
+    spare_size = old_size;
+  }
+  // 数据已拷贝, 一次性转换为本机字节序, 之后read无需再转换
+  if (!CAPS_HOST_NET_BYTEORDER)
+    normalize_byteorder(store.get(), datasize);
+  return parse_buffer(store.get(), datasize);
+}
 
+int32_t CapsReader::parse(const void* data, uint32_t datasize,
+    const shared_ptr<int8_t>& st) {
   if (datasize <= sizeof(Header))
     return CAPS_ERR_INVAL;
-  if (dup && bin_data)
-    delete bin_data;
-  if (dup) {
-    bin_data = new int8_t[datasize];
-    memcpy(const_cast<int8_t*>(bin_data), data, datasize);
-    b = reinterpret_cast<const int8_t*>(bin_data);
+  recycle_store();
+  store = st;
+  return parse_buffer(reinterpret_cast<const int8_t*>(data), datasize);
+}
+
+int32_t CapsReader::parse(const CapsWriter& w) {
+  uint32_t size = w.binary_size();
+  shared_ptr<int8_t> old;
+  uint32_t old_size = store_size;
+
+  // 'w'可能以write_ref引用当前store中的数据, 序列化完成后再回收
+  old.swap(store);
+  store_size = 0;
+  if (spare_size >= size) {
+    store.swap(spare);
+    store_size = spare_size;
+    spare_size = 0;
   } else {
-    b = reinterpret_cast<const int8_t*>(data);
-    bin_data = b;
+    store.reset(new int8_t[size], default_delete<int8_t[]>());
+    store_size = size;
+  }
+  w.serialize(store.get(), size, 0);
+  if (old_size > spare_size && exclusive(old)) {
+    spare.swap(old);
+    spare_size = old_size;
   }
-  duplicated = dup;
+  return parse_buffer(store.get(), size);
+}
 
+int32_t CapsReader::parse_buffer(const int8_t* b, uint32_t datasize) {
+  int32_t r = layout.parse(b, datasize);
+  cur.pos = layout.origin;
+  return r;
+}
+
+void CapsLayout::clear() {
+  header = nullptr;
+  member_declarations = nullptr;
+  num_members = 0;
+  data_length = 0;
+  swap = false;
+  align8 = false;
+  origin = CapsReaderRecord();
+  member_index.clear();
+  bin_data = nullptr;
+}
+
+int32_t CapsLayout::parse(const int8_t* b, uint32_t datasize) {
+  member_index.clear();
+  int32_t r = parse_sections(b, datasize);
+  if (r != CAPS_SUCCESS)
+    clear();
+  return r;
+}
+
+int32_t CapsLayout::parse_sections(const int8_t* b, uint32_t datasize) {
+  uint32_t num_str = 0;
+  uint32_t num_bin = 0;
+  uint32_t num_num = 0;
+  uint32_t num_long = 0;
+  uint32_t i;
+  uint32_t count_size;
+
+  bin_data = b;
   header = reinterpret_cast<const Header*>(b);
   int32_t r = check_header(header, data_length);
   if (r)
     return r;
   if (data_length != datasize)
     return CAPS_ERR_CORRUPTED;
+  swap = caps_need_swap(header->magic[0]);
+  align8 = header->magic[3] >= CAPS_ALIGN8_VERSION;
 
   member_declarations = reinterpret_cast<const char*>(b + datasize);
-  --member_declarations;
-  num_members = (uint8_t)member_declarations[0];
-  if (datasize < sizeof(Header) + ALIGN4(num_members + 1))
+  count_size = caps_read_count(member_declarations, datasize - sizeof(Header),
+      header->magic[3] >= CAPS_VARINT_COUNT_VERSION, num_members);
+  if (count_size == 0
+      || num_members > datasize - sizeof(Header) - count_size)
     return CAPS_ERR_CORRUPTED;
-  --member_declarations;
+  member_declarations -= count_size + 1;
   for (i = 0; i < num_members; ++i) {
     switch (member_declarations[-(int32_t)i]) {
       case 'i':
@@ -93,11 +467,12 @@ int32_t CapsReader::parse(const void* data, uint32_t datasize, bool dup) {
         ++num_str;
         break;
       case 'B':
-        ++num_bin;
-        break;
       case 'O':
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
         ++num_bin;
-        ++num_obj;
         break;
       case 'V':
         break;
@@ -105,137 +480,233 @@ int32_t CapsReader::parse(const void* data, uint32_t datasize, bool dup) {
         return CAPS_ERR_CORRUPTED;
     }
   }
-  long_values = reinterpret_cast<const int64_t*>(header + 1);
-  number_values = reinterpret_cast<const int32_t*>(long_values + num_long);
-  bin_sizes = reinterpret_cast<const uint32_t*>(number_values + num_num);
-  binary_section = reinterpret_cast<const int8_t*>(bin_sizes + num_bin);
-  if (datasize < reinterpret_cast<const int8_t*>(binary_section) - b)
+  origin = CapsReaderRecord();
+  origin.long_values = reinterpret_cast<const int64_t*>(header + 1);
+  origin.number_values = reinterpret_cast<const int32_t*>(
+      origin.long_values + num_long);
+  origin.bin_sizes = reinterpret_cast<const uint32_t*>(
+      origin.number_values + num_num);
+  if (header->magic[3] >= CAPS_STRLEN_VERSION)
+    origin.str_sizes = origin.bin_sizes + num_bin;
+  else
+    num_str = 0;
+  if (caps_dedup_strings(header)) {
+    origin.str_offsets = origin.str_sizes + num_str;
+    num_str *= 2;
+  }
+  // binary sizes, binary section及string section均位于成员声明之前
+  uint64_t decl_start = datasize - count_size - num_members;
+  uint64_t front = sizeof(Header) + (uint64_t)num_long * sizeof(int64_t)
+    + ((uint64_t)num_num + num_bin + num_str) * sizeof(int32_t);
+  if (front > decl_start)
     return CAPS_ERR_CORRUPTED;
-  uint32_t bin_sec_size = 0;
+  origin.binary_section = b + caps_bin_align(front, align8);
+  uint64_t bin_sec_size = origin.binary_section - b;
   uint32_t bin_size;
   for (i = 0; i < num_bin; ++i) {
-    if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-      bin_size = ntohl(bin_sizes[i]);
-    else
-      bin_size = bin_sizes[i];
-    bin_sec_size += ALIGN4(bin_size);
+    bin_size = caps_order32(origin.bin_sizes[i], swap);
+    bin_sec_size += align8 ? ALIGN8((uint64_t)bin_size)
+      : ALIGN4((uint64_t)bin_size);
   }
-  string_section = reinterpret_cast<const char*>(binary_section + bin_sec_size);
-  // TODO: 检查 string section 与 member declarations 不重叠
+  if (bin_sec_size > decl_start)
+    return CAPS_ERR_CORRUPTED;
+  origin.string_section = reinterpret_cast<const char*>(b + bin_sec_size);
   return CAPS_SUCCESS;
 }
 
-uint32_t CapsReader::binary_size() const {
-  return bin_data ? data_length : 0;
+void CapsLayout::build_index() {
+  uint32_t i;
+  uint32_t bin_size;
+  MemberOffset off = { 0, 0, 0, 0, 0, 0 };
+
+  member_index.resize(num_members + 1);
+  for (i = 0; i < num_members; ++i) {
+    member_index[i] = off;
+    switch (member_declarations[-(int32_t)i]) {
+      case 'i':
+      case 'f':
+        ++off.number_index;
+        break;
+      case 'l':
+      case 'd':
+        ++off.long_index;
+        break;
+      case 'S':
+        // 去重的数据string_section不移动, 只记录string_index
+        if (origin.str_offsets == nullptr) {
+          if (origin.str_sizes)
+            off.string_offset += caps_order32(origin.str_sizes[off.string_index], swap) + 1;
+          else
+            off.string_offset += strlen(origin.string_section + off.string_offset) + 1;
+        }
+        ++off.string_index;
+        break;
+      case 'B':
+      case 'O':
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        bin_size = caps_order32(origin.bin_sizes[off.bin_index], swap);
+        off.binary_offset += caps_bin_align(bin_size, align8);
+        ++off.bin_index;
+        break;
+    }
+  }
+  member_index[num_members] = off;
 }
 
-int32_t CapsReader::read32(int32_t* r, char type) {
-  if (end_of_object())
+int32_t CapsCursorCore::next_type(const CapsLayout& l) const {
+  int32_t r = current_member_type(l);
+  if (r == '\0')
     return CAPS_ERR_EOO;
-  if (current_member_type() != type)
-    return CAPS_ERR_INCORRECT_TYPE;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    *r = ntohl(number_values[0]);
-  else
-    *r = number_values[0];
-  ++number_values;
-  ++current_read_member;
+  return r;
+}
+
+int32_t CapsCursorCore::read_string(const CapsLayout& l, const char*& r,
+    uint32_t& len) {
+  int32_t code = check(l, 'S');
+  if (code != CAPS_SUCCESS)
+    return code;
+  r = next_string(l, len);
   return CAPS_SUCCESS;
 }
 
-int32_t CapsReader::read64(int64_t* r, char type) {
-  if (end_of_object())
-    return CAPS_ERR_EOO;
-  if (current_member_type() != type)
-    return CAPS_ERR_INCORRECT_TYPE;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    *r = caps_ntohll(long_values[0]);
-  else
-    *r = long_values[0];
-  ++long_values;
-  ++current_read_member;
+int32_t CapsCursorCore::read(const CapsLayout& l, string& r) {
+  const char* s;
+  uint32_t len;
+  int32_t code = read_string(l, s, len);
+  if (code != CAPS_SUCCESS)
+    return code;
+  r.assign(s, len);
   return CAPS_SUCCESS;
 }
 
-int32_t CapsReader::read(int32_t& r) {
-  return read32(&r, 'i');
+int32_t CapsCursorCore::read_binary(const CapsLayout& l, char type,
+    const void*& r, uint32_t& len) {
+  int32_t code = check(l, type);
+  if (code != CAPS_SUCCESS)
+    return code;
+  r = next_binary(l, len);
+  return CAPS_SUCCESS;
 }
 
-int32_t CapsReader::read(uint32_t& r) {
-  return read32(reinterpret_cast<int32_t*>(&r), 'i');
+int32_t CapsCursorCore::read(const CapsLayout& l, vector<uint8_t>& r) {
+  const void* b;
+  uint32_t len;
+  int32_t code = read_binary(l, 'B', b, len);
+  if (code != CAPS_SUCCESS)
+    return code;
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(b);
+  r.assign(p, p + len);
+  return CAPS_SUCCESS;
 }
 
-int32_t CapsReader::read(float& r) {
-  return read32(reinterpret_cast<int32_t*>(&r), 'f');
+int32_t CapsCursorCore::read_void(const CapsLayout& l) {
+  int32_t code = check(l, 'V');
+  if (code != CAPS_SUCCESS)
+    return code;
+  ++pos.current_read_member;
+  return CAPS_SUCCESS;
 }
 
-int32_t CapsReader::read(int64_t& r) {
-  return read64(&r, 'l');
+int32_t CapsCursorCore::read_array(const CapsLayout& l, const void*& r,
+    uint32_t& length, char type, bool ref) {
+  int32_t code = check(l, type);
+  if (code != CAPS_SUCCESS)
+    return code;
+  if (ref && l.swap)
+    return CAPS_ERR_BYTEORDER;
+  // parse(dup = false)时调用者的缓冲区可能未按元素大小对齐, 不能直接引用
+  if (ref && (uintptr_t)pos.binary_section % caps_array_element_size(type))
+    return CAPS_ERR_INVAL;
+  // 长度不是元素大小的整数倍时数据已损坏, 不读取此成员
+  if (caps_order32(pos.bin_sizes[0], l.swap) % caps_array_element_size(type))
+    return CAPS_ERR_CORRUPTED;
+  r = next_binary(l, length);
+  return CAPS_SUCCESS;
 }
 
-int32_t CapsReader::read(uint64_t& r) {
-  return read64(reinterpret_cast<int64_t*>(&r), 'l');
+void CapsCursorCore::copy_array(const CapsLayout& l, char type, void* dst,
+    const void* src, uint32_t length) {
+  memcpy(dst, src, length);
+  if (l.swap)
+    caps_bswap_array(type, dst, length);
 }
 
-int32_t CapsReader::read(double& r) {
-  return read64(reinterpret_cast<int64_t*>(&r), 'd');
+int32_t CapsCursorCore::seek(const CapsLayout& l, uint32_t index) {
+  if (index > l.num_members)
+    return CAPS_ERR_INVAL;
+  const CapsReaderRecord& origin = l.origin;
+  const MemberOffset& off = l.member_index[index];
+  pos.number_values = origin.number_values + off.number_index;
+  pos.long_values = origin.long_values + off.long_index;
+  pos.bin_sizes = origin.bin_sizes + off.bin_index;
+  pos.binary_section = origin.binary_section + off.binary_offset;
+  pos.string_section = origin.string_section + off.string_offset;
+  if (origin.str_sizes)
+    pos.str_sizes = origin.str_sizes + off.string_index;
+  if (origin.str_offsets)
+    pos.str_offsets = origin.str_offsets + off.string_index;
+  pos.current_read_member = index;
+  return CAPS_SUCCESS;
 }
 
-int32_t CapsReader::read(const char*& r) {
-  if (end_of_object())
+int32_t CapsCursorCore::skip(const CapsLayout& l, uint32_t n) {
+  if (n > l.num_members - pos.current_read_member)
     return CAPS_ERR_EOO;
-  if (current_member_type() != 'S')
-    return CAPS_ERR_INCORRECT_TYPE;
-  r = string_section;
-  string_section += strlen(r) + 1;
-  ++current_read_member;
-  return CAPS_SUCCESS;
+  return seek(l, pos.current_read_member + n);
 }
 
-int32_t CapsReader::read(const void*& r, uint32_t& length) {
-  if (end_of_object())
+int32_t CapsReader::seek(uint32_t index) {
+  if (index > size())
+    return CAPS_ERR_INVAL;
+  if (layout.member_index.empty())
+    layout.build_index();
+  return cur.seek(layout, index);
+}
+
+int32_t CapsReader::skip(uint32_t n) {
+  if (n > size() - cur.pos.current_read_member)
     return CAPS_ERR_EOO;
-  if (current_member_type() != 'B')
-    return CAPS_ERR_INCORRECT_TYPE;
-  r = binary_section;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    length = ntohl(bin_sizes[0]);
-  else
-    length = bin_sizes[0];
-  binary_section += ALIGN4(length);
-  ++bin_sizes;
-  ++current_read_member;
-  return CAPS_SUCCESS;
+  if (layout.member_index.empty())
+    layout.build_index();
+  return cur.skip(layout, n);
+}
+
+uint32_t CapsReader::binary_size() const {
+  return layout.bin_data ? layout.data_length : 0;
+}
+
+int32_t CapsReader::read(const char*& r) {
+  uint32_t len;
+  return cur.read_string(layout, r, len);
+}
+
+int32_t CapsReader::read_string(const char*& r, uint32_t& len) {
+  return cur.read_string(layout, r, len);
+}
+
+int32_t CapsReader::read(const void*& r, uint32_t& length) {
+  return cur.read_binary(layout, 'B', r, length);
 }
 
 int32_t CapsReader::read(string& r) {
-  const char* s;
-  int32_t code = read(s);
-  if (code != CAPS_SUCCESS)
-    return code;
-  r = s;
-  return CAPS_SUCCESS;
+  return cur.read(layout, r);
 }
 
 int32_t CapsReader::read(vector<uint8_t>& r) {
-  const void* b;
-  uint32_t l;
-  int32_t code = read(b, l);
-  if (code != CAPS_SUCCESS)
-    return code;
-  r.resize(l);
-  memcpy(r.data(), b, l);
-  return CAPS_SUCCESS;
+  return cur.read(layout, r);
 }
 
 int32_t CapsReader::read_string(string& r) {
-  return read(r);
+  return cur.read(layout, r);
 }
 
 int32_t CapsReader::read_binary(string& r) {
   const void* b;
   uint32_t l;
-  int32_t code = read(b, l);
+  int32_t code = cur.read_binary(layout, 'B', b, l);
   if (code != CAPS_SUCCESS)
     return code;
   r.assign(reinterpret_cast<const char*>(b), l);
@@ -243,80 +714,267 @@ int32_t CapsReader::read_binary(string& r) {
 }
 
 int32_t CapsReader::read(shared_ptr<Caps>& r) {
+  const void* data;
+  uint32_t bin_size;
+  int32_t code = cur.read_binary(layout, 'O', data, bin_size);
+  if (code != CAPS_SUCCESS)
+    return code;
+  return sub_object(data, bin_size, r);
+}
+
+int32_t CapsReader::sub_object(const void* data, uint32_t len,
+    shared_ptr<Caps>& r) const {
+  r.reset();
+  if (len == 0)
+    return CAPS_SUCCESS;
+  shared_ptr<CapsReader> sub = make_shared<CapsReader>();
+  int32_t code;
+  // 父对象parse(dup = false)时没有store, 子对象拷贝数据, 不引用调用者内存
+  if (store.get())
+    code = sub->parse(data, len, store);
+  else
+    code = sub->parse(data, len, true);
+  if (code != CAPS_SUCCESS)
+    return code;
+  r = sub;
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsReader::read_object(CapsReader*& r) {
   if (end_of_object())
     return CAPS_ERR_EOO;
-  if (current_member_type() != 'O')
+  int8_t type = current_member_type();
+  if (type != 'O' && type != 'B')
     return CAPS_ERR_INCORRECT_TYPE;
 
-  shared_ptr<CapsReader> sub;
-  int32_t code = CAPS_SUCCESS;
   uint32_t bin_size;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    bin_size = ntohl(bin_sizes[0]);
+  const int8_t* data = next_binary(bin_size);
+  r = nullptr;
+  if (bin_size == 0)
+    return CAPS_SUCCESS;
+  // c api写入的子对象为binary类型, parse(dup = true)时未转换字节序
+  // store可能由多个reader共享, 不能原地转换, 需要转换时拷贝
+  bool dup = store.get() == nullptr;
+  if (type == 'B' && bin_size > sizeof(Header)
+      && caps_need_swap(reinterpret_cast<const Header*>(data)->magic[0]))
+    dup = true;
+  CapsReader* sub = new CapsReader();
+  int32_t code;
+  if (dup)
+    code = sub->parse(data, bin_size, true);
   else
-    bin_size = bin_sizes[0];
-  if (bin_size > 0) {
-    sub = make_shared<CapsReader>();
-    code = sub->parse(binary_section, bin_size, true);
+    code = sub->parse(data, bin_size, store);
+  if (code != CAPS_SUCCESS) {
+    delete sub;
+    return code;
   }
-  binary_section += bin_size;
-  ++bin_sizes;
-  ++current_read_member;
-  r = static_pointer_cast<Caps>(sub);
-  return code;
+  r = sub;
+  return CAPS_SUCCESS;
 }
 
-int32_t CapsReader::read() {
-  if (end_of_object())
+int32_t CapsReader::check_types(const char* types, uint32_t n,
+    bool c_api) const {
+  uint32_t i;
+  char type;
+  char decl;
+
+  if (n > layout.num_members - cur.pos.current_read_member)
     return CAPS_ERR_EOO;
-  if (current_member_type() != 'V')
-    return CAPS_ERR_INCORRECT_TYPE;
-  ++current_read_member;
+  for (i = 0; i < n; ++i) {
+    type = types[i];
+    decl = layout.member_declarations[
+      -(int32_t)(cur.pos.current_read_member + i)];
+    if (decl != type && !(c_api && type == 'O' && decl == 'B'))
+      return CAPS_ERR_INCORRECT_TYPE;
+    if (c_api && layout.swap && caps_is_array(type))
+      return CAPS_ERR_BYTEORDER;
+  }
   return CAPS_SUCCESS;
 }
 
-CapsReader::~CapsReader() noexcept {
-  if (duplicated)
-    delete[] bin_data;
+int32_t CapsReader::read_fmt_prepare(const char* fmt,
+    vector<CapsReader*>& subs) {
+  const char* f;
+  uint32_t len;
+  CapsReader* sub;
+  CapsReaderRecord rec;
+  int32_t r = CAPS_SUCCESS;
+  size_t i;
+
+  record(rec);
+  for (f = fmt; *f && r == CAPS_SUCCESS; ++f) {
+    switch (*f) {
+      case 'i':
+      case 'f':
+        next32();
+        break;
+      case 'l':
+      case 'd':
+        next64();
+        break;
+      case 'S':
+        next_string(len);
+        break;
+      case 'B':
+        next_binary(len);
+        break;
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        if (caps_order32(cur.pos.bin_sizes[0], layout.swap)
+            % caps_array_element_size(*f))
+          r = CAPS_ERR_CORRUPTED;
+        else if ((uintptr_t)cur.pos.binary_section
+            % caps_array_element_size(*f))
+          r = CAPS_ERR_INVAL;
+        else
+          next_binary(len);
+        break;
+      case 'O':
+        r = read_object(sub);
+        if (r == CAPS_SUCCESS)
+          subs.push_back(sub);
+        break;
+      case 'V':
+        ++cur.pos.current_read_member;
+        break;
+    }
+  }
+  rollback(rec);
+  if (r != CAPS_SUCCESS) {
+    for (i = 0; i < subs.size(); ++i)
+      delete subs[i];
+    subs.clear();
+  }
+  return r;
 }
 
-int8_t CapsReader::current_member_type() const {
-  if (end_of_object())
-    return '\0';
-  return member_declarations[-(int32_t)current_read_member];
+int32_t CapsReader::read_fmt(const char* fmt, va_list ap) {
+  const char* f;
+  const void** p;
+  uint32_t* len;
+  uint32_t slen;
+  int32_t iv;
+  int64_t lv;
+  vector<CapsReader*> subs;
+  size_t nsub = 0;
+  int32_t r = check_types(fmt, strlen(fmt), true);
+  if (r != CAPS_SUCCESS)
+    return r;
+  if (strpbrk(fmt, "OIFLD")) {
+    r = read_fmt_prepare(fmt, subs);
+    if (r != CAPS_SUCCESS)
+      return r;
+  }
+  for (f = fmt; *f; ++f) {
+    switch (*f) {
+      case 'i':
+        *va_arg(ap, int32_t*) = next32();
+        break;
+      case 'f':
+        iv = next32();
+        memcpy(va_arg(ap, float*), &iv, sizeof(iv));
+        break;
+      case 'l':
+        *va_arg(ap, int64_t*) = next64();
+        break;
+      case 'd':
+        lv = next64();
+        memcpy(va_arg(ap, double*), &lv, sizeof(lv));
+        break;
+      case 'S':
+        *va_arg(ap, const char**) = next_string(slen);
+        break;
+      case 'B':
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        p = va_arg(ap, const void**);
+        len = va_arg(ap, uint32_t*);
+        *p = next_binary(*len);
+        if (*f != 'B')
+          *len /= caps_array_element_size(*f);
+        break;
+      case 'O':
+        next_binary(slen);
+        *va_arg(ap, caps_t*) = reinterpret_cast<caps_t>(subs[nsub++]);
+        break;
+      case 'V':
+        ++cur.pos.current_read_member;
+        break;
+    }
+  }
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsReader::read_array(const int32_t*& r, uint32_t& count) {
+  return cur.read_array(layout, r, count);
+}
+
+int32_t CapsReader::read_array(const float*& r, uint32_t& count) {
+  return cur.read_array(layout, r, count);
+}
+
+int32_t CapsReader::read_array(const int64_t*& r, uint32_t& count) {
+  return cur.read_array(layout, r, count);
+}
+
+int32_t CapsReader::read_array(const double*& r, uint32_t& count) {
+  return cur.read_array(layout, r, count);
+}
+
+int32_t CapsReader::read_array(vector<int32_t>& r) {
+  return cur.read_array(layout, r);
+}
+
+int32_t CapsReader::read_array(vector<float>& r) {
+  return cur.read_array(layout, r);
 }
 
-bool CapsReader::end_of_object() const {
-  return (uint8_t)member_declarations[1] <= current_read_member;
+int32_t CapsReader::read_array(vector<int64_t>& r) {
+  return cur.read_array(layout, r);
+}
+
+int32_t CapsReader::read_array(vector<double>& r) {
+  return cur.read_array(layout, r);
+}
+
+int32_t CapsReader::read() {
+  return cur.read_void(layout);
+}
+
+CapsReader::~CapsReader() noexcept {
 }
 
 void CapsReader::record(CapsReaderRecord& rec) const {
-  rec.number_values = number_values;
-  rec.long_values = long_values;
-  rec.bin_sizes = bin_sizes;
-  rec.binary_section = binary_section;
-  rec.string_section = string_section;
-  rec.current_read_member = current_read_member;
+  rec = cur.pos;
 }
 
 void CapsReader::rollback(const CapsReaderRecord& rec) {
-  number_values = rec.number_values;
-  long_values = rec.long_values;
-  bin_sizes = rec.bin_sizes;
-  binary_section = rec.binary_section;
-  string_section = rec.string_section;
-  current_read_member = rec.current_read_member;
+  cur.pos = rec;
 }
 
-uint32_t CapsReader::size() const {
-  return member_declarations[1];
+int32_t CapsReader::next_type() const {
+  return cur.next_type(layout);
 }
 
-int32_t CapsReader::next_type() const {
-  int32_t r = current_member_type();
-  if (r == '\0')
-    return CAPS_ERR_EOO;
-  return r;
+int32_t caps_parse_reuse(const void* data, uint32_t length,
+    shared_ptr<Caps>& caps) {
+  shared_ptr<CapsReader> reader;
+
+  if (caps.get() && caps->type() == CAPS_TYPE_READER && exclusive(caps))
+    reader = static_pointer_cast<CapsReader>(caps);
+  else
+    reader = make_shared<CapsReader>();
+  int32_t r = reader->parse(data, length, false);
+  if (r != CAPS_SUCCESS) {
+    caps.reset();
+    return r;
+  }
+  caps = reader;
+  return CAPS_SUCCESS;
 }
 
 } // namespace rokid
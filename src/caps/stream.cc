@@ -0,0 +1,121 @@
+#include <string.h>
+#include "caps-stream.h"
+#include "caps-reader.h"
+#include "defs.h"
+
+using namespace std;
+using namespace rokid;
+
+CapsStreamDecoder::CapsStreamDecoder(uint32_t max_size)
+    : max_frame_size(max_size) {
+}
+
+void CapsStreamDecoder::feed(const void* data, uint32_t length) {
+  chunk = reinterpret_cast<const int8_t*>(data);
+  chunk_size = length;
+}
+
+int32_t CapsStreamDecoder::next(shared_ptr<Caps>& caps) {
+  uint32_t length;
+  uint32_t n;
+  const int8_t* p;
+  int32_t r;
+
+  release_buffer();
+  if (buffer.empty()) {
+    if (chunk_size >= header_size()) {
+      r = frame_length(chunk, length);
+      if (r != CAPS_SUCCESS)
+        return r;
+      if (length <= chunk_size && aligned(chunk)) {
+        p = chunk;
+        chunk += length;
+        chunk_size -= length;
+        return parse_frame(p, length, caps);
+      }
+    }
+  }
+  // 帧不完整或未对齐, 拷贝到内部缓冲区
+  while (buffer_need() > 0) {
+    if (chunk_size == 0)
+      return CAPS_ERR_EOO;
+    n = chunk_size < buffer_need() ? chunk_size : buffer_need();
+    r = append_buffer(chunk, n);
+    chunk += n;
+    chunk_size -= n;
+    if (r != CAPS_SUCCESS)
+      return r;
+  }
+  return parse_buffer(caps);
+}
+
+void CapsStreamDecoder::reset() {
+  chunk = nullptr;
+  chunk_size = 0;
+  buffer.clear();
+  frame_size = 0;
+  buffer_ready = false;
+  stream_erase = 0;
+}
+
+uint32_t CapsStreamDecoder::pending() const {
+  return buffer_ready ? 0 : buffer.size();
+}
+
+uint32_t CapsStreamDecoder::header_size() {
+  return sizeof(Header);
+}
+
+int32_t CapsStreamDecoder::frame_length(const void* data,
+    uint32_t& length) const {
+  Header header;
+  memcpy(&header, data, sizeof(header));
+  int32_t r = check_header(&header, length);
+  if (r != CAPS_SUCCESS)
+    return r;
+  if (length <= sizeof(Header) || length > max_frame_size)
+    return CAPS_ERR_CORRUPTED;
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsStreamDecoder::parse_frame(const void* data, uint32_t length,
+    shared_ptr<Caps>& caps) {
+  return caps_parse_reuse(data, length, caps);
+}
+
+uint32_t CapsStreamDecoder::buffer_need() const {
+  if (frame_size == 0)
+    return header_size() - buffer.size();
+  return frame_size - buffer.size();
+}
+
+int32_t CapsStreamDecoder::append_buffer(const void* data, uint32_t length) {
+  const int8_t* p = reinterpret_cast<const int8_t*>(data);
+  buffer.insert(buffer.end(), p, p + length);
+  if (frame_size == 0 && buffer.size() == header_size()) {
+    int32_t r = frame_length(buffer.data(), frame_size);
+    if (r != CAPS_SUCCESS) {
+      frame_size = 0;
+      return r;
+    }
+    buffer.reserve(frame_size);
+  }
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsStreamDecoder::parse_buffer(shared_ptr<Caps>& caps) {
+  uint32_t length;
+  // buffer中header不正确
+  if (frame_size == 0)
+    return frame_length(buffer.data(), length);
+  buffer_ready = true;
+  return parse_frame(buffer.data(), frame_size, caps);
+}
+
+void CapsStreamDecoder::release_buffer() {
+  if (buffer_ready) {
+    buffer.clear();
+    frame_size = 0;
+    buffer_ready = false;
+  }
+}
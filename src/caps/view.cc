@@ -0,0 +1,161 @@
+#include "caps-view.h"
+#include "caps-writer.h"
+#include "defs.h"
+
+using namespace std;
+
+namespace rokid {
+
+int32_t CapsView::parse(const void* data, uint32_t datasize,
+    shared_ptr<CapsView>& r, bool dup) {
+  shared_ptr<CapsView> view = make_shared<CapsView>();
+  int32_t code = view->reader.parse(data, datasize, dup);
+  if (code != CAPS_SUCCESS) {
+    r.reset();
+    return code;
+  }
+  r = view;
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsView::create(const Caps& caps, shared_ptr<CapsView>& r) {
+  shared_ptr<CapsView> view = make_shared<CapsView>();
+  int32_t code;
+
+  r.reset();
+  if (caps.type() == CAPS_TYPE_WRITER) {
+    code = view->reader.parse(static_cast<const CapsWriter&>(caps));
+  } else {
+    const CapsReader& src = static_cast<const CapsReader&>(caps);
+    const CapsLayout& l = src.layout;
+    if (l.bin_data == nullptr)
+      return CAPS_ERR_INVAL;
+    if (src.store.get())
+      code = view->reader.parse(l.bin_data, l.data_length, src.store);
+    else
+      code = view->reader.parse(l.bin_data, l.data_length, false);
+  }
+  if (code != CAPS_SUCCESS)
+    return code;
+  r = view;
+  return CAPS_SUCCESS;
+}
+
+int8_t CapsView::member_type(uint32_t index) const {
+  if (index >= layout().num_members)
+    return '\0';
+  return layout().member_declarations[-(int32_t)index];
+}
+
+CapsCursor CapsView::cursor() const {
+  return CapsCursor(this);
+}
+
+int32_t CapsView::cursor(uint32_t index, CapsCursor& r) const {
+  r = CapsCursor(this);
+  return r.seek(index);
+}
+
+void CapsView::ensure_index() const {
+  call_once(index_once, [this]() {
+    const_cast<CapsLayout&>(reader.layout).build_index();
+  });
+}
+
+const CapsLayout CapsCursor::empty_layout;
+
+int32_t CapsCursor::read(const char*& r) {
+  uint32_t len;
+  return cur.read_string(layout(), r, len);
+}
+
+int32_t CapsCursor::read_string(const char*& r, uint32_t& len) {
+  return cur.read_string(layout(), r, len);
+}
+
+int32_t CapsCursor::read(string& r) {
+  return cur.read(layout(), r);
+}
+
+int32_t CapsCursor::read(const void*& r, uint32_t& len) {
+  return cur.read_binary(layout(), 'B', r, len);
+}
+
+int32_t CapsCursor::read(vector<uint8_t>& r) {
+  return cur.read(layout(), r);
+}
+
+int32_t CapsCursor::read(shared_ptr<CapsView>& r) {
+  const void* p;
+  uint32_t len;
+  int32_t code = cur.read_binary(layout(), 'O', p, len);
+  if (code != CAPS_SUCCESS)
+    return code;
+  r.reset();
+  if (len == 0)
+    return CAPS_SUCCESS;
+  shared_ptr<CapsView> sub = make_shared<CapsView>();
+  code = sub->reader.parse(p, len, view->store());
+  if (code != CAPS_SUCCESS)
+    return code;
+  r = sub;
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsCursor::read() {
+  return cur.read_void(layout());
+}
+
+int32_t CapsCursor::read_array(const int32_t*& r, uint32_t& count) {
+  return cur.read_array(layout(), r, count);
+}
+
+int32_t CapsCursor::read_array(const float*& r, uint32_t& count) {
+  return cur.read_array(layout(), r, count);
+}
+
+int32_t CapsCursor::read_array(const int64_t*& r, uint32_t& count) {
+  return cur.read_array(layout(), r, count);
+}
+
+int32_t CapsCursor::read_array(const double*& r, uint32_t& count) {
+  return cur.read_array(layout(), r, count);
+}
+
+int32_t CapsCursor::read_array(vector<int32_t>& r) {
+  return cur.read_array(layout(), r);
+}
+
+int32_t CapsCursor::read_array(vector<float>& r) {
+  return cur.read_array(layout(), r);
+}
+
+int32_t CapsCursor::read_array(vector<int64_t>& r) {
+  return cur.read_array(layout(), r);
+}
+
+int32_t CapsCursor::read_array(vector<double>& r) {
+  return cur.read_array(layout(), r);
+}
+
+int32_t CapsCursor::next_type() const {
+  return cur.next_type(layout());
+}
+
+int32_t CapsCursor::seek(uint32_t index) {
+  if (view == nullptr || index > view->size())
+    return CAPS_ERR_INVAL;
+  view->ensure_index();
+  return cur.seek(layout(), index);
+}
+
+int32_t CapsCursor::skip(uint32_t n) {
+  if (view == nullptr)
+    return CAPS_ERR_INVAL;
+  if (n > view->size() - cur.pos.current_read_member)
+    return CAPS_ERR_EOO;
+  view->ensure_index();
+  return cur.skip(layout(), n);
+}
+
+} // namespace rokid
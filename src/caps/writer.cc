@@ -1,448 +1,1094 @@
+#include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include "writer.h"
-#include "reader.h"
+#include <mutex>
+#include "caps-writer.h"
+#include "caps-reader.h"
+#include "defs.h"
 
 using namespace std;
 
 namespace rokid {
 
-static int64_t caps_htonll(int64_t v) {
-  int32_t num = 42;
-  if (*(char*)&num == 42) {
-    return ((((uint64_t)htonl(v)) << 32) + htonl((v) >> 32));
-  }
-  return v;
-}
-
-typedef struct {
+struct CapsWriter::WritePointer {
   char* mdecls;
   int32_t* ivalues;
   int64_t* lvalues;
   uint32_t* bin_sizes;
+  uint32_t* str_sizes;
+  // 字符串去重时为string offsets及预先计算的偏移, 否则为nullptr
+  uint32_t* str_offsets = nullptr;
+  const uint32_t* dedup_offsets = nullptr;
   int8_t* bin_section;
   char* str_section;
 
   uint32_t cur_strp = 0;
   uint32_t cur_binp = 0;
-} WritePointer;
-
-class Member {
-public:
-  virtual ~Member() = default;
-
-  virtual void do_serialize(Header* header, WritePointer* wp) const = 0;
-
-  virtual char type() const = 0;
-};
-
-class IntegerMember : public Member {
-public:
-  void do_serialize(Header* header, WritePointer* wp) const;
-
-  char type() const { return 'i'; }
-
-  int32_t value;
-};
-
-class LongMember : public Member {
-public:
-  void do_serialize(Header* header, WritePointer* wp) const;
-
-  char type() const { return 'l'; }
-
-  int64_t value;
-};
-
-class FloatMember : public Member {
-public:
-  void do_serialize(Header* header, WritePointer* wp) const;
-
-  char type() const { return 'f'; }
-
-  float value;
 };
 
-class DoubleMember : public Member {
-public:
-  void do_serialize(Header* header, WritePointer* wp) const;
-
-  char type() const { return 'd'; }
+template <bool Swap>
+void CapsWriter::serialize_object(const shared_ptr<Caps>& value,
+    WritePointer* wp, uint32_t flags) {
+  uint32_t obj_size;
 
-  double value;
-};
+  if (value.get())
+    obj_size = value->binary_size();
+  else
+    obj_size = 0;
+  if (value.get()) {
+    if (value->type() == CAPS_TYPE_WRITER) {
+      static_pointer_cast<CapsWriter>(value)->serialize(wp->bin_section + wp->cur_binp, obj_size, flags);
+    } else {
+      memcpy(wp->bin_section + wp->cur_binp, static_pointer_cast<CapsReader>(value)->binary_data(), obj_size);
+    }
+  }
+  wp->bin_sizes[0] = caps_order32<Swap>(obj_size);
+  ++wp->bin_sizes;
+  wp->cur_binp += ALIGN8(obj_size);
+}
 
-class StringMember : public Member {
+// 以开放寻址哈希表查找相同的字符串, 首次出现的字符串按成员顺序存放
+class CapsWriter::StringDedup {
 public:
-  void do_serialize(Header* header, WritePointer* wp) const;
-
-  char type() const { return 'S'; }
-
-  string value;
-};
+  void reserve(uint32_t n) {
+    uint32_t cap = 8;
+    while (cap < n * 2)
+      cap <<= 1;
+    slots.assign(cap, Slot());
+    offsets.reserve(n);
+  }
 
-class BinaryMember : public Member {
-public:
-  void do_serialize(Header* header, WritePointer* wp) const;
+  // 返回字符串在string section中的偏移
+  uint32_t add(const char* s, uint32_t len) {
+    uint32_t h = hash(s, len);
+    size_t mask = slots.size() - 1;
+    size_t i = h & mask;
+
+    while (slots[i].used) {
+      if (slots[i].hash == h && slots[i].length == len
+          && memcmp(slots[i].str, s, len) == 0)
+        return slots[i].offset;
+      i = (i + 1) & mask;
+    }
+    slots[i].used = true;
+    slots[i].str = s;
+    slots[i].length = len;
+    slots[i].hash = h;
+    slots[i].offset = size;
+    size += len + 1;
+    return slots[i].offset;
+  }
 
-  char type() const { return 'B'; }
+  // 每个字符串成员的偏移
+  vector<uint32_t> offsets;
+  // 去重后string section长度
+  uint32_t size = 0;
+
+private:
+  // FNV-1a
+  static uint32_t hash(const char* s, uint32_t len) {
+    uint32_t h = 2166136261u;
+    uint32_t i;
+    for (i = 0; i < len; ++i) {
+      h ^= (uint8_t)s[i];
+      h *= 16777619u;
+    }
+    return h;
+  }
 
-  string value;
+  struct Slot {
+    const char* str = nullptr;
+    uint32_t length = 0;
+    uint32_t hash = 0;
+    uint32_t offset = 0;
+    bool used = false;
+  };
+  vector<Slot> slots;
 };
 
-class ObjectMember : public Member {
-public:
-  void do_serialize(Header* header, WritePointer* wp) const;
+CapsWriter::CapsWriter() {
+  members.reserve(8);
+}
 
-  char type() const { return 'O'; }
+CapsWriter::CapsWriter(const CapsWriter& o) : CapsWriter() {
+  copy_from_writer(this, &o);
+}
 
-  shared_ptr<Caps> value;
-};
+CapsWriter::~CapsWriter() noexcept {
+  if (frozen)
+    frozen->remove_parent(this);
+  detach_sub_objects();
+}
 
-class VoidMember : public Member {
-public:
-  void do_serialize(Header* header, WritePointer* wp) const {
-    wp->mdecls[0] = 'V';
-    --wp->mdecls;
+void CapsWriter::detach_sub_objects() {
+  size_t i;
+  for (i = 0; i < sub_objects.size(); ++i) {
+    if (sub_objects[i].get() && sub_objects[i]->type() == CAPS_TYPE_WRITER)
+      static_pointer_cast<CapsWriter>(sub_objects[i])->remove_parent(this);
   }
-
-  char type() const { return 'V'; }
-};
-
-void IntegerMember::do_serialize(Header* header, WritePointer* wp) const {
-  wp->mdecls[0] = 'i';
-  --wp->mdecls;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    wp->ivalues[0] = htonl(value);
-  else
-    wp->ivalues[0] = value;
-  ++wp->ivalues;
 }
 
-void FloatMember::do_serialize(Header* header, WritePointer* wp) const {
-  wp->mdecls[0] = 'f';
-  --wp->mdecls;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    wp->ivalues[0] = htonl(*((int32_t*)&value));
-  else
-    memcpy(wp->ivalues, &value, sizeof(value));
-  ++wp->ivalues;
+void CapsWriter::reset() {
+  if (frozen) {
+    frozen->remove_parent(this);
+    frozen.reset();
+  }
+  detach_sub_objects();
+  members.clear();
+  arena.clear();
+  owned_strings.clear();
+  owned_binaries.clear();
+  sub_objects.clear();
+  number_member_number = 0;
+  long_member_number = 0;
+  string_member_number = 0;
+  binary_object_member_number = 0;
+  binary_section_size = 0;
+  string_section_size = 0;
+  object_data_size.store(0, memory_order_relaxed);
+  invalidate_size();
 }
 
-void LongMember::do_serialize(Header* header, WritePointer* wp) const {
-  wp->mdecls[0] = 'l';
-  --wp->mdecls;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    wp->lvalues[0] = caps_htonll(value);
-  else
-    wp->lvalues[0] = value;
-  ++wp->lvalues;
+uint32_t CapsWriter::arena_append(const void* data, uint32_t length,
+    bool terminate) {
+  if (frozen)
+    unfreeze();
+  uint32_t offset = arena.size();
+  const int8_t* p = reinterpret_cast<const int8_t*>(data);
+  arena.insert(arena.end(), p, p + length);
+  if (terminate)
+    arena.push_back(0);
+  return offset;
 }
 
-void DoubleMember::do_serialize(Header* header, WritePointer* wp) const {
-  wp->mdecls[0] = 'd';
-  --wp->mdecls;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    wp->lvalues[0] = caps_htonll(*(int64_t*)(&value));
-  else
-    memcpy(wp->lvalues, &value, sizeof(value));
-  ++wp->lvalues;
+// 所有writer的parents共用一个锁: convert后共享数据的writer及共享的
+// writer子对象可能在不同线程中同时修改同一parents
+// invalidate_parents沿parents递归, 使用recursive_mutex
+// 函数内静态对象, 全局对象构造时创建writer也可使用
+static recursive_mutex& parents_mutex() {
+  static recursive_mutex m;
+  return m;
 }
 
-void StringMember::do_serialize(Header* header, WritePointer* wp) const {
-  wp->mdecls[0] = 'S';
-  --wp->mdecls;
-  memcpy(wp->str_section + wp->cur_strp, value.c_str(), value.length() + 1);
-  wp->cur_strp += value.length() + 1;
-}
+void CapsWriter::invalidate_parents() {
+  size_t i;
 
-void BinaryMember::do_serialize(Header* header, WritePointer* wp) const {
-  wp->mdecls[0] = 'B';
-  --wp->mdecls;
-  if (header->magic[0] & CAPS_FLAG_NET_BYTEORDER)
-    wp->bin_sizes[0] = htonl(value.length());
-  else
-    wp->bin_sizes[0] = value.length();
-  ++wp->bin_sizes;
-  if (value.length() > 0) {
-    memcpy(wp->bin_section + wp->cur_binp, value.data(), value.length());
-    wp->cur_binp += ALIGN4(value.length());
-  }
+  size_dirty.store(true, memory_order_relaxed);
+  lock_guard<recursive_mutex> locker(parents_mutex());
+  for (i = 0; i < parents.size(); ++i)
+    parents[i]->invalidate_size();
 }
 
-void ObjectMember::do_serialize(Header* header, WritePointer* wp) const {
-  int32_t obj_size;
-  uint32_t flags = header->magic[0] & CAPS_FLAG_NET_BYTEORDER;
+void CapsWriter::add_parent(CapsWriter* parent) {
+  lock_guard<recursive_mutex> locker(parents_mutex());
+  parents.push_back(parent);
+}
 
-  wp->mdecls[0] = 'O';
-  --wp->mdecls;
-  if (value.get())
-    obj_size = value->binary_size();
-  else
-    obj_size = 0;
-  if (value.get()) {
-    if (value->type() == CAPS_TYPE_WRITER) {
-      static_pointer_cast<CapsWriter>(value)->serialize(wp->bin_section + wp->cur_binp, obj_size, flags);
-    } else {
-      memcpy(wp->bin_section + wp->cur_binp, static_pointer_cast<CapsReader>(value)->binary_data(), obj_size);
+void CapsWriter::remove_parent(const CapsWriter* parent) {
+  size_t i;
+  lock_guard<recursive_mutex> locker(parents_mutex());
+  for (i = 0; i < parents.size(); ++i) {
+    if (parents[i] == parent) {
+      parents.erase(parents.begin() + i);
+      break;
     }
   }
-  if (flags & CAPS_FLAG_NET_BYTEORDER)
-    wp->bin_sizes[0] = htonl(obj_size);
-  else
-    wp->bin_sizes[0] = obj_size;
-  ++wp->bin_sizes;
-  wp->cur_binp += ALIGN4(obj_size);
 }
 
-CapsWriter::CapsWriter() {
-  members.reserve(8);
+const void* CapsWriter::member_data(const MemberRecord* m) const {
+  if (m->flags & MEMBER_FLAG_REF)
+    return m->value.ref;
+  if (m->flags & MEMBER_FLAG_OWNED) {
+    if (m->type == 'S')
+      return owned_strings[m->value.offset].c_str();
+    return owned_binaries[m->value.offset].data();
+  }
+  return arena.data() + m->value.offset;
 }
 
-CapsWriter::~CapsWriter() noexcept {
-  int32_t i;
-  for (i = 0; i < members.size(); ++i) {
-    delete members[i];
-  }
+int32_t CapsWriter::write(const char* v) {
+  if (v == nullptr)
+    return CAPS_ERR_INVAL;
+  return write_string(v, strlen(v));
 }
 
-int32_t CapsWriter::write(int32_t v) {
-  IntegerMember* m = new IntegerMember();
-  m->value = v;
-  members.push_back(m);
-  ++number_member_number;
+int32_t CapsWriter::write_string(const char* v, uint32_t len) {
+  if (v == nullptr && len > 0)
+    return CAPS_ERR_INVAL;
+  uint32_t offset = arena_append(v, len, true);
+  MemberRecord& m = add_member('S');
+  m.length = len;
+  m.value.offset = offset;
+  ++string_member_number;
+  string_section_size += len + 1;
   return CAPS_SUCCESS;
 }
 
-int32_t CapsWriter::write(uint32_t v) {
-  return write((int32_t)v);
+int32_t CapsWriter::write(const string& v) {
+  return write_string(v.data(), v.length());
+}
+
+int32_t CapsWriter::write(string&& v) {
+  uint32_t len = v.length();
+  MemberRecord& m = add_member('S');
+  m.flags = MEMBER_FLAG_OWNED;
+  m.length = len;
+  m.value.offset = owned_strings.size();
+  owned_strings.push_back(move(v));
+  ++string_member_number;
+  string_section_size += len + 1;
+  return CAPS_SUCCESS;
 }
 
-int32_t CapsWriter::write(int64_t v) {
-  LongMember* m = new LongMember();
-  m->value = v;
-  members.push_back(m);
-  ++long_member_number;
+int32_t CapsWriter::write(const void* v, uint32_t l) {
+  if (v == nullptr && l > 0)
+    return CAPS_ERR_INVAL;
+  uint32_t offset = arena_append(v, l, false);
+  MemberRecord& m = add_member('B');
+  m.length = l;
+  m.value.offset = offset;
+  ++binary_object_member_number;
+  binary_section_size += ALIGN8(l);
   return CAPS_SUCCESS;
 }
 
-int32_t CapsWriter::write(uint64_t v) {
-  return write((int64_t)v);
+int32_t CapsWriter::write(const vector<uint8_t>& v) {
+  return write(v.data(), v.size());
 }
 
-int32_t CapsWriter::write(float v) {
-  FloatMember* m = new FloatMember();
-  m->value = v;
-  members.push_back(m);
-  ++number_member_number;
+int32_t CapsWriter::write(vector<uint8_t>&& v) {
+  uint32_t len = v.size();
+  MemberRecord& m = add_member('B');
+  m.flags = MEMBER_FLAG_OWNED;
+  m.length = len;
+  m.value.offset = owned_binaries.size();
+  owned_binaries.push_back(move(v));
+  ++binary_object_member_number;
+  binary_section_size += ALIGN8(len);
   return CAPS_SUCCESS;
 }
 
-int32_t CapsWriter::write(double v) {
-  DoubleMember* m = new DoubleMember();
-  m->value = v;
-  members.push_back(m);
-  ++long_member_number;
+int32_t CapsWriter::write(shared_ptr<Caps>& v) {
+  add_member('O').value.offset = sub_objects.size();
+  ++binary_object_member_number;
+  sub_objects.push_back(v);
+  if (v.get() && v->type() == CAPS_TYPE_WRITER)
+    static_pointer_cast<CapsWriter>(v)->add_parent(this);
   return CAPS_SUCCESS;
 }
 
-int32_t CapsWriter::write(const char* v) {
-  StringMember* m = new StringMember();
-  m->value = v;
-  members.push_back(m);
+int32_t CapsWriter::write_ref(const char* v) {
+  if (v == nullptr)
+    return CAPS_ERR_INVAL;
+  uint32_t len = strlen(v);
+  MemberRecord& m = add_member('S');
+  m.flags = MEMBER_FLAG_REF;
+  m.length = len;
+  m.value.ref = v;
   ++string_member_number;
-  string_section_size += m->value.length() + 1;
+  string_section_size += len + 1;
   return CAPS_SUCCESS;
 }
 
-int32_t CapsWriter::write(const string& v) {
-  return write(v.c_str());
+int32_t CapsWriter::write_ref(const void* v, uint32_t l) {
+  if (v == nullptr && l > 0)
+    return CAPS_ERR_INVAL;
+  MemberRecord& m = add_member('B');
+  m.flags = MEMBER_FLAG_REF;
+  m.length = l;
+  m.value.ref = v;
+  ++binary_object_member_number;
+  binary_section_size += ALIGN8(l);
+  return CAPS_SUCCESS;
 }
 
-int32_t CapsWriter::write(const void* v, uint32_t l) {
-  if (v == nullptr && l > 0)
+int32_t CapsWriter::write_array(char type, const void* v, uint32_t count) {
+  uint32_t esize = caps_array_element_size(type);
+  if ((v == nullptr && count > 0) || count > UINT32_MAX / esize)
     return CAPS_ERR_INVAL;
-  BinaryMember* m = new BinaryMember();
-  if (v)
-    m->value.assign((const char*)v, l);
-  members.push_back(m);
+  uint32_t length = count * esize;
+  uint32_t offset = arena_append(v, length, false);
+  MemberRecord& m = add_member(type);
+  m.length = length;
+  m.value.offset = offset;
   ++binary_object_member_number;
-  binary_section_size += ALIGN4(l);
+  binary_section_size += ALIGN8(length);
   return CAPS_SUCCESS;
 }
 
-int32_t CapsWriter::write(const vector<uint8_t>& v) {
-  return write(v.data(), v.size());
+int32_t CapsWriter::write_array(const int32_t* v, uint32_t count) {
+  return write_array('I', v, count);
 }
 
-int32_t CapsWriter::write(shared_ptr<Caps>& v) {
-  ObjectMember* m = new ObjectMember();
-  m->value = v;
-  members.push_back(m);
-  ++binary_object_member_number;
-  sub_objects.push_back(v);
-  return CAPS_SUCCESS;
+int32_t CapsWriter::write_array(const float* v, uint32_t count) {
+  return write_array('F', v, count);
+}
+
+int32_t CapsWriter::write_array(const int64_t* v, uint32_t count) {
+  return write_array('L', v, count);
+}
+
+int32_t CapsWriter::write_array(const double* v, uint32_t count) {
+  return write_array('D', v, count);
 }
 
 int32_t CapsWriter::write() {
-  VoidMember* m = new VoidMember();
-  members.push_back(m);
+  add_member('V');
   return CAPS_SUCCESS;
 }
 
-uint32_t CapsWriter::binary_size() const {
-  uint32_t r;
-  size_t i;
-  
-  r = sizeof(Header);
+int32_t CapsWriter::write_binary_object(const Caps* o) {
+  if (o == nullptr)
+    return write(nullptr, 0);
+  if (o->type() == CAPS_TYPE_READER) {
+    const CapsReader* r = static_cast<const CapsReader*>(o);
+    return write(r->binary_data(), r->binary_size());
+  }
+  if (frozen)
+    unfreeze();
+  uint32_t size = o->binary_size();
+  // 按8字节对齐, header及long section可直接写入
+  uint32_t offset = ALIGN8(arena.size());
+  arena.resize(offset + size);
+  static_cast<const CapsWriter*>(o)->serialize(arena.data() + offset, size,
+      CAPS_FLAG_NET_BYTEORDER);
+  MemberRecord& m = add_member('B');
+  m.length = size;
+  m.value.offset = offset;
+  ++binary_object_member_number;
+  binary_section_size += ALIGN8(size);
+  return CAPS_SUCCESS;
+}
+
+int32_t CapsWriter::write_fmt(const char* fmt, va_list ap) {
+  const char* f;
+  const void* p;
+  uint32_t len;
+  int32_t r = CAPS_SUCCESS;
+  va_list aq;
+
+  // 先检查所有类型及参数, 之后的写入不会失败
+  va_copy(aq, ap);
+  for (f = fmt; *f && r == CAPS_SUCCESS; ++f) {
+    switch (*f) {
+      case 'i':
+        va_arg(aq, int32_t);
+        break;
+      case 'f':
+      case 'd':
+        va_arg(aq, double);
+        break;
+      case 'l':
+        va_arg(aq, int64_t);
+        break;
+      case 'S':
+        if (va_arg(aq, const char*) == nullptr)
+          r = CAPS_ERR_INVAL;
+        break;
+      case 'B':
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        p = va_arg(aq, const void*);
+        len = va_arg(aq, uint32_t);
+        if (p == nullptr && len > 0)
+          r = CAPS_ERR_INVAL;
+        else if (*f != 'B' && len > UINT32_MAX / caps_array_element_size(*f))
+          r = CAPS_ERR_INVAL;
+        break;
+      case 'O':
+        va_arg(aq, caps_t);
+        break;
+      case 'V':
+        break;
+      default:
+        r = CAPS_ERR_INVAL;
+    }
+  }
+  va_end(aq);
+  if (r != CAPS_SUCCESS)
+    return r;
+  for (f = fmt; *f && r == CAPS_SUCCESS; ++f) {
+    switch (*f) {
+      case 'i':
+        write(va_arg(ap, int32_t));
+        break;
+      case 'f':
+        // float参数提升为double
+        write((float)va_arg(ap, double));
+        break;
+      case 'l':
+        write(va_arg(ap, int64_t));
+        break;
+      case 'd':
+        write(va_arg(ap, double));
+        break;
+      case 'S':
+        r = write(va_arg(ap, const char*));
+        break;
+      case 'B':
+        p = va_arg(ap, const void*);
+        len = va_arg(ap, uint32_t);
+        r = write(p, len);
+        break;
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        p = va_arg(ap, const void*);
+        len = va_arg(ap, uint32_t);
+        r = write_array(*f, p, len);
+        break;
+      case 'O':
+        r = write_binary_object(reinterpret_cast<const Caps*>(va_arg(ap, caps_t)));
+        break;
+      case 'V':
+        write();
+        break;
+    }
+  }
+  return r;
+}
+
+uint32_t CapsWriter::bin_section_offset(bool dedup) const {
+  uint32_t r = sizeof(Header);
   r += long_member_number * sizeof(int64_t); // long section
   r += number_member_number * sizeof(uint32_t); // number section
   r += binary_object_member_number * sizeof(uint32_t); // binary sizes
+  r += string_member_number * sizeof(uint32_t); // string sizes
+  if (dedup)
+    r += string_member_number * sizeof(uint32_t); // string offsets
+  return ALIGN8(r);
+}
+
+uint32_t CapsWriter::serialized_size(uint32_t flags,
+    StringDedup& dedup) const {
+  const MemberRecord* m = members.data();
+  const MemberRecord* mend = m + members.size();
+  uint32_t r = binary_size();
+
+  if ((flags & CAPS_FLAG_DEDUP_STRINGS) == 0)
+    return r;
+  dedup.reserve(string_member_number);
+  for (; m < mend; ++m) {
+    if (m->type == 'S')
+      dedup.offsets.push_back(dedup.add(
+            reinterpret_cast<const char*>(member_data(m)), m->length));
+  }
+  // binary_size已更新object_data_size
+  r = bin_section_offset(true);
+  r += binary_section_size;
+  r += object_data_size;
+  r += dedup.size;
+  r += members.size() + caps_count_size(members.size());
+  return ALIGN8(r);
+}
+
+uint32_t CapsWriter::binary_size() const {
+  uint32_t r;
+  uint32_t obj_size = 0;
+  size_t i;
+
+  if (frozen) {
+    // 大小由frozen缓存, 其变化时会通知此对象
+    size_dirty.store(false, memory_order_relaxed);
+    return frozen->binary_size();
+  }
+  if (!size_dirty.load(memory_order_acquire))
+    return cached_size.load(memory_order_relaxed);
+  r = bin_section_offset();
   r += binary_section_size;
   // sub objects
-  object_data_size = 0;
   for (i = 0; i < sub_objects.size(); ++i) {
     if (sub_objects[i].get())
-      object_data_size += sub_objects[i]->binary_size();
+      obj_size += ALIGN8(sub_objects[i]->binary_size());
   }
-  r += object_data_size;
+  r += obj_size;
   r += string_section_size;
-  r += members.size() + 1; // member declarations
-  return ALIGN4(r);
+  r += members.size() + caps_count_size(members.size()); // member declarations
+  // 总长度按8字节对齐, 连续排列的多个caps数据均保持8字节对齐
+  r = ALIGN8(r);
+  object_data_size.store(obj_size, memory_order_relaxed);
+  cached_size.store(r, memory_order_relaxed);
+  size_dirty.store(false, memory_order_release);
+  return r;
 }
 
 int32_t CapsWriter::serialize(void* buf, uint32_t bufsize,
     uint32_t flags) const {
-  Header* header;
-  WritePointer wp;
-  uint32_t total_size = binary_size();
+  if (frozen)
+    return frozen->serialize(buf, bufsize, flags);
+  StringDedup dedup;
+  uint32_t total_size = serialized_size(flags, dedup);
 
   if (bufsize < total_size || buf == nullptr)
     return total_size;
+  serialize_to(buf, total_size, flags, dedup);
+  return total_size;
+}
+
+template <typename T>
+int32_t CapsWriter::append_to(T& buf, uint32_t flags) const {
+  if (frozen)
+    return frozen->append_to(buf, flags);
+  StringDedup dedup;
+  uint32_t total_size = serialized_size(flags, dedup);
+  size_t offset = buf.size();
+
+  buf.resize(offset + total_size);
+  serialize_to(&buf[offset], total_size, flags, dedup);
+  return total_size;
+}
+
+int32_t CapsWriter::serialize_append(string& buf, uint32_t flags) const {
+  return append_to(buf, flags);
+}
+
+int32_t CapsWriter::serialize_append(vector<uint8_t>& buf,
+    uint32_t flags) const {
+  return append_to(buf, flags);
+}
+
+int32_t CapsWriter::serialize_realloc(void** buf, uint32_t* bufsize,
+    uint32_t flags) const {
+  if (frozen)
+    return frozen->serialize_realloc(buf, bufsize, flags);
+  StringDedup dedup;
+  uint32_t total_size = serialized_size(flags, dedup);
+
+  if (*buf == nullptr || *bufsize < total_size) {
+    void* p = realloc(*buf, total_size);
+    if (p == nullptr)
+      return CAPS_ERR_NOMEM;
+    *buf = p;
+    *bufsize = total_size;
+  }
+  serialize_to(*buf, total_size, flags, dedup);
+  return total_size;
+}
+
+int32_t CapsWriter::to_reader(shared_ptr<Caps>& r) const {
+  shared_ptr<CapsReader> reader = make_shared<CapsReader>();
+  int32_t code = reader->parse(*this);
+  if (code != CAPS_SUCCESS) {
+    r.reset();
+    return code;
+  }
+  r = reader;
+  return CAPS_SUCCESS;
+}
+
+void CapsWriter::serialize_to(void* buf, uint32_t total_size,
+    uint32_t flags, const StringDedup& dedup) const {
+  Header* header;
+  WritePointer wp;
+  bool dedup_strings = flags & CAPS_FLAG_DEDUP_STRINGS;
+
   header = reinterpret_cast<Header*>(buf);
   wp.lvalues = reinterpret_cast<int64_t*>(header + 1);
   wp.ivalues = reinterpret_cast<int32_t*>(wp.lvalues + long_member_number);
   wp.bin_sizes = reinterpret_cast<uint32_t*>(wp.ivalues + number_member_number);
-  wp.bin_section = reinterpret_cast<int8_t*>(wp.bin_sizes + binary_object_member_number);
-  wp.str_section = reinterpret_cast<char*>(wp.bin_section + binary_section_size + object_data_size);
-  wp.mdecls = reinterpret_cast<char*>(buf) + total_size - 1;
-
-  memcpy(header->magic, CAPS_MAGIC, sizeof(CAPS_MAGIC));
-  if (flags & CAPS_FLAG_NET_BYTEORDER) {
-    header->magic[0] |= CAPS_FLAG_NET_BYTEORDER;
-    header->length = htonl(total_size);
-  } else {
-    header->length = total_size;
+  wp.str_sizes = wp.bin_sizes + binary_object_member_number;
+  if (dedup_strings) {
+    wp.str_offsets = wp.str_sizes + string_member_number;
+    wp.dedup_offsets = dedup.offsets.data();
   }
-  wp.mdecls[0] = members.size();
-  --wp.mdecls;
+  wp.bin_section = reinterpret_cast<int8_t*>(header) + bin_section_offset(dedup_strings);
+  wp.str_section = reinterpret_cast<char*>(wp.bin_section + binary_section_size + object_data_size);
+  wp.mdecls = caps_write_count(reinterpret_cast<char*>(buf) + total_size,
+      members.size()) - 1;
 
-  size_t i;
-  for (i = 0; i < members.size(); ++i) {
-    members[i]->do_serialize(header, &wp);
-  }
-  return total_size;
+  write_header(header, total_size, flags);
+  if (caps_need_swap(flags))
+    serialize_members<true>(&wp, flags);
+  else
+    serialize_members<false>(&wp, flags);
 }
 
-static void copy_from_reader(CapsWriter* dst, const CapsReader* src) {
-  int32_t iv;
-  float fv;
-  int64_t lv;
-  double dv;
-  const char* sv;
-  const void* bv;
-  uint32_t bl;
-  shared_ptr<Caps> cv;
-  CapsReaderRecord rec;
-  CapsReader* msrc = const_cast<CapsReader*>(src);
+void CapsWriter::write_header(Header* header, uint32_t total_size,
+    uint32_t flags) {
+  memcpy(header->magic, CAPS_MAGIC, sizeof(CAPS_MAGIC));
+  header->magic[0] |= flags & (CAPS_FLAG_NET_BYTEORDER
+      | CAPS_FLAG_DEDUP_STRINGS);
+  header->length = caps_order32(total_size, caps_need_swap(flags));
+}
 
-  msrc->record(rec);
-  while (!msrc->end_of_object()) {
-    switch (msrc->current_member_type()) {
+template <bool Swap>
+void CapsWriter::serialize_members(WritePointer* wp, uint32_t flags) const {
+  const MemberRecord* m = members.data();
+  const MemberRecord* mend = m + members.size();
+  char* mdecls = wp->mdecls;
+  int32_t* ivalues = wp->ivalues;
+  int64_t* lvalues = wp->lvalues;
+  uint32_t* bin_sizes = wp->bin_sizes;
+  uint32_t* str_sizes = wp->str_sizes;
+  uint32_t* str_offsets = wp->str_offsets;
+  const uint32_t* dedup_offsets = wp->dedup_offsets;
+  uint32_t offset;
+  int8_t* p;
+
+  for (; m < mend; ++m) {
+    *mdecls-- = m->type;
+    switch (m->type) {
       case 'i':
-        msrc->read(iv);
-        dst->write(iv);
-        break;
       case 'f':
-        msrc->read(fv);
-        dst->write(fv);
+        *ivalues++ = caps_order32<Swap>(m->value.i);
         break;
       case 'l':
-        msrc->read(lv);
-        dst->write(lv);
-        break;
       case 'd':
-        msrc->read(dv);
-        dst->write(dv);
+        caps_store64(lvalues++, caps_order64<Swap>(m->value.l));
         break;
       case 'S':
-        msrc->read(sv);
-        dst->write(sv);
+        *str_sizes++ = caps_order32<Swap>(m->length);
+        if (str_offsets) {
+          offset = *dedup_offsets++;
+          *str_offsets++ = caps_order32<Swap>(offset);
+          // 重复的字符串已写入
+          if (offset != wp->cur_strp)
+            break;
+        }
+        memcpy(wp->str_section + wp->cur_strp, member_data(m),
+            m->length + 1);
+        wp->cur_strp += m->length + 1;
         break;
       case 'B':
-        msrc->read(bv, bl);
-        dst->write(bv, bl);
+        *bin_sizes++ = caps_order32<Swap>(m->length);
+        if (m->length > 0) {
+          memcpy(wp->bin_section + wp->cur_binp, member_data(m),
+              m->length);
+          wp->cur_binp += ALIGN8(m->length);
+        }
         break;
       case 'O':
-        msrc->read(cv);
-        dst->write(cv);
+        wp->bin_sizes = bin_sizes;
+        // 子对象的长度已由binary_size确定, 不去重
+        serialize_object<Swap>(sub_objects[m->value.offset], wp,
+            flags & ~CAPS_FLAG_DEDUP_STRINGS);
+        ++bin_sizes;
         break;
-      case 'V':
-        msrc->read();
-        dst->write();
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        *bin_sizes++ = caps_order32<Swap>(m->length);
+        if (m->length > 0) {
+          p = wp->bin_section + wp->cur_binp;
+          memcpy(p, member_data(m), m->length);
+          if (Swap)
+            caps_bswap_array(m->type, p, m->length);
+          wp->cur_binp += ALIGN8(m->length);
+        }
         break;
     }
   }
-  msrc->rollback(rec);
 }
 
-void CapsWriter::copy_from_writer(CapsWriter* dst, const CapsWriter* src) {
-  size_t i;
-  size_t s = src->members.size();
-  Member* m;
+typedef struct {
+  // nullptr: 数据位于IovBuilder::buf, 偏移为offset
+  const void* ref;
+  uint32_t offset;
+  uint32_t length;
+} IovSegment;
+
+class CapsWriter::IovBuilder {
+public:
+  IovBuilder(string& b, uint32_t t) : buf(b), threshold(t) {
+  }
+
+  // 在buf中分配'length'字节, 返回偏移
+  // 返回的偏移在下一次alloc之前才可转换为指针使用
+  uint32_t alloc(uint32_t length) {
+    uint32_t offset;
+    if (!segments.empty() && segments.back().ref == nullptr) {
+      offset = buf.length();
+      buf.append(length, '\0');
+      segments.back().length += length;
+    } else {
+      // 新的segment在buf中的偏移与其在序列化数据中的偏移按8字节同余,
+      // 保证在buf中写入的header及数值区对齐
+      buf.append((total - buf.length()) & 7, '\0');
+      offset = buf.length();
+      buf.append(length, '\0');
+      segments.emplace_back();
+      segments.back().ref = nullptr;
+      segments.back().offset = offset;
+      segments.back().length = length;
+    }
+    total += length;
+    return offset;
+  }
+
+  void append(const void* data, uint32_t length) {
+    if (length == 0)
+      return;
+    if (length < threshold) {
+      memcpy(&buf[alloc(length)], data, length);
+      return;
+    }
+    segments.emplace_back();
+    segments.back().ref = data;
+    segments.back().length = length;
+    total += length;
+  }
 
-  for (i = 0; i < s; ++i) {
-    m = src->members[i];
-    switch (m->type()) {
+  void finish(vector<struct iovec>& iov) const {
+    size_t i;
+    iov.resize(segments.size());
+    for (i = 0; i < segments.size(); ++i) {
+      if (segments[i].ref)
+        iov[i].iov_base = const_cast<void*>(segments[i].ref);
+      else
+        iov[i].iov_base = &buf[segments[i].offset];
+      iov[i].iov_len = segments[i].length;
+    }
+  }
+
+  string& buf;
+
+private:
+  uint32_t threshold;
+  // 已生成的序列化数据长度
+  uint32_t total = 0;
+  vector<IovSegment> segments;
+};
+
+template <bool Swap>
+void CapsWriter::serialize_fixed(Header* header) const {
+  const MemberRecord* m = members.data();
+  const MemberRecord* mend = m + members.size();
+  int64_t* lvalues = reinterpret_cast<int64_t*>(header + 1);
+  int32_t* ivalues = reinterpret_cast<int32_t*>(lvalues + long_member_number);
+  uint32_t* bin_sizes = reinterpret_cast<uint32_t*>(ivalues + number_member_number);
+  uint32_t* str_sizes = bin_sizes + binary_object_member_number;
+  uint32_t obj_size;
+
+  for (; m < mend; ++m) {
+    switch (m->type) {
       case 'i':
-        dst->write(static_cast<IntegerMember*>(m)->value);
-        break;
-      case 'l':
-        dst->write(static_cast<LongMember*>(m)->value);
-        break;
       case 'f':
-        dst->write(static_cast<FloatMember*>(m)->value);
+        *ivalues++ = caps_order32<Swap>(m->value.i);
         break;
+      case 'l':
       case 'd':
-        dst->write(static_cast<DoubleMember*>(m)->value);
+        caps_store64(lvalues++, caps_order64<Swap>(m->value.l));
         break;
       case 'S':
-        dst->write(static_cast<StringMember*>(m)->value.c_str());
+        *str_sizes++ = caps_order32<Swap>(m->length);
         break;
       case 'B':
-        dst->write(static_cast<BinaryMember*>(m)->value.data(),
-            static_cast<BinaryMember*>(m)->value.length());
+      case 'I':
+      case 'F':
+      case 'L':
+      case 'D':
+        *bin_sizes++ = caps_order32<Swap>(m->length);
         break;
       case 'O':
-        dst->write(static_cast<ObjectMember*>(m)->value);
-        break;
-      case 'V':
-        dst->write();
+        if (sub_objects[m->value.offset].get())
+          obj_size = sub_objects[m->value.offset]->binary_size();
+        else
+          obj_size = 0;
+        *bin_sizes++ = caps_order32<Swap>(obj_size);
         break;
     }
   }
 }
 
-CapsWriter& CapsWriter::operator = (const Caps& o) {
-  if (o.type() == CAPS_TYPE_WRITER)
-    copy_from_writer(this, static_cast<const CapsWriter*>(&o));
+int32_t CapsWriter::serialize_iov(vector<struct iovec>& iov, string& buf,
+    uint32_t flags, uint32_t threshold) const {
+  if (frozen)
+    return frozen->serialize_iov(iov, buf, flags, threshold);
+  if (flags & CAPS_FLAG_DEDUP_STRINGS) {
+    // 去重的字符串不按成员顺序引用, 整体序列化到'buf'
+    buf.clear();
+    int32_t r = append_to(buf, flags);
+    iov.resize(1);
+    iov[0].iov_base = &buf[0];
+    iov[0].iov_len = buf.length();
+    return r;
+  }
+  IovBuilder builder(buf, threshold);
+  uint32_t total_size = binary_size();
+
+  buf.clear();
+  serialize_iov(builder, total_size, flags);
+  builder.finish(iov);
+  return total_size;
+}
+
+void CapsWriter::serialize_iov(IovBuilder& builder, uint32_t total_size,
+    uint32_t flags) const {
+  if (frozen) {
+    frozen->serialize_iov(builder, total_size, flags);
+    return;
+  }
+  const MemberRecord* mbegin = members.data();
+  const MemberRecord* mend = mbegin + members.size();
+  const MemberRecord* m;
+  uint32_t front_size = bin_section_offset();
+  uint32_t obj_size;
+  uint32_t offset;
+  bool swap = caps_need_swap(flags);
+
+  // header, long/number section, binary/string sizes
+  Header* header = reinterpret_cast<Header*>(&builder.buf[builder.alloc(front_size)]);
+  write_header(header, total_size, flags);
+  if (swap)
+    serialize_fixed<true>(header);
   else
-    copy_from_reader(this, static_cast<const CapsReader*>(&o));
+    serialize_fixed<false>(header);
+
+  // binary section
+  uint32_t data_size = front_size;
+  for (m = mbegin; m < mend; ++m) {
+    if (m->type == 'B') {
+      builder.append(member_data(m), m->length);
+      if (ALIGN8(m->length) > m->length)
+        builder.alloc(ALIGN8(m->length) - m->length);
+      data_size += ALIGN8(m->length);
+    } else if (m->type == 'O') {
+      const shared_ptr<Caps>& value = sub_objects[m->value.offset];
+      if (value.get() == nullptr)
+        continue;
+      obj_size = value->binary_size();
+      if (value->type() == CAPS_TYPE_WRITER)
+        static_pointer_cast<CapsWriter>(value)->serialize_iov(builder, obj_size, flags);
+      else
+        builder.append(static_pointer_cast<CapsReader>(value)->binary_data(), obj_size);
+      if (ALIGN8(obj_size) > obj_size)
+        builder.alloc(ALIGN8(obj_size) - obj_size);
+      data_size += ALIGN8(obj_size);
+    } else if (caps_is_array(m->type)) {
+      if (swap && m->length > 0) {
+        // 需转换字节序, 不能直接引用arena
+        offset = builder.alloc(m->length);
+        memcpy(&builder.buf[offset], member_data(m), m->length);
+        caps_bswap_array(m->type, &builder.buf[offset], m->length);
+      } else {
+        builder.append(member_data(m), m->length);
+      }
+      if (ALIGN8(m->length) > m->length)
+        builder.alloc(ALIGN8(m->length) - m->length);
+      data_size += ALIGN8(m->length);
+    }
+  }
+
+  // string section
+  for (m = mbegin; m < mend; ++m) {
+    if (m->type == 'S') {
+      builder.append(member_data(m), m->length + 1);
+      data_size += m->length + 1;
+    }
+  }
+
+  // member declarations
+  uint32_t tail_size = total_size - data_size;
+  char* mdecls = caps_write_count(&builder.buf[builder.alloc(tail_size)]
+      + tail_size, members.size()) - 1;
+  for (m = mbegin; m < mend; ++m) {
+    mdecls[0] = m->type;
+    --mdecls;
+  }
+}
+
+// 将reader的成员写入writer, 子对象为与reader共享数据的reader, 不逐个拷贝成员
+class CopyVisitor : public CapsVisitor {
+public:
+  CopyVisitor(CapsWriter* d, const CapsReader* s) : dst(d), src(s) {
+  }
+
+  inline int32_t on_integer(int32_t v) {
+    return dst->write(v);
+  }
+
+  inline int32_t on_float(float v) {
+    return dst->write(v);
+  }
+
+  inline int32_t on_long(int64_t v) {
+    return dst->write(v);
+  }
+
+  inline int32_t on_double(double v) {
+    return dst->write(v);
+  }
+
+  inline int32_t on_string(const char* v, uint32_t len) {
+    return dst->write_string(v, len);
+  }
+
+  inline int32_t on_binary(const void* v, uint32_t len) {
+    return dst->write(v, len);
+  }
+
+  template <typename T>
+  inline int32_t on_array(const T* v, uint32_t count) {
+    return dst->write_array(v, count);
+  }
+
+  inline int32_t on_void() {
+    return dst->write();
+  }
+
+  int32_t on_object_begin(const void* data, uint32_t len) {
+    shared_ptr<Caps> sub;
+    int32_t r = src->sub_object(data, len, sub);
+    if (r != CAPS_SUCCESS)
+      return r;
+    dst->write(sub);
+    return CAPS_VISIT_SKIP;
+  }
+
+private:
+  CapsWriter* dst;
+  const CapsReader* src;
+};
+
+static int32_t copy_from_reader(CapsWriter* dst, const CapsReader* src) {
+  CapsReaderRecord rec;
+  CapsReader* msrc = const_cast<CapsReader*>(src);
+  CopyVisitor visitor(dst, src);
+
+  msrc->record(rec);
+  int32_t r = msrc->visit(visitor);
+  msrc->rollback(rec);
+  return r;
+}
+
+int32_t CapsWriter::append(const Caps& o) {
+  if (o.type() == CAPS_TYPE_WRITER) {
+    copy_from_writer(this, static_cast<const CapsWriter*>(&o));
+    return CAPS_SUCCESS;
+  }
+  const CapsReader* src = static_cast<const CapsReader*>(&o);
+  // 'o'的数据不正确时此对象不变: 此对象为空时直接写入, 失败时清空,
+  // 否则先写入临时对象
+  if (size() == 0) {
+    int32_t r = copy_from_reader(this, src);
+    if (r != CAPS_SUCCESS)
+      reset();
+    return r;
+  }
+  CapsWriter tmp;
+  int32_t r = copy_from_reader(&tmp, src);
+  if (r == CAPS_SUCCESS)
+    copy_from_writer(this, &tmp);
+  return r;
+}
+
+void CapsWriter::copy_from_writer(CapsWriter* dst, const CapsWriter* src) {
+  if (dst == src)
+    return;
+  // 先拷贝dst共享的数据, 'src'可能与dst共享同一frozen
+  if (dst->frozen)
+    dst->unfreeze();
+  if (src->frozen)
+    src = src->frozen.get();
+
+  uint32_t arena_base = dst->arena.size();
+  uint32_t object_base = dst->sub_objects.size();
+  size_t member_base = dst->members.size();
+  size_t i;
+
+  dst->members.insert(dst->members.end(), src->members.begin(),
+      src->members.end());
+  dst->arena.insert(dst->arena.end(), src->arena.begin(), src->arena.end());
+  dst->sub_objects.insert(dst->sub_objects.end(), src->sub_objects.begin(),
+      src->sub_objects.end());
+  for (i = object_base; i < dst->sub_objects.size(); ++i) {
+    if (dst->sub_objects[i].get()
+        && dst->sub_objects[i]->type() == CAPS_TYPE_WRITER)
+      static_pointer_cast<CapsWriter>(dst->sub_objects[i])->add_parent(dst);
+  }
+  for (i = member_base; i < dst->members.size(); ++i) {
+    MemberRecord& m = dst->members[i];
+    if (m.flags & MEMBER_FLAG_REF)
+      continue;
+    // 'src'接管的数据拷贝到'dst'的arena中
+    if (m.flags & MEMBER_FLAG_OWNED) {
+      m.value.offset = dst->arena_append(
+          src->member_data(&src->members[i - member_base]), m.length,
+          m.type == 'S');
+      m.flags = 0;
+      continue;
+    }
+    if (m.type == 'S' || m.type == 'B' || caps_is_array(m.type))
+      m.value.offset += arena_base;
+    else if (m.type == 'O')
+      m.value.offset += object_base;
+  }
+  dst->number_member_number += src->number_member_number;
+  dst->long_member_number += src->long_member_number;
+  dst->string_member_number += src->string_member_number;
+  dst->binary_object_member_number += src->binary_object_member_number;
+  dst->binary_section_size += src->binary_section_size;
+  dst->string_section_size += src->string_section_size;
+  dst->invalidate_size();
+}
+
+shared_ptr<CapsWriter> CapsWriter::share() {
+  size_t i;
+
+  if (frozen)
+    return frozen;
+  shared_ptr<CapsWriter> s = make_shared<CapsWriter>();
+  s->members.swap(members);
+  s->arena.swap(arena);
+  s->owned_strings.swap(owned_strings);
+  s->owned_binaries.swap(owned_binaries);
+  s->sub_objects.swap(sub_objects);
+  swap(s->number_member_number, number_member_number);
+  swap(s->long_member_number, long_member_number);
+  swap(s->string_member_number, string_member_number);
+  swap(s->binary_object_member_number, binary_object_member_number);
+  swap(s->binary_section_size, binary_section_size);
+  swap(s->string_section_size, string_section_size);
+  // writer子对象的父对象改为s
+  for (i = 0; i < s->sub_objects.size(); ++i) {
+    if (s->sub_objects[i].get()
+        && s->sub_objects[i]->type() == CAPS_TYPE_WRITER) {
+      CapsWriter* o = static_cast<CapsWriter*>(s->sub_objects[i].get());
+      o->remove_parent(this);
+      o->add_parent(s.get());
+    }
+  }
+  s->add_parent(this);
+  frozen = s;
+  return s;
+}
+
+void CapsWriter::unfreeze() {
+  shared_ptr<CapsWriter> s;
+
+  s.swap(frozen);
+  s->remove_parent(this);
+  copy_from_writer(this, s.get());
+  invalidate_parents();
+}
+
+void CapsWriter::share_from(CapsWriter& src) {
+  if (&src == this)
+    return;
+  // 先取得共享数据, 'src'可能是此对象的子对象
+  shared_ptr<CapsWriter> s = src.share();
+  reset();
+  frozen = s;
+  frozen->add_parent(this);
+}
+
+CapsWriter& CapsWriter::operator = (const Caps& o) {
+  append(o);
   return *this;
 }
 
-uint32_t CapsWriter::size() const {
-  return members.size();
+CapsWriter& CapsWriter::operator = (const CapsWriter& o) {
+  if (&o == this)
+    return *this;
+  // 'o'可能是此对象(或其共享数据)的子对象, reset后仍须有效
+  vector<shared_ptr<Caps> > subs(sub_objects);
+  shared_ptr<CapsWriter> s(frozen);
+  reset();
+  copy_from_writer(this, &o);
+  return *this;
 }
 
 } // namespace rokid
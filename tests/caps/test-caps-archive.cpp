@@ -0,0 +1,148 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "caps-archive.h"
+
+using namespace std;
+
+static void append_records(CapsArchiveWriter& writer, uint32_t begin,
+    uint32_t end) {
+  uint32_t i;
+  for (i = begin; i < end; ++i) {
+    shared_ptr<Caps> caps = Caps::new_instance();
+    caps->write((int32_t)i);
+    caps->write(string(i % 37, 'x'));
+    ASSERT_EQ(writer.append(*caps, i * 10), CAPS_SUCCESS);
+  }
+}
+
+static void check_record(CapsArchiveReader& reader, uint32_t i) {
+  shared_ptr<Caps> caps;
+  int64_t ts;
+  int32_t iv;
+  string sv;
+  ASSERT_EQ(reader.next(caps, &ts), CAPS_SUCCESS);
+  EXPECT_EQ(ts, i * 10);
+  ASSERT_EQ(caps->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, (int32_t)i);
+  ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, string(i % 37, 'x'));
+}
+
+class CapsArchiveTest : public testing::Test {
+protected:
+  void SetUp() {
+    char tmpl[] = "/tmp/caps-archive-XXXXXX";
+    int fd = mkstemp(tmpl);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path = tmpl;
+    unlink(path.c_str());
+  }
+
+  void TearDown() {
+    unlink(path.c_str());
+    unlink((path + ".idx").c_str());
+  }
+
+  string path;
+};
+
+TEST_F(CapsArchiveTest, appendAndReplay) {
+  CapsArchiveWriter writer;
+  ASSERT_EQ(writer.open(path.c_str(), 16, 1024), CAPS_SUCCESS);
+  append_records(writer, 0, 500);
+  writer.close();
+
+  // 重新打开, 追加记录
+  ASSERT_EQ(writer.open(path.c_str(), 16, 1024), CAPS_SUCCESS);
+  EXPECT_EQ(writer.size(), 500u);
+  append_records(writer, 500, 600);
+  ASSERT_EQ(writer.flush(), CAPS_SUCCESS);
+
+  CapsArchiveReader reader;
+  uint32_t i;
+  ASSERT_EQ(reader.open(path.c_str()), CAPS_SUCCESS);
+  ASSERT_EQ(reader.size(), 600u);
+  for (i = 0; i < 600; ++i)
+    check_record(reader, i);
+  shared_ptr<Caps> caps;
+  EXPECT_EQ(reader.next(caps), CAPS_ERR_EOO);
+
+  ASSERT_EQ(reader.seek(333), CAPS_SUCCESS);
+  check_record(reader, 333);
+  ASSERT_EQ(reader.seek(0), CAPS_SUCCESS);
+  check_record(reader, 0);
+  ASSERT_EQ(reader.seek(600), CAPS_SUCCESS);
+  EXPECT_EQ(reader.next(caps), CAPS_ERR_EOO);
+  EXPECT_EQ(reader.seek(601), CAPS_ERR_INVAL);
+
+  ASSERT_EQ(reader.seek_time(4321), CAPS_SUCCESS);
+  EXPECT_EQ(reader.tell(), 433u);
+  check_record(reader, 433);
+  ASSERT_EQ(reader.seek_time(-1), CAPS_SUCCESS);
+  EXPECT_EQ(reader.tell(), 0u);
+  ASSERT_EQ(reader.seek_time(100000), CAPS_SUCCESS);
+  EXPECT_EQ(reader.tell(), 600u);
+}
+
+TEST_F(CapsArchiveTest, truncatedTail) {
+  CapsArchiveWriter writer;
+  ASSERT_EQ(writer.open(path.c_str(), 8), CAPS_SUCCESS);
+  append_records(writer, 0, 100);
+  writer.close();
+
+  // 模拟异常退出: 最后一条记录不完整, 索引丢失
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+  ASSERT_GE(fd, 0);
+  int64_t ts = 1000;
+  char partial[] = { 0x1e, 'A', 'P' };
+  ASSERT_EQ(write(fd, &ts, sizeof(ts)), (ssize_t)sizeof(ts));
+  ASSERT_EQ(write(fd, partial, sizeof(partial)), (ssize_t)sizeof(partial));
+  close(fd);
+  unlink((path + ".idx").c_str());
+
+  CapsArchiveReader reader;
+  ASSERT_EQ(reader.open(path.c_str()), CAPS_SUCCESS);
+  EXPECT_EQ(reader.size(), 100u);
+  ASSERT_EQ(reader.seek(99), CAPS_SUCCESS);
+  check_record(reader, 99);
+  reader.close();
+
+  // 追加时截断不完整的记录
+  ASSERT_EQ(writer.open(path.c_str(), 8), CAPS_SUCCESS);
+  append_records(writer, 100, 110);
+  writer.close();
+  ASSERT_EQ(reader.open(path.c_str()), CAPS_SUCCESS);
+  ASSERT_EQ(reader.size(), 110u);
+  ASSERT_EQ(reader.seek(95), CAPS_SUCCESS);
+  uint32_t i;
+  for (i = 95; i < 110; ++i)
+    check_record(reader, i);
+}
+
+TEST_F(CapsArchiveTest, zeroCopyArray) {
+  CapsArchiveWriter writer;
+  vector<int64_t> lv = { 1, -2, (int64_t)1 << 40 };
+  vector<int32_t> iv = { 3, -4, 5 };
+  ASSERT_EQ(writer.open(path.c_str()), CAPS_SUCCESS);
+  shared_ptr<Caps> caps = Caps::new_instance();
+  caps->write_array(lv.data(), lv.size());
+  caps->write_array(iv.data(), iv.size());
+  ASSERT_EQ(writer.append(*caps, 1), CAPS_SUCCESS);
+  writer.close();
+
+  // 记录为本机字节序, 回放时数组直接引用映射的文件内存
+  CapsArchiveReader reader;
+  shared_ptr<Caps> r;
+  const int64_t* lp;
+  const int32_t* ip;
+  uint32_t count;
+  ASSERT_EQ(reader.open(path.c_str()), CAPS_SUCCESS);
+  ASSERT_EQ(reader.next(r), CAPS_SUCCESS);
+  ASSERT_EQ(r->read_array(lp, count), CAPS_SUCCESS);
+  EXPECT_EQ(vector<int64_t>(lp, lp + count), lv);
+  ASSERT_EQ(r->read_array(ip, count), CAPS_SUCCESS);
+  EXPECT_EQ(vector<int32_t>(ip, ip + count), iv);
+}
@@ -0,0 +1,329 @@
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps.h"
+#include "caps-view.h"
+
+using namespace std;
+
+static void gen_arrays(vector<int32_t>& iv, vector<float>& fv,
+    vector<int64_t>& lv, vector<double>& dv) {
+  int32_t i;
+  for (i = 0; i < 37; ++i) {
+    iv.push_back(0x01020304 + i);
+    fv.push_back(0.5f + i);
+    lv.push_back(0x0102030405060708LL + i);
+    dv.push_back(-1.25 + i);
+  }
+}
+
+static shared_ptr<Caps> gen_caps() {
+  vector<int32_t> iv;
+  vector<float> fv;
+  vector<int64_t> lv;
+  vector<double> dv;
+  gen_arrays(iv, fv, lv, dv);
+  shared_ptr<Caps> caps = Caps::new_instance();
+  shared_ptr<Caps> sub = Caps::new_instance();
+  // 奇数长度成员, 使后续数据不在8字节边界
+  caps->write(1);
+  caps->write("abc", 3);
+  caps->write_array(iv);
+  caps->write_array(lv.data(), lv.size());
+  caps->write("str");
+  sub->write(2);
+  sub->write_array(dv);
+  sub->write_array(fv);
+  sub->write_array((const int64_t*)nullptr, 0);
+  caps->write(sub);
+  caps->write_array(fv);
+  return caps;
+}
+
+static void check_caps(shared_ptr<Caps>& caps) {
+  vector<int32_t> iv;
+  vector<float> fv;
+  vector<int64_t> lv;
+  vector<double> dv;
+  gen_arrays(iv, fv, lv, dv);
+  int32_t v;
+  const void* bv;
+  uint32_t bl;
+  string sv;
+  const int32_t* ia;
+  const int64_t* la;
+  const float* fa;
+  const double* da;
+  uint32_t count;
+  shared_ptr<Caps> sub;
+
+  ASSERT_EQ(caps->read(v), CAPS_SUCCESS);
+  ASSERT_EQ(caps->read(bv, bl), CAPS_SUCCESS);
+  EXPECT_EQ(bl, 3u);
+  ASSERT_EQ(caps->read_array(ia, count), CAPS_SUCCESS);
+  ASSERT_EQ(count, iv.size());
+  EXPECT_EQ(memcmp(ia, iv.data(), count * sizeof(int32_t)), 0);
+  ASSERT_EQ(caps->read_array(la, count), CAPS_SUCCESS);
+  ASSERT_EQ(count, lv.size());
+  EXPECT_EQ((uintptr_t)la % sizeof(int64_t), 0u);
+  EXPECT_EQ(memcmp(la, lv.data(), count * sizeof(int64_t)), 0);
+  ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "str");
+  ASSERT_EQ(caps->read(sub), CAPS_SUCCESS);
+  ASSERT_EQ(sub->read(v), CAPS_SUCCESS);
+  EXPECT_EQ(v, 2);
+  ASSERT_EQ(sub->read_array(da, count), CAPS_SUCCESS);
+  ASSERT_EQ(count, dv.size());
+  EXPECT_EQ((uintptr_t)da % sizeof(double), 0u);
+  EXPECT_EQ(memcmp(da, dv.data(), count * sizeof(double)), 0);
+  ASSERT_EQ(sub->read_array(fa, count), CAPS_SUCCESS);
+  ASSERT_EQ(count, fv.size());
+  EXPECT_EQ(memcmp(fa, fv.data(), count * sizeof(float)), 0);
+  ASSERT_EQ(sub->read_array(la, count), CAPS_SUCCESS);
+  EXPECT_EQ(count, 0u);
+  EXPECT_EQ(sub->read_array(la, count), CAPS_ERR_EOO);
+  ASSERT_EQ(caps->read_array(fa, count), CAPS_SUCCESS);
+  ASSERT_EQ(count, fv.size());
+  EXPECT_EQ(memcmp(fa, fv.data(), count * sizeof(float)), 0);
+}
+
+TEST(CapsArray, readWrite) {
+  shared_ptr<Caps> caps = gen_caps();
+  uint32_t size = caps->binary_size();
+  // 64位对齐的buffer
+  vector<int64_t> buf(size / sizeof(int64_t) + 1);
+  uint32_t flags[] = { 0, CAPS_FLAG_NET_BYTEORDER };
+  shared_ptr<Caps> rcaps;
+  size_t i;
+
+  for (i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+    ASSERT_EQ(caps->serialize(buf.data(), size, flags[i]), (int32_t)size);
+    ASSERT_EQ(Caps::parse(buf.data(), size, rcaps), CAPS_SUCCESS);
+    check_caps(rcaps);
+
+    // 与serialize_iov结果一致
+    vector<struct iovec> iov;
+    string iovbuf;
+    string data;
+    size_t j;
+    ASSERT_EQ(caps->serialize_iov(iov, iovbuf, flags[i], 16), (int32_t)size);
+    for (j = 0; j < iov.size(); ++j)
+      data.append((const char*)iov[j].iov_base, iov[j].iov_len);
+    ASSERT_EQ(data.size(), size);
+    ASSERT_EQ(Caps::parse(data.data(), size, rcaps), CAPS_SUCCESS);
+    check_caps(rcaps);
+  }
+}
+
+TEST(CapsArray, foreignByteOrder) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  vector<int64_t> lv = { 1, -2, 0x0102030405060708LL };
+  caps->write_array(lv);
+  uint32_t size = caps->binary_size();
+  vector<int64_t> buf(size / sizeof(int64_t) + 1);
+  ASSERT_EQ(caps->serialize(buf.data(), size), (int32_t)size);
+
+  // 不拷贝parse, 网络字节序数据不能直接引用, 可拷贝读取
+  shared_ptr<Caps> rcaps;
+  const int64_t* la;
+  uint32_t count;
+  vector<int64_t> rlv;
+  ASSERT_EQ(Caps::parse(buf.data(), size, rcaps, false), CAPS_SUCCESS);
+  if (*(const uint8_t*)&lv[0] == 1) {
+    EXPECT_EQ(rcaps->read_array(la, count), CAPS_ERR_BYTEORDER);
+  }
+  ASSERT_EQ(rcaps->read_array(rlv), CAPS_SUCCESS);
+  EXPECT_EQ(rlv, lv);
+  EXPECT_EQ(rcaps->read_array(rlv), CAPS_ERR_EOO);
+}
+
+TEST(CapsArray, cApi) {
+  caps_t caps = caps_create();
+  caps_t sub = caps_create();
+  float fv[] = { 1.0f, 2.0f, 3.0f };
+  double dv[] = { 0.5, -0.5 };
+  ASSERT_EQ(caps_write_integer(sub, 7), CAPS_SUCCESS);
+  ASSERT_EQ(caps_write_double_array(sub, dv, 2), CAPS_SUCCESS);
+  ASSERT_EQ(caps_write_float_array(caps, fv, 3), CAPS_SUCCESS);
+  ASSERT_EQ(caps_write_object(caps, sub), CAPS_SUCCESS);
+  int32_t size = caps_serialize(caps, nullptr, 0);
+  vector<int64_t> buf(size / sizeof(int64_t) + 1);
+  ASSERT_EQ(caps_serialize(caps, buf.data(), size), size);
+  caps_destroy(caps);
+  caps_destroy(sub);
+
+  caps_t rcaps;
+  caps_t rsub;
+  const float* fa;
+  const double* da;
+  uint32_t count;
+  int32_t iv;
+  ASSERT_EQ(caps_parse(buf.data(), size, &rcaps), CAPS_SUCCESS);
+  ASSERT_EQ(caps_read_float_array(rcaps, &fa, &count), CAPS_SUCCESS);
+  ASSERT_EQ(count, 3u);
+  EXPECT_EQ(memcmp(fa, fv, sizeof(fv)), 0);
+  ASSERT_EQ(caps_read_object(rcaps, &rsub), CAPS_SUCCESS);
+  ASSERT_EQ(caps_read_integer(rsub, &iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 7);
+  ASSERT_EQ(caps_read_double_array(rsub, &da, &count), CAPS_SUCCESS);
+  ASSERT_EQ(count, 2u);
+  EXPECT_EQ((uintptr_t)da % sizeof(double), 0u);
+  EXPECT_EQ(memcmp(da, dv, sizeof(dv)), 0);
+  caps_destroy(rsub);
+  caps_destroy(rcaps);
+}
+
+TEST(CapsArray, randomAccess) {
+  shared_ptr<Caps> caps = gen_caps();
+  uint32_t size = caps->binary_size();
+  vector<int64_t> buf(size / sizeof(int64_t) + 1);
+  ASSERT_EQ(caps->serialize(buf.data(), size), (int32_t)size);
+  shared_ptr<Caps> rcaps;
+  ASSERT_EQ(Caps::parse(buf.data(), size, rcaps), CAPS_SUCCESS);
+  vector<float> fv;
+  string sv;
+  ASSERT_EQ(rcaps->seek(6), CAPS_SUCCESS);
+  ASSERT_EQ(rcaps->read_array(fv), CAPS_SUCCESS);
+  EXPECT_EQ(fv.size(), 37u);
+  ASSERT_EQ(rcaps->read_at(4, sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "str");
+}
+
+// v4数据: integer 1, binary "ab", string "s"
+TEST(CapsArray, readVersion4) {
+  uint8_t data[28] = { 0x1e, 'A', 'P', 4 };
+  uint32_t v;
+  v = sizeof(data);
+  memcpy(data + 4, &v, 4);
+  v = 1;
+  memcpy(data + 8, &v, 4);
+  v = 2;
+  memcpy(data + 12, &v, 4);
+  memcpy(data + 16, "ab", 2);
+  memcpy(data + 20, "s", 2);
+  data[24] = 'S';
+  data[25] = 'B';
+  data[26] = 'i';
+  data[27] = 3;
+
+  shared_ptr<Caps> caps;
+  int32_t iv;
+  vector<uint8_t> bv;
+  string sv;
+  ASSERT_EQ(Caps::parse(data, sizeof(data), caps), CAPS_SUCCESS);
+  ASSERT_EQ(caps->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  ASSERT_EQ(caps->read(bv), CAPS_SUCCESS);
+  EXPECT_EQ(bv.size(), 2u);
+  ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "s");
+}
+
+// 空数组, 及长度不是元素大小整数倍的损坏数据
+TEST(CapsArray, emptyAndCorrupted) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  vector<int32_t> iv;
+  vector<double> dv;
+  caps->write_array(iv);
+  caps->write_array(dv);
+  vector<uint8_t> bv;
+  caps->write(bv);
+  string buf(caps->binary_size(), '\0');
+  uint32_t flags[] = { 0, CAPS_FLAG_NET_BYTEORDER };
+  size_t i;
+
+  for (i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+    vector<struct iovec> iov;
+    string iovbuf;
+    ASSERT_EQ(caps->serialize_iov(iov, iovbuf, flags[i]), (int32_t)buf.size());
+    ASSERT_EQ(caps->serialize(&buf[0], buf.size(), flags[i]),
+        (int32_t)buf.size());
+    shared_ptr<Caps> rcaps;
+    ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps, false), CAPS_SUCCESS);
+    iv.push_back(1);
+    dv.push_back(1.0);
+    bv.push_back(1);
+    ASSERT_EQ(rcaps->read_array(iv), CAPS_SUCCESS);
+    EXPECT_TRUE(iv.empty());
+    ASSERT_EQ(rcaps->read_array(dv), CAPS_SUCCESS);
+    EXPECT_TRUE(dv.empty());
+    ASSERT_EQ(rcaps->read(bv), CAPS_SUCCESS);
+    EXPECT_TRUE(bv.empty());
+  }
+
+  caps = Caps::new_instance();
+  iv = { 1, 2 };
+  caps->write_array(iv);
+  buf.assign(caps->binary_size(), '\0');
+  ASSERT_EQ(caps->serialize(&buf[0], buf.size(), 0), (int32_t)buf.size());
+  // header之后为bin sizes
+  uint32_t len = 7;
+  memcpy(&buf[8], &len, sizeof(len));
+  EXPECT_EQ(Caps::validate(buf.data(), buf.size()), CAPS_ERR_CORRUPTED);
+  shared_ptr<Caps> rcaps;
+  const int32_t* ia;
+  uint32_t count;
+  ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps), CAPS_SUCCESS);
+  EXPECT_EQ(rcaps->read_array(iv), CAPS_ERR_CORRUPTED);
+  EXPECT_EQ(rcaps->read_array(ia, count), CAPS_ERR_CORRUPTED);
+  // 损坏的成员未被读取
+  EXPECT_EQ(rcaps->next_type(), (int32_t)'I');
+  shared_ptr<rokid::CapsView> view;
+  ASSERT_EQ(rokid::CapsView::parse(buf.data(), buf.size(), view),
+      CAPS_SUCCESS);
+  rokid::CapsCursor cur = view->cursor();
+  EXPECT_EQ(cur.read_array(iv), CAPS_ERR_CORRUPTED);
+  EXPECT_EQ(cur.read_array(ia, count), CAPS_ERR_CORRUPTED);
+}
+
+struct SumVisitor : public rokid::CapsVisitor {
+  using rokid::CapsVisitor::on_array;
+  int32_t on_array(const int64_t* v, uint32_t count) {
+    uint32_t i;
+    for (i = 0; i < count; ++i)
+      sum += v[i];
+    return CAPS_SUCCESS;
+  }
+  int64_t sum = 0;
+};
+
+TEST(CapsArray, unaligned) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  vector<int64_t> lv = { 1, 2, 3 };
+  caps->write_array(lv);
+  uint32_t size = caps->binary_size();
+  // 8字节对齐的缓冲区偏移4字节, 数组只按4字节对齐
+  vector<int64_t> storage(size / sizeof(int64_t) + 2);
+  char* buf = reinterpret_cast<char*>(storage.data()) + 4;
+  ASSERT_EQ(caps->serialize(buf, size, 0), (int32_t)size);
+
+  shared_ptr<Caps> rcaps;
+  const int64_t* lp;
+  uint32_t count;
+  ASSERT_EQ(Caps::parse(buf, size, rcaps, false), CAPS_SUCCESS);
+  EXPECT_EQ(rcaps->read_array(lp, count), CAPS_ERR_INVAL);
+  // 读取位置不变, 可拷贝读取
+  vector<int64_t> rlv;
+  ASSERT_EQ(rcaps->read_array(rlv), CAPS_SUCCESS);
+  EXPECT_EQ(rlv, lv);
+
+  // visit时拷贝到对齐的缓冲区
+  rokid::CapsReader reader;
+  SumVisitor v;
+  ASSERT_EQ(reader.parse(buf, size, false), CAPS_SUCCESS);
+  ASSERT_EQ(reader.visit(v), CAPS_SUCCESS);
+  EXPECT_EQ(v.sum, 6);
+
+  ASSERT_EQ(reader.parse(buf, size, false), CAPS_SUCCESS);
+  EXPECT_EQ(caps_read_fmt(reinterpret_cast<caps_t>(&reader), "L",
+        &lp, &count), CAPS_ERR_INVAL);
+
+  shared_ptr<rokid::CapsView> view;
+  ASSERT_EQ(rokid::CapsView::parse(buf, size, view, false), CAPS_SUCCESS);
+  rokid::CapsCursor cur = view->cursor();
+  EXPECT_EQ(cur.read_array(lp, count), CAPS_ERR_INVAL);
+
+  // 拷贝parse的数据已对齐
+  ASSERT_EQ(Caps::parse(buf, size, rcaps), CAPS_SUCCESS);
+  ASSERT_EQ(rcaps->read_array(lp, count), CAPS_SUCCESS);
+  EXPECT_EQ(vector<int64_t>(lp, lp + count), lv);
+}
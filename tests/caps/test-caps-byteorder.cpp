@@ -0,0 +1,95 @@
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps.h"
+
+using namespace std;
+
+static shared_ptr<Caps> gen_caps() {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  shared_ptr<Caps> sub = Caps::new_instance();
+  int32_t i;
+  caps->write("odd");
+  for (i = 0; i < 11; ++i) {
+    caps->write((int32_t)(0x01020304 + i));
+    caps->write((int64_t)(0x0102030405060708LL + i));
+    caps->write(1.5f + i);
+    caps->write(2.5 + i);
+  }
+  sub->write((int64_t)-2);
+  sub->write(-1);
+  sub->write("sub");
+  caps->write(sub);
+  caps->write(sub);
+  caps->write("xyz", 3);
+  return caps;
+}
+
+static void check_caps(shared_ptr<Caps>& caps) {
+  int32_t i;
+  int32_t iv;
+  int64_t lv;
+  float fv;
+  double dv;
+  string sv;
+  vector<uint8_t> bv;
+  shared_ptr<Caps> sub;
+  ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+  for (i = 0; i < 11; ++i) {
+    ASSERT_EQ(caps->read(iv), CAPS_SUCCESS);
+    EXPECT_EQ(iv, 0x01020304 + i);
+    ASSERT_EQ(caps->read(lv), CAPS_SUCCESS);
+    EXPECT_EQ(lv, 0x0102030405060708LL + i);
+    ASSERT_EQ(caps->read(fv), CAPS_SUCCESS);
+    EXPECT_EQ(fv, 1.5f + i);
+    ASSERT_EQ(caps->read(dv), CAPS_SUCCESS);
+    EXPECT_EQ(dv, 2.5 + i);
+  }
+  for (i = 0; i < 2; ++i) {
+    ASSERT_EQ(caps->read(sub), CAPS_SUCCESS);
+    ASSERT_EQ(sub->read(lv), CAPS_SUCCESS);
+    EXPECT_EQ(lv, -2);
+    ASSERT_EQ(sub->read(iv), CAPS_SUCCESS);
+    EXPECT_EQ(iv, -1);
+    ASSERT_EQ(sub->read(sv), CAPS_SUCCESS);
+    EXPECT_EQ(sv, "sub");
+  }
+  ASSERT_EQ(caps->read(bv), CAPS_SUCCESS);
+  EXPECT_EQ(bv.size(), 3u);
+}
+
+TEST(Caps, byteOrder) {
+  shared_ptr<Caps> wcaps = gen_caps();
+  uint32_t flags[] = { CAPS_FLAG_NET_BYTEORDER, 0 };
+  size_t i;
+  for (i = 0; i < 2; ++i) {
+    vector<int8_t> buf(wcaps->binary_size());
+    ASSERT_EQ(wcaps->serialize(buf.data(), buf.size(), flags[i]),
+        (int32_t)buf.size());
+    EXPECT_EQ(buf[0] & CAPS_FLAG_NET_BYTEORDER, (int32_t)flags[i]);
+    uint32_t length;
+    ASSERT_EQ(caps_binary_info(buf.data(), nullptr, &length), CAPS_SUCCESS);
+    EXPECT_EQ(length, buf.size());
+
+    shared_ptr<Caps> rcaps;
+    // 不拷贝数据, 逐个成员转换字节序
+    ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps, false), CAPS_SUCCESS);
+    check_caps(rcaps);
+    // 拷贝数据, parse时批量转换字节序, 原始数据不变
+    vector<int8_t> orig = buf;
+    ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps), CAPS_SUCCESS);
+    EXPECT_EQ(buf, orig);
+    check_caps(rcaps);
+
+    // 转换后的数据作为子对象再次序列化
+    shared_ptr<Caps> outer = Caps::new_instance();
+    ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps), CAPS_SUCCESS);
+    outer->write(rcaps);
+    vector<int8_t> obuf(outer->binary_size());
+    outer->serialize(obuf.data(), obuf.size());
+    shared_ptr<Caps> router;
+    shared_ptr<Caps> inner;
+    ASSERT_EQ(Caps::parse(obuf.data(), obuf.size(), router, false), CAPS_SUCCESS);
+    ASSERT_EQ(router->read(inner), CAPS_SUCCESS);
+    check_caps(inner);
+  }
+}
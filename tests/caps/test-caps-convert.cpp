@@ -0,0 +1,210 @@
+#include <thread>
+#include "gtest/gtest.h"
+#include "caps-reader.h"
+#include "caps-writer.h"
+
+using namespace std;
+using namespace rokid;
+
+static string serialize(const Caps* caps) {
+  string r;
+  static_cast<const CapsWriter*>(caps)->serialize_append(r);
+  return r;
+}
+
+static string build(shared_ptr<Caps>& sub, const char* extra) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  caps->write(1);
+  caps->write(string("owned"));
+  caps->write("str");
+  caps->write(sub);
+  if (extra)
+    caps->write(extra);
+  return serialize(caps.get());
+}
+
+TEST(Caps, convertWriter) {
+  shared_ptr<Caps> sub = Caps::new_instance();
+  shared_ptr<Caps> caps = Caps::new_instance();
+  sub->write("sub");
+  caps->write(1);
+  caps->write(string("owned"));
+  caps->write("str");
+  caps->write(sub);
+
+  caps_t c = Caps::convert(caps);
+  Caps* conv = reinterpret_cast<Caps*>(c);
+  EXPECT_EQ(conv->size(), 4u);
+  EXPECT_EQ(serialize(conv), build(sub, nullptr));
+
+  // 修改原对象, 转换结果不变
+  caps->write("a");
+  EXPECT_EQ(caps->size(), 5u);
+  EXPECT_EQ(conv->size(), 4u);
+  EXPECT_EQ(serialize(caps.get()), build(sub, "a"));
+  EXPECT_EQ(serialize(conv), build(sub, nullptr));
+
+  // 修改转换结果, 原对象不变
+  conv->write("b");
+  EXPECT_EQ(serialize(conv), build(sub, "b"));
+  EXPECT_EQ(serialize(caps.get()), build(sub, "a"));
+
+  // 子对象仍共享, 修改后两者均更新
+  sub->write(2);
+  EXPECT_EQ(serialize(conv), build(sub, "b"));
+  EXPECT_EQ(serialize(caps.get()), build(sub, "a"));
+  caps_destroy(c);
+}
+
+TEST(Caps, convertWriterSubObject) {
+  shared_ptr<Caps> sub = Caps::new_instance();
+  shared_ptr<Caps> caps = Caps::new_instance();
+  sub->write("sub");
+  caps->write(1);
+  caps->write(sub);
+
+  caps_t c = Caps::convert(caps);
+  shared_ptr<Caps> conv = Caps::convert(c);
+  caps_destroy(c);
+  // 共享数据的writer作为子对象, 孙对象修改后父对象大小随之更新
+  shared_ptr<Caps> parent = Caps::new_instance();
+  parent->write(conv);
+  uint32_t size = parent->binary_size();
+  sub->write(string(100, 'a'));
+  EXPECT_GT(parent->binary_size(), size);
+
+  shared_ptr<Caps> expected = Caps::new_instance();
+  expected->write(caps);
+  EXPECT_EQ(serialize(parent.get()), serialize(expected.get()));
+
+  static_pointer_cast<CapsWriter>(conv)->reset();
+  EXPECT_EQ(conv->size(), 0u);
+  EXPECT_LT(parent->binary_size(), expected->binary_size());
+}
+
+TEST(Caps, convertWriterThreads) {
+  shared_ptr<Caps> sub = Caps::new_instance();
+  sub->write("sub");
+
+  for (int32_t n = 0; n < 50; ++n) {
+    shared_ptr<Caps> caps = Caps::new_instance();
+    caps->write(1);
+    caps->write(string("owned"));
+    caps->write(sub);
+    caps_t c = Caps::convert(caps);
+    shared_ptr<Caps> conv = Caps::convert(c);
+    caps_destroy(c);
+    // 两者共享同一快照及子对象, 在不同线程中同时写入时各自拷贝
+    thread t1([&caps]() {
+      for (int32_t i = 0; i < 20; ++i)
+        caps->write(i);
+    });
+    thread t2([&conv]() {
+      for (int32_t i = 0; i < 20; ++i)
+        conv->write("b");
+    });
+    t1.join();
+    t2.join();
+    EXPECT_EQ(caps->size(), 23u);
+    EXPECT_EQ(conv->size(), 23u);
+    conv.reset();
+    caps.reset();
+  }
+  // 子对象已与所有父对象解除关系
+  sub->write(2);
+  EXPECT_EQ(sub->size(), 2u);
+}
+
+TEST(Caps, convertReader) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  string buf;
+  shared_ptr<Caps> rd;
+  int32_t iv;
+  string sv;
+
+  caps->write(1);
+  caps->write("str");
+  buf = serialize(caps.get());
+  ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rd), CAPS_SUCCESS);
+  ASSERT_EQ(rd->read(iv), CAPS_SUCCESS);
+
+  // 共享数据, 读取位置为第一个成员
+  caps_t c = Caps::convert(rd);
+  CapsReader* conv = reinterpret_cast<CapsReader*>(c);
+  EXPECT_EQ(conv->binary_data(),
+      static_pointer_cast<CapsReader>(rd)->binary_data());
+  rd.reset();
+  ASSERT_EQ(conv->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  ASSERT_EQ(conv->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "str");
+
+  // 引用调用者内存时拷贝
+  CapsReader ref;
+  ASSERT_EQ(ref.parse(buf.data(), buf.size(), false), CAPS_SUCCESS);
+  shared_ptr<Caps> copied = Caps::convert(reinterpret_cast<caps_t>(&ref));
+  EXPECT_NE(static_pointer_cast<CapsReader>(copied)->binary_data(),
+      (const void*)buf.data());
+  ASSERT_EQ(copied->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  caps_destroy(c);
+}
+
+TEST(Caps, toReader) {
+  CapsWriter writer;
+  shared_ptr<Caps> sub = Caps::new_instance();
+  vector<int64_t> lv = { 1, 2, 3 };
+  shared_ptr<Caps> r;
+  int32_t iv;
+  string sv;
+  vector<int64_t> rlv;
+  const int64_t* lp;
+  uint32_t count;
+
+  sub->write("sub");
+  writer.write(1);
+  writer.write(string("a\0b", 3));
+  writer.write_array(lv);
+  writer.write(sub);
+  ASSERT_EQ(writer.to_reader(r), CAPS_SUCCESS);
+  EXPECT_EQ(r->binary_size(), writer.binary_size());
+  ASSERT_EQ(r->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  ASSERT_EQ(r->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, string("a\0b", 3));
+  // 本机字节序, 数组可直接引用
+  ASSERT_EQ(r->read_array(lp, count), CAPS_SUCCESS);
+  EXPECT_EQ(vector<int64_t>(lp, lp + count), lv);
+  shared_ptr<Caps> rsub;
+  ASSERT_EQ(r->read(rsub), CAPS_SUCCESS);
+  ASSERT_EQ(rsub->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "sub");
+
+  // writer引用reader上次parse的数据
+  CapsReader reader;
+  const char* s;
+  ASSERT_EQ(reader.parse(writer), CAPS_SUCCESS);
+  reader.read(iv);
+  ASSERT_EQ(reader.read(s), CAPS_SUCCESS);
+  CapsWriter w2;
+  w2.write_ref(s);
+  w2.write(string(100, 'x'));
+  ASSERT_EQ(reader.parse(w2), CAPS_SUCCESS);
+  ASSERT_EQ(reader.read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "a");
+  ASSERT_EQ(reader.read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, string(100, 'x'));
+
+  // c api
+  caps_t c;
+  caps_t rc;
+  const char* cs;
+  c = caps_create();
+  caps_write_string(c, "c");
+  ASSERT_EQ(caps_to_reader(c, &rc), CAPS_SUCCESS);
+  ASSERT_EQ(caps_read_string(rc, &cs), CAPS_SUCCESS);
+  EXPECT_STREQ(cs, "c");
+  EXPECT_EQ(caps_to_reader(rc, &c), CAPS_ERR_RDONLY);
+  caps_destroy(rc);
+  caps_destroy(c);
+}
@@ -0,0 +1,131 @@
+#include "gtest/gtest.h"
+#include "caps-reader.h"
+#include "caps-schema.h"
+#include "caps-view.h"
+#include "caps-writer.h"
+
+using namespace std;
+using namespace rokid;
+
+static const char* keys[] = { "temperature", "humidity", "", "state" };
+
+static void gen_caps(CapsWriter& w) {
+  shared_ptr<Caps> sub = Caps::new_instance();
+  uint32_t i;
+  sub->write("temperature");
+  sub->write("temperature");
+  for (i = 0; i < 40; ++i) {
+    w.write(keys[i % 4]);
+    w.write((int32_t)i);
+    if (i == 20) {
+      w.write(sub);
+      w.write(string("a\0b", 3));
+    }
+  }
+  w.write(string("a\0b", 3));
+}
+
+static void check_caps(Caps* caps) {
+  uint32_t i;
+  int32_t iv;
+  string sv;
+  shared_ptr<Caps> sub;
+  for (i = 0; i < 40; ++i) {
+    ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+    EXPECT_EQ(sv, keys[i % 4]);
+    ASSERT_EQ(caps->read(iv), CAPS_SUCCESS);
+    EXPECT_EQ(iv, (int32_t)i);
+    if (i == 20) {
+      ASSERT_EQ(caps->read(sub), CAPS_SUCCESS);
+      ASSERT_EQ(sub->read(sv), CAPS_SUCCESS);
+      EXPECT_EQ(sv, "temperature");
+      ASSERT_EQ(sub->read(sv), CAPS_SUCCESS);
+      EXPECT_EQ(sv, "temperature");
+      ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+      EXPECT_EQ(sv, string("a\0b", 3));
+    }
+  }
+  ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, string("a\0b", 3));
+  EXPECT_EQ(caps->next_type(), CAPS_ERR_EOO);
+}
+
+TEST(Caps, dedupStrings) {
+  CapsWriter w;
+  uint32_t flags[] = { CAPS_FLAG_NET_BYTEORDER, 0 };
+  size_t i;
+
+  gen_caps(w);
+  for (i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+    uint32_t f = flags[i] | CAPS_FLAG_DEDUP_STRINGS;
+    string buf;
+    int32_t size = w.serialize(nullptr, 0, f);
+    EXPECT_LT(size, (int32_t)w.binary_size());
+    ASSERT_EQ(w.serialize_append(buf, f), size);
+    ASSERT_EQ((int32_t)buf.size(), size);
+    EXPECT_EQ(Caps::validate(buf.data(), buf.size()), CAPS_SUCCESS);
+
+    // 拷贝(转换字节序)及不拷贝parse
+    shared_ptr<Caps> caps;
+    ASSERT_EQ(Caps::parse(buf.data(), buf.size(), caps), CAPS_SUCCESS);
+    check_caps(caps.get());
+    CapsReader reader;
+    ASSERT_EQ(reader.parse(buf.data(), buf.size(), false), CAPS_SUCCESS);
+    check_caps(&reader);
+
+    // 随机读取
+    string sv;
+    ASSERT_EQ(reader.seek(6), CAPS_SUCCESS);
+    ASSERT_EQ(reader.read(sv), CAPS_SUCCESS);
+    EXPECT_EQ(sv, "state");
+    shared_ptr<CapsView> view;
+    ASSERT_EQ(CapsView::parse(buf.data(), buf.size(), view), CAPS_SUCCESS);
+    CapsCursor cur;
+    ASSERT_EQ(view->cursor(2, cur), CAPS_SUCCESS);
+    ASSERT_EQ(cur.read(sv), CAPS_SUCCESS);
+    EXPECT_EQ(sv, "humidity");
+
+    // serialize_iov整体序列化
+    vector<struct iovec> iov;
+    string iovbuf;
+    ASSERT_EQ(w.serialize_iov(iov, iovbuf, f), size);
+    ASSERT_EQ(iov.size(), 1u);
+    EXPECT_EQ(iovbuf, buf);
+  }
+}
+
+TEST(Caps, dedupCorrupted) {
+  CapsWriter w;
+  string buf;
+  w.write("abc");
+  w.write("abc");
+  w.serialize_append(buf, CAPS_FLAG_DEDUP_STRINGS);
+  // header 8, string sizes 8, string offsets 8
+  uint32_t off = 100;
+  memcpy(&buf[20], &off, sizeof(off));
+  EXPECT_EQ(Caps::validate(buf.data(), buf.size()), CAPS_ERR_CORRUPTED);
+  // v8之前的版本不能标记字符串去重
+  buf[3] = 7;
+  EXPECT_EQ(Caps::validate(buf.data(), buf.size()), CAPS_ERR_CORRUPTED);
+}
+
+struct DedupPoint {
+  string name;
+  int32_t x;
+  string tag;
+};
+CAPS_SCHEMA(DedupPoint, name, x, tag)
+
+TEST(Caps, dedupSchema) {
+  CapsWriter w;
+  DedupPoint p;
+  string buf;
+  w.write("pt");
+  w.write(3);
+  w.write("pt");
+  w.serialize_append(buf, CAPS_FLAG_NET_BYTEORDER | CAPS_FLAG_DEDUP_STRINGS);
+  ASSERT_EQ(caps_schema::parse(buf.data(), buf.size(), p), CAPS_SUCCESS);
+  EXPECT_EQ(p.name, "pt");
+  EXPECT_EQ(p.x, 3);
+  EXPECT_EQ(p.tag, "pt");
+}
@@ -0,0 +1,145 @@
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps-writer.h"
+#include "caps-reader.h"
+
+using namespace std;
+using namespace rokid;
+
+TEST(CapsFmt, cApi) {
+  caps_t wcaps = caps_create();
+  caps_t wsub = caps_create();
+  uint8_t bin[] = { 1, 2, 3 };
+  int32_t iarr[] = { 4, 5 };
+  double darr[] = { 0.5, 1.5, 2.5 };
+  ASSERT_EQ(caps_write_integer(wsub, 7), CAPS_SUCCESS);
+  ASSERT_EQ(caps_write_fmt(wcaps, "ifldSBOVID", -1, 1.5f, (int64_t)1 << 40,
+        2.5, "str", bin, (uint32_t)sizeof(bin), wsub, iarr, (uint32_t)2,
+        darr, (uint32_t)3), CAPS_SUCCESS);
+  EXPECT_EQ(caps_write_fmt(wcaps, "ix", 1, 2), CAPS_ERR_INVAL);
+  caps_destroy(wsub);
+
+  uint32_t size = caps_serialize(wcaps, nullptr, 0);
+  vector<int64_t> buf(size / sizeof(int64_t));
+  ASSERT_EQ(caps_serialize(wcaps, buf.data(), size), (int32_t)size);
+  caps_destroy(wcaps);
+
+  caps_t rcaps;
+  int32_t iv;
+  float fv;
+  int64_t lv;
+  double dv;
+  const char* sv;
+  const void* bv;
+  uint32_t bl;
+  caps_t rsub;
+  const int32_t* iav;
+  uint32_t ial;
+  const double* dav;
+  uint32_t dal;
+  ASSERT_EQ(caps_parse(buf.data(), size, &rcaps), CAPS_SUCCESS);
+  // 类型不匹配时不读取任何成员
+  EXPECT_EQ(caps_read_fmt(rcaps, "ifll", &iv, &fv, &lv, &lv),
+      CAPS_ERR_INCORRECT_TYPE);
+  EXPECT_EQ(caps_read_fmt(rcaps, "ifldSBOVIDi", &iv, &fv, &lv, &dv, &sv,
+        &bv, &bl, &rsub, &iav, &ial, &dav, &dal, &iv), CAPS_ERR_EOO);
+  ASSERT_EQ(caps_read_fmt(rcaps, "ifldSBOVID", &iv, &fv, &lv, &dv, &sv,
+        &bv, &bl, &rsub, &iav, &ial, &dav, &dal), CAPS_SUCCESS);
+  EXPECT_EQ(iv, -1);
+  EXPECT_EQ(fv, 1.5f);
+  EXPECT_EQ(lv, (int64_t)1 << 40);
+  EXPECT_EQ(dv, 2.5);
+  EXPECT_STREQ(sv, "str");
+  ASSERT_EQ(bl, sizeof(bin));
+  EXPECT_EQ(memcmp(bv, bin, bl), 0);
+  ASSERT_EQ(ial, 2u);
+  EXPECT_EQ(iav[1], 5);
+  ASSERT_EQ(dal, 3u);
+  EXPECT_EQ(dav[2], 2.5);
+  ASSERT_EQ(caps_read_fmt(rsub, "i", &iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 7);
+  EXPECT_EQ(caps_read_fmt(rcaps, "i", &iv), CAPS_ERR_EOO);
+  caps_destroy(rsub);
+  caps_destroy(rcaps);
+}
+
+// 失败时不写入/读取任何成员
+TEST(CapsFmt, allOrNothing) {
+  caps_t wcaps = caps_create();
+  EXPECT_EQ(caps_write_fmt(wcaps, "iSi", 1, (const char*)nullptr, 2),
+      CAPS_ERR_INVAL);
+  EXPECT_EQ(caps_write_fmt(wcaps, "iB", 1, (const void*)nullptr, (uint32_t)3),
+      CAPS_ERR_INVAL);
+  EXPECT_EQ(caps_write_fmt(wcaps, "iL", 1, (const void*)nullptr, (uint32_t)3),
+      CAPS_ERR_INVAL);
+  EXPECT_EQ(reinterpret_cast<Caps*>(wcaps)->size(), 0u);
+
+  // 第一个子对象正确, 第二个子对象数据不正确
+  caps_t wsub = caps_create();
+  caps_write_integer(wsub, 7);
+  ASSERT_EQ(caps_write_fmt(wcaps, "iO", 1, wsub), CAPS_SUCCESS);
+  caps_destroy(wsub);
+  vector<uint8_t> bad(16, 0);
+  memcpy(bad.data(), "\x1e" "AP\x08", 4);
+  ASSERT_EQ(caps_write_fmt(wcaps, "B", bad.data(), (uint32_t)bad.size()),
+      CAPS_SUCCESS);
+  uint32_t size = caps_serialize(wcaps, nullptr, 0);
+  vector<int64_t> buf(size / sizeof(int64_t));
+  ASSERT_EQ(caps_serialize(wcaps, buf.data(), size), (int32_t)size);
+  caps_destroy(wcaps);
+
+  caps_t rcaps;
+  caps_t sub1 = 0;
+  caps_t sub2 = 0;
+  int32_t iv = 0;
+  ASSERT_EQ(caps_parse(buf.data(), size, &rcaps), CAPS_SUCCESS);
+  EXPECT_EQ(caps_read_fmt(rcaps, "iOO", &iv, &sub1, &sub2),
+      CAPS_ERR_CORRUPTED);
+  EXPECT_EQ(iv, 0);
+  EXPECT_EQ(sub1, 0);
+  EXPECT_EQ(sub2, 0);
+  ASSERT_EQ(caps_read_fmt(rcaps, "iO", &iv, &sub1), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  ASSERT_EQ(caps_read_fmt(sub1, "i", &iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 7);
+  caps_destroy(sub1);
+  caps_destroy(rcaps);
+}
+
+TEST(CapsFmt, variadic) {
+  CapsWriter writer;
+  shared_ptr<Caps> sub = Caps::new_instance();
+  vector<uint8_t> bin = { 1, 2, 3 };
+  vector<float> farr = { 0.5f, 1.5f };
+  sub->write("sub");
+  ASSERT_EQ(writer.write_fields(1, 2.0f, (int64_t)3, 4.0, "five",
+        string("six"), bin, farr, sub), CAPS_SUCCESS);
+  vector<int8_t> buf(writer.binary_size());
+  writer.serialize(buf.data(), buf.size());
+
+  CapsReader reader;
+  int32_t iv;
+  float fv;
+  int64_t lv;
+  double dv;
+  const char* sv;
+  string str;
+  vector<uint8_t> bv;
+  vector<float> fav;
+  shared_ptr<Caps> rsub;
+  ASSERT_EQ(reader.parse(buf.data(), buf.size(), false), CAPS_SUCCESS);
+  EXPECT_EQ(reader.read_fields(iv, lv), CAPS_ERR_INCORRECT_TYPE);
+  ASSERT_EQ(reader.read_fields(iv, fv, lv, dv, sv, str, bv, fav, rsub),
+      CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  EXPECT_EQ(fv, 2.0f);
+  EXPECT_EQ(lv, 3);
+  EXPECT_EQ(dv, 4.0);
+  EXPECT_STREQ(sv, "five");
+  EXPECT_EQ(str, "six");
+  EXPECT_EQ(bv, bin);
+  EXPECT_EQ(fav, farr);
+  ASSERT_EQ(rsub->read(sv), CAPS_SUCCESS);
+  EXPECT_STREQ(sv, "sub");
+  EXPECT_EQ(reader.read_fields(iv), CAPS_ERR_EOO);
+}
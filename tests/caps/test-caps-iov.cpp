@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps.h"
+#include "caps-writer.h"
+
+using namespace std;
+
+static shared_ptr<Caps> gen_caps(const vector<uint8_t>& big) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  shared_ptr<Caps> sub = Caps::new_instance();
+  caps->write((int32_t)1);
+  caps->write("short");
+  caps->write(big);
+  caps->write_ref(big.data(), 3);
+  sub->write((int64_t)2);
+  sub->write(0.5f);
+  sub->write_ref(big.data(), big.size());
+  sub->write(string(1000, 'x'));
+  caps->write(sub);
+  caps->write();
+  caps->write(2.0);
+
+  // reader子对象
+  shared_ptr<Caps> rsub;
+  vector<int8_t> buf(sub->serialize(nullptr, 0));
+  sub->serialize(buf.data(), buf.size());
+  Caps::parse(buf.data(), buf.size(), rsub);
+  caps->write(rsub);
+  shared_ptr<Caps> nsub;
+  caps->write(nsub);
+  return caps;
+}
+
+static string flatten(const vector<struct iovec>& iov) {
+  string r;
+  size_t i;
+  for (i = 0; i < iov.size(); ++i)
+    r.append(reinterpret_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+  return r;
+}
+
+TEST(Caps, serializeIov) {
+  vector<uint8_t> big(4099);
+  size_t i;
+  for (i = 0; i < big.size(); ++i)
+    big[i] = i;
+  shared_ptr<Caps> caps = gen_caps(big);
+
+  uint32_t flags[] = { CAPS_FLAG_NET_BYTEORDER, 0 };
+  uint32_t thresholds[] = { 0, 1, 4, CAPS_IOV_REF_THRESHOLD, 0xffffffff };
+  size_t f, t;
+  for (f = 0; f < 2; ++f) {
+    string expected(caps->serialize(nullptr, 0), '\0');
+    ASSERT_EQ(caps->serialize(&expected[0], expected.length(), flags[f]),
+        (int32_t)expected.length());
+    for (t = 0; t < sizeof(thresholds) / sizeof(uint32_t); ++t) {
+      vector<struct iovec> iov;
+      string buf;
+      int32_t r = caps->serialize_iov(iov, buf, flags[f], thresholds[t]);
+      ASSERT_EQ(r, (int32_t)expected.length());
+      EXPECT_EQ(flatten(iov), expected);
+      if (thresholds[t] == 0xffffffff) {
+        EXPECT_EQ(iov.size(), 1u);
+        EXPECT_EQ(buf.length(), expected.length());
+      }
+      if (thresholds[t] == CAPS_IOV_REF_THRESHOLD) {
+        EXPECT_LT(buf.length(), 512u);
+      }
+    }
+  }
+}
+
+TEST(Caps, serializeIovReader) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  caps->write(1);
+  vector<int8_t> data(caps->serialize(nullptr, 0));
+  caps->serialize(data.data(), data.size());
+  shared_ptr<Caps> rcaps;
+  ASSERT_EQ(Caps::parse(data.data(), data.size(), rcaps), CAPS_SUCCESS);
+  vector<struct iovec> iov;
+  string buf;
+  EXPECT_EQ(rcaps->serialize_iov(iov, buf), CAPS_ERR_RDONLY);
+}
+
+TEST(Caps, serializeAppend) {
+  vector<uint8_t> big(3000, 0x5a);
+  shared_ptr<Caps> caps = gen_caps(big);
+  string expected(caps->binary_size(), '\0');
+  ASSERT_EQ(caps->serialize(&expected[0], expected.size()),
+      (int32_t)expected.size());
+
+  // 连续追加, 每次追加的位置保持8字节对齐
+  string sbuf;
+  vector<uint8_t> vbuf;
+  ASSERT_EQ(caps->serialize_append(sbuf), (int32_t)expected.size());
+  ASSERT_EQ(caps->serialize_append(sbuf), (int32_t)expected.size());
+  EXPECT_EQ(sbuf, expected + expected);
+  ASSERT_EQ(caps->serialize_append(vbuf), (int32_t)expected.size());
+  EXPECT_EQ(memcmp(vbuf.data(), expected.data(), expected.size()), 0);
+  // 复用缓冲区
+  vbuf.clear();
+  const uint8_t* p = vbuf.data();
+  ASSERT_EQ(caps->serialize_append(vbuf), (int32_t)expected.size());
+  EXPECT_EQ(vbuf.data(), p);
+
+  shared_ptr<Caps> rcaps;
+  ASSERT_EQ(Caps::parse(sbuf.data() + expected.size(), expected.size(), rcaps),
+      CAPS_SUCCESS);
+  EXPECT_EQ(rcaps->serialize_append(sbuf), CAPS_ERR_RDONLY);
+}
+
+TEST(Caps, serializeReallocCApi) {
+  caps_t caps = caps_create();
+  void* buf = nullptr;
+  uint32_t bufsize = 0;
+  caps_write_string(caps, "the first string");
+  int32_t size = caps_serialize_realloc(caps, &buf, &bufsize);
+  ASSERT_GT(size, 0);
+  EXPECT_EQ(bufsize, (uint32_t)size);
+  void* first = buf;
+
+  // 数据变小时不重新分配
+  caps_t small = caps_create();
+  caps_write_integer(small, 1);
+  ASSERT_LT(caps_serialize_realloc(small, &buf, &bufsize), size);
+  EXPECT_EQ(buf, first);
+  EXPECT_EQ(bufsize, (uint32_t)size);
+
+  caps_write_string(caps, string(500, 'x').c_str());
+  size = caps_serialize_realloc(caps, &buf, &bufsize);
+  ASSERT_GT(size, 0);
+  EXPECT_GE(bufsize, (uint32_t)size);
+
+  caps_t rcaps;
+  const char* sv;
+  ASSERT_EQ(caps_parse(buf, size, &rcaps), CAPS_SUCCESS);
+  ASSERT_EQ(caps_read_string(rcaps, &sv), CAPS_SUCCESS);
+  EXPECT_STREQ(sv, "the first string");
+  caps_destroy(rcaps);
+  caps_destroy(small);
+  caps_destroy(caps);
+
+  // 字符串去重的长度与binary_size不同, 按实际长度分配
+  rokid::CapsWriter w;
+  w.write("dup");
+  w.write("dup");
+  uint32_t flags = CAPS_FLAG_NET_BYTEORDER | CAPS_FLAG_DEDUP_STRINGS;
+  free(buf);
+  buf = nullptr;
+  bufsize = 0;
+  size = w.serialize_realloc(&buf, &bufsize, flags);
+  ASSERT_EQ(size, w.serialize(nullptr, 0, flags));
+  EXPECT_EQ(bufsize, (uint32_t)size);
+  EXPECT_EQ(caps_validate(buf, size), CAPS_SUCCESS);
+  free(buf);
+}
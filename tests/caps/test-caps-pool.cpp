@@ -0,0 +1,113 @@
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps-writer.h"
+#include "caps-reader.h"
+
+using namespace std;
+using namespace rokid;
+
+static vector<int8_t> gen_data(uint32_t n) {
+  CapsWriter writer;
+  uint32_t i;
+  for (i = 0; i < n; ++i)
+    writer.write(string(i + 1, 'a' + i % 26));
+  vector<int8_t> buf(writer.binary_size());
+  writer.serialize(buf.data(), buf.size());
+  return buf;
+}
+
+static void check_data(Caps& caps, uint32_t n) {
+  uint32_t i;
+  string sv;
+  EXPECT_EQ(caps.size(), n);
+  for (i = 0; i < n; ++i) {
+    ASSERT_EQ(caps.read(sv), CAPS_SUCCESS);
+    EXPECT_EQ(sv, string(i + 1, 'a' + i % 26));
+  }
+}
+
+TEST(CapsPool, writerReset) {
+  CapsWriter writer;
+  shared_ptr<Caps> sub = Caps::new_instance();
+  sub->write(1);
+  writer.write("abc");
+  writer.write(sub);
+  writer.write((int64_t)2);
+  uint32_t size = writer.binary_size();
+  writer.reset();
+  EXPECT_EQ(writer.size(), 0u);
+  EXPECT_LT(writer.binary_size(), size);
+  // reset后子对象不再关联此对象
+  sub->write(2);
+
+  uint32_t i;
+  for (i = 0; i < 10; ++i)
+    writer.write(string(i + 1, 'a' + i % 26));
+  vector<int8_t> buf(writer.binary_size());
+  ASSERT_EQ(writer.serialize(buf.data(), buf.size()), (int32_t)buf.size());
+  EXPECT_EQ(buf, gen_data(10));
+}
+
+TEST(CapsPool, readerReuseBuffer) {
+  vector<int8_t> large = gen_data(20);
+  vector<int8_t> small = gen_data(5);
+  CapsReader reader;
+
+  ASSERT_EQ(reader.parse(large.data(), large.size()), CAPS_SUCCESS);
+  const void* buf = reader.binary_data();
+  ASSERT_EQ(reader.parse(small.data(), small.size()), CAPS_SUCCESS);
+  EXPECT_EQ(reader.binary_data(), buf);
+  check_data(reader, 5);
+
+  // 子对象引用缓冲区时不复用
+  CapsWriter writer;
+  shared_ptr<Caps> sub = Caps::new_instance();
+  sub->write("sub");
+  writer.write(sub);
+  vector<int8_t> data(writer.binary_size());
+  writer.serialize(data.data(), data.size());
+  ASSERT_EQ(reader.parse(data.data(), data.size()), CAPS_SUCCESS);
+  shared_ptr<Caps> rsub;
+  const char* sv;
+  ASSERT_EQ(reader.read(rsub), CAPS_SUCCESS);
+  reader.reset();
+  ASSERT_EQ(reader.parse(large.data(), large.size()), CAPS_SUCCESS);
+  check_data(reader, 20);
+  ASSERT_EQ(rsub->read(sv), CAPS_SUCCESS);
+  EXPECT_STREQ(sv, "sub");
+
+  // 重新parse自身的数据
+  ASSERT_EQ(reader.parse(reader.binary_data(), large.size()), CAPS_SUCCESS);
+  check_data(reader, 20);
+}
+
+TEST(CapsPool, threadLocalPool) {
+  vector<int8_t> data = gen_data(3);
+  Caps::set_pool_capacity(2);
+
+  shared_ptr<Caps> w1 = Caps::new_instance();
+  shared_ptr<Caps> w2 = Caps::new_instance();
+  EXPECT_NE(w1.get(), w2.get());
+  w1->write(1);
+  Caps* p = w1.get();
+  w1.reset();
+  w1 = Caps::new_instance();
+  // 复用的对象已reset
+  EXPECT_EQ(w1.get(), p);
+  EXPECT_EQ(w1->size(), 0u);
+
+  shared_ptr<Caps> r;
+  ASSERT_EQ(Caps::parse(data.data(), data.size(), r), CAPS_SUCCESS);
+  p = r.get();
+  const void* buf = static_cast<CapsReader*>(p)->binary_data();
+  r.reset();
+  ASSERT_EQ(Caps::parse(data.data(), data.size(), r), CAPS_SUCCESS);
+  EXPECT_EQ(r.get(), p);
+  EXPECT_EQ(static_cast<CapsReader*>(p)->binary_data(), buf);
+  check_data(*r, 3);
+
+  Caps::set_pool_capacity(0);
+  r.reset();
+  ASSERT_EQ(Caps::parse(data.data(), data.size(), r), CAPS_SUCCESS);
+  check_data(*r, 3);
+}
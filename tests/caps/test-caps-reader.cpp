@@ -0,0 +1,314 @@
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps-writer.h"
+#include "caps-reader.h"
+
+using namespace std;
+using namespace rokid;
+
+static vector<int8_t> serialize(shared_ptr<Caps>& caps) {
+  vector<int8_t> buf(caps->binary_size());
+  caps->serialize(buf.data(), buf.size());
+  return buf;
+}
+
+TEST(Caps, subReaderSharesParentBuffer) {
+  shared_ptr<Caps> wcaps = Caps::new_instance();
+  shared_ptr<Caps> wsub = Caps::new_instance();
+  shared_ptr<Caps> wsubsub = Caps::new_instance();
+  wsubsub->write("level 2");
+  wsub->write("level 1");
+  wsub->write(wsubsub);
+  wcaps->write(wsub);
+  vector<int8_t> buf = serialize(wcaps);
+
+  shared_ptr<Caps> sub;
+  shared_ptr<Caps> subsub;
+  const char* s1;
+  const char* s2;
+  {
+    shared_ptr<Caps> rcaps;
+    ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps), CAPS_SUCCESS);
+    ASSERT_EQ(rcaps->read(sub), CAPS_SUCCESS);
+    ASSERT_EQ(sub->read(s1), CAPS_SUCCESS);
+    ASSERT_EQ(sub->read(subsub), CAPS_SUCCESS);
+    ASSERT_EQ(subsub->read(s2), CAPS_SUCCESS);
+  }
+  // 父对象销毁, 原始数据被覆盖后子对象依然有效, 且数据位于同一块内存
+  memset(buf.data(), 0, buf.size());
+  sub.reset();
+  EXPECT_STREQ(s1, "level 1");
+  EXPECT_STREQ(s2, "level 2");
+  EXPECT_EQ(subsub->size(), 1u);
+  EXPECT_LT(s1 > s2 ? s1 - s2 : s2 - s1, 256);
+}
+
+// parse(dup = false)读取的子对象拷贝数据, 调用者的缓冲区释放后依然有效
+TEST(Caps, subReaderOfUnduplicatedParent) {
+  shared_ptr<Caps> wcaps = Caps::new_instance();
+  shared_ptr<Caps> wsub = Caps::new_instance();
+  wsub->write("level 1");
+  wcaps->write(wsub);
+  wcaps->write(wsub);
+  vector<int8_t>* buf = new vector<int8_t>(serialize(wcaps));
+
+  shared_ptr<Caps> sub;
+  CapsReader* csub;
+  string sv;
+  CapsReader reader;
+  ASSERT_EQ(reader.parse(buf->data(), buf->size(), false), CAPS_SUCCESS);
+  ASSERT_EQ(reader.read(sub), CAPS_SUCCESS);
+  ASSERT_EQ(reader.read_object(csub), CAPS_SUCCESS);
+  reader.reset();
+  delete buf;
+  ASSERT_EQ(sub->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "level 1");
+  ASSERT_EQ(csub->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "level 1");
+  delete csub;
+}
+
+// parse(dup = true)后binary_data为本机字节序, 数据含义不变
+TEST(Caps, binaryDataNormalized) {
+  shared_ptr<Caps> wcaps = Caps::new_instance();
+  wcaps->write(1);
+  wcaps->write((int64_t)2);
+  vector<int8_t> buf = serialize(wcaps);
+  CapsReader reader;
+  ASSERT_EQ(reader.parse(buf.data(), buf.size()), CAPS_SUCCESS);
+  ASSERT_EQ(reader.binary_size(), buf.size());
+  const Header* header = reinterpret_cast<const Header*>(reader.binary_data());
+  EXPECT_EQ(header->magic[0] & CAPS_FLAG_NET_BYTEORDER,
+      CAPS_HOST_NET_BYTEORDER ? CAPS_FLAG_NET_BYTEORDER : 0);
+
+  shared_ptr<Caps> rcaps;
+  int32_t iv;
+  int64_t lv;
+  ASSERT_EQ(Caps::parse(reader.binary_data(), reader.binary_size(), rcaps),
+      CAPS_SUCCESS);
+  ASSERT_EQ(rcaps->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  ASSERT_EQ(rcaps->read(lv), CAPS_SUCCESS);
+  EXPECT_EQ(lv, 2);
+}
+
+TEST(Caps, cApiObject) {
+  caps_t wcaps = caps_create();
+  caps_t wsub = caps_create();
+  caps_write_string(wsub, "c sub object");
+  ASSERT_EQ(caps_write_object(wcaps, wsub), CAPS_SUCCESS);
+  // 写入后修改子对象不影响已写入的数据
+  caps_write_integer(wsub, 1);
+  caps_destroy(wsub);
+  ASSERT_EQ(caps_write_object(wcaps, 0), CAPS_SUCCESS);
+  vector<int8_t> buf(caps_serialize(wcaps, nullptr, 0));
+  caps_serialize(wcaps, buf.data(), buf.size());
+  caps_destroy(wcaps);
+
+  caps_t rcaps;
+  caps_t rsub;
+  caps_t rnull;
+  const char* s;
+  ASSERT_EQ(caps_parse(buf.data(), buf.size(), &rcaps), CAPS_SUCCESS);
+  ASSERT_EQ(caps_read_object(rcaps, &rsub), CAPS_SUCCESS);
+  ASSERT_EQ(caps_read_object(rcaps, &rnull), CAPS_SUCCESS);
+  EXPECT_EQ(rnull, 0);
+  caps_destroy(rcaps);
+  ASSERT_EQ(caps_read_string(rsub, &s), CAPS_SUCCESS);
+  EXPECT_STREQ(s, "c sub object");
+  EXPECT_EQ(caps_read_string(rsub, &s), CAPS_ERR_EOO);
+  caps_destroy(rsub);
+
+  // c api写入的网络字节序子对象, 多次读取不修改共享的数据
+  wcaps = caps_create();
+  wsub = caps_create();
+  caps_write_integer(wsub, 7);
+  caps_write_object(wcaps, wsub);
+  caps_destroy(wsub);
+  buf.resize(caps_serialize(wcaps, nullptr, 0));
+  caps_serialize(wcaps, buf.data(), buf.size());
+  caps_destroy(wcaps);
+  CapsReader shared;
+  int32_t iv;
+  ASSERT_EQ(shared.parse(buf.data(), buf.size()), CAPS_SUCCESS);
+  vector<int8_t> before((const int8_t*)shared.binary_data(),
+      (const int8_t*)shared.binary_data() + shared.binary_size());
+  for (int32_t i = 0; i < 2; ++i) {
+    CapsReader* csub;
+    ASSERT_EQ(shared.seek(0), CAPS_SUCCESS);
+    ASSERT_EQ(shared.read_object(csub), CAPS_SUCCESS);
+    ASSERT_EQ(csub->read(iv), CAPS_SUCCESS);
+    EXPECT_EQ(iv, 7);
+    delete csub;
+  }
+  EXPECT_EQ(memcmp(before.data(), shared.binary_data(), before.size()), 0);
+
+  // c api读取c++ api写入的object成员
+  shared_ptr<Caps> cpp = Caps::new_instance();
+  shared_ptr<Caps> cppsub = Caps::new_instance();
+  cppsub->write(42);
+  cpp->write(cppsub);
+  buf = serialize(cpp);
+  ASSERT_EQ(caps_parse(buf.data(), buf.size(), &rcaps), CAPS_SUCCESS);
+  ASSERT_EQ(caps_read_object(rcaps, &rsub), CAPS_SUCCESS);
+  ASSERT_EQ(caps_read_integer(rsub, &iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 42);
+  caps_destroy(rsub);
+  caps_destroy(rcaps);
+}
+
+TEST(Caps, randomAccess) {
+  shared_ptr<Caps> wcaps = Caps::new_instance();
+  shared_ptr<Caps> wsub = Caps::new_instance();
+  uint8_t bin[] = { 1, 2, 3, 4, 5 };
+  int32_t i;
+  wsub->write(-1);
+  for (i = 0; i < 10; ++i) {
+    wcaps->write(i);
+    wcaps->write((int64_t)i * 100);
+    wcaps->write(to_string(i));
+    wcaps->write(bin, i % 6);
+    wcaps->write(wsub);
+    wcaps->write();
+  }
+  vector<int8_t> buf = serialize(wcaps);
+  shared_ptr<Caps> rcaps;
+  ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps, false), CAPS_SUCCESS);
+
+  int32_t iv;
+  int64_t lv;
+  string sv;
+  vector<uint8_t> bv;
+  shared_ptr<Caps> ov;
+  for (i = 9; i >= 0; --i) {
+    ASSERT_EQ(rcaps->read_at(i * 6 + 2, sv), CAPS_SUCCESS);
+    EXPECT_EQ(sv, to_string(i));
+    ASSERT_EQ(rcaps->read_at(i * 6, iv), CAPS_SUCCESS);
+    EXPECT_EQ(iv, i);
+    ASSERT_EQ(rcaps->read(lv), CAPS_SUCCESS);
+    EXPECT_EQ(lv, i * 100);
+    ASSERT_EQ(rcaps->skip(1), CAPS_SUCCESS);
+    ASSERT_EQ(rcaps->read(bv), CAPS_SUCCESS);
+    EXPECT_EQ(bv.size(), (size_t)(i % 6));
+    ASSERT_EQ(rcaps->read(ov), CAPS_SUCCESS);
+    ASSERT_EQ(ov->read(iv), CAPS_SUCCESS);
+    EXPECT_EQ(iv, -1);
+    ASSERT_EQ(rcaps->read(), CAPS_SUCCESS);
+  }
+  EXPECT_EQ(rcaps->read_at(0, sv), CAPS_ERR_INCORRECT_TYPE);
+  EXPECT_EQ(rcaps->seek(61), CAPS_ERR_INVAL);
+  ASSERT_EQ(rcaps->seek(58), CAPS_SUCCESS);
+  EXPECT_EQ(rcaps->skip(3), CAPS_ERR_EOO);
+  ASSERT_EQ(rcaps->skip(2), CAPS_SUCCESS);
+  EXPECT_EQ(rcaps->next_type(), CAPS_ERR_EOO);
+  EXPECT_EQ(wcaps->seek(0), CAPS_ERR_WRONLY);
+}
+
+// 具体类型在栈上构造, 与Caps接口混合使用
+TEST(Caps, concreteTypes) {
+  CapsWriter writer;
+  shared_ptr<Caps> sub = Caps::new_instance();
+  sub->write("sub");
+  writer.write(1);
+  writer.write(2.5f);
+  writer.write((int64_t)-3);
+  writer.write(4.5);
+  writer.write("str");
+  writer.write(sub);
+  EXPECT_EQ(writer.size(), 6u);
+  vector<int8_t> buf(writer.binary_size());
+  ASSERT_EQ(writer.serialize(buf.data(), buf.size()), (int32_t)buf.size());
+
+  CapsReader reader;
+  int32_t iv;
+  float fv;
+  int64_t lv;
+  double dv;
+  const char* sv;
+  shared_ptr<Caps> rsub;
+  ASSERT_EQ(reader.parse(buf.data(), buf.size(), false), CAPS_SUCCESS);
+  EXPECT_EQ(reader.size(), 6u);
+  EXPECT_EQ(reader.read(fv), CAPS_ERR_INCORRECT_TYPE);
+  ASSERT_EQ(reader.read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  ASSERT_EQ(reader.read(fv), CAPS_SUCCESS);
+  EXPECT_EQ(fv, 2.5f);
+  ASSERT_EQ(reader.read(lv), CAPS_SUCCESS);
+  EXPECT_EQ(lv, -3);
+  ASSERT_EQ(reader.read(dv), CAPS_SUCCESS);
+  EXPECT_EQ(dv, 4.5);
+  ASSERT_EQ(reader.read(sv), CAPS_SUCCESS);
+  EXPECT_STREQ(sv, "str");
+  ASSERT_EQ(reader.read(rsub), CAPS_SUCCESS);
+  ASSERT_EQ(rsub->read(sv), CAPS_SUCCESS);
+  EXPECT_STREQ(sv, "sub");
+  EXPECT_EQ(reader.read(iv), CAPS_ERR_EOO);
+
+  // 作为Caps复制(从当前读取位置开始)
+  ASSERT_EQ(reader.seek(0), CAPS_SUCCESS);
+  CapsWriter copy;
+  copy = reader;
+  EXPECT_EQ(copy.binary_size(), writer.binary_size());
+}
+
+TEST(Caps, stringLength) {
+  shared_ptr<Caps> wcaps = Caps::new_instance();
+  string s1("a\0b", 3);
+  uint32_t i;
+  wcaps->write_string(s1.data(), s1.length());
+  wcaps->write(1);
+  wcaps->write(string("cd\0\0e", 5));
+  wcaps->write("");
+  wcaps->write("last");
+  vector<int8_t> buf = serialize(wcaps);
+
+  const char* sv;
+  uint32_t len;
+  string str;
+  for (i = 0; i < 2; ++i) {
+    shared_ptr<Caps> rcaps;
+    ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps, i == 0), CAPS_SUCCESS);
+    ASSERT_EQ(rcaps->read_string(sv, len), CAPS_SUCCESS);
+    EXPECT_EQ(string(sv, len), s1);
+    EXPECT_EQ(rcaps->read_string(sv, len), CAPS_ERR_INCORRECT_TYPE);
+    ASSERT_EQ(rcaps->seek(2), CAPS_SUCCESS);
+    ASSERT_EQ(rcaps->read(str), CAPS_SUCCESS);
+    EXPECT_EQ(str, string("cd\0\0e", 5));
+    ASSERT_EQ(rcaps->read_string(sv, len), CAPS_SUCCESS);
+    EXPECT_EQ(len, 0u);
+    EXPECT_STREQ(sv, "");
+    ASSERT_EQ(rcaps->read_at(4, sv), CAPS_SUCCESS);
+    EXPECT_STREQ(sv, "last");
+    ASSERT_EQ(rcaps->read_at(0, str), CAPS_SUCCESS);
+    EXPECT_EQ(str, s1);
+  }
+  EXPECT_EQ(wcaps->read_string(sv, len), CAPS_ERR_WRONLY);
+}
+
+// v6数据没有string sizes: integer 1, string "s"
+TEST(Caps, readVersion6String) {
+  uint8_t data[24] = { 0x1e, 'A', 'P', 6 };
+  uint32_t v;
+  v = sizeof(data);
+  memcpy(data + 4, &v, 4);
+  v = 1;
+  memcpy(data + 8, &v, 4);
+  memcpy(data + 16, "s", 2);
+  data[21] = 'S';
+  data[22] = 'i';
+  data[23] = 2;
+
+  shared_ptr<Caps> caps;
+  int32_t iv;
+  const char* sv;
+  uint32_t len;
+  ASSERT_EQ(Caps::validate(data, sizeof(data)), CAPS_SUCCESS);
+  ASSERT_EQ(Caps::parse(data, sizeof(data), caps), CAPS_SUCCESS);
+  ASSERT_EQ(caps->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+  ASSERT_EQ(caps->read_string(sv, len), CAPS_SUCCESS);
+  EXPECT_EQ(len, 1u);
+  EXPECT_STREQ(sv, "s");
+  ASSERT_EQ(caps->read_at(1, sv), CAPS_SUCCESS);
+  EXPECT_STREQ(sv, "s");
+}
@@ -0,0 +1,183 @@
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps-schema.h"
+
+using namespace std;
+
+struct SchemaPoint {
+  int32_t x;
+  double y;
+  string name;
+};
+CAPS_SCHEMA(SchemaPoint, x, y, name)
+
+struct SchemaRecord {
+  uint32_t id;
+  string title;
+  vector<uint8_t> blob;
+  int64_t timestamp;
+  vector<float> feature;
+  SchemaPoint point;
+  float score;
+  vector<int64_t> ids;
+};
+CAPS_SCHEMA(SchemaRecord, id, title, blob, timestamp, feature, point, score,
+    ids)
+
+static void gen_record(SchemaRecord& r) {
+  uint32_t i;
+  r.id = 0xfffffff0;
+  r.title = "record";
+  r.blob.assign(13, 0xab);
+  r.timestamp = 0x0102030405060708LL;
+  for (i = 0; i < 7; ++i) {
+    r.feature.push_back(0.25f * i);
+    r.ids.push_back(-((int64_t)i << 40));
+  }
+  r.point.x = -5;
+  r.point.y = 3.5;
+  r.point.name = "pt";
+  r.score = 99.5f;
+}
+
+static void check_record(const SchemaRecord& r) {
+  SchemaRecord e;
+  gen_record(e);
+  EXPECT_EQ(r.id, e.id);
+  EXPECT_EQ(r.title, e.title);
+  EXPECT_EQ(r.blob, e.blob);
+  EXPECT_EQ(r.timestamp, e.timestamp);
+  EXPECT_EQ(r.feature, e.feature);
+  EXPECT_EQ(r.point.x, e.point.x);
+  EXPECT_EQ(r.point.y, e.point.y);
+  EXPECT_EQ(r.point.name, e.point.name);
+  EXPECT_EQ(r.score, e.score);
+  EXPECT_EQ(r.ids, e.ids);
+}
+
+static shared_ptr<Caps> gen_caps() {
+  SchemaRecord r;
+  gen_record(r);
+  shared_ptr<Caps> caps = Caps::new_instance();
+  shared_ptr<Caps> sub = Caps::new_instance();
+  caps->write(r.id);
+  caps->write(r.title);
+  caps->write(r.blob.data(), r.blob.size());
+  caps->write(r.timestamp);
+  caps->write_array(r.feature);
+  sub->write(r.point.x);
+  sub->write(r.point.y);
+  sub->write(r.point.name);
+  caps->write(sub);
+  caps->write(r.score);
+  caps->write_array(r.ids);
+  return caps;
+}
+
+TEST(CapsSchema, readWrite) {
+  uint32_t flags[] = { 0, CAPS_FLAG_NET_BYTEORDER };
+  size_t i;
+  SchemaRecord r;
+  gen_record(r);
+
+  for (i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+    vector<int64_t> buf(caps_schema::binary_size(r) / sizeof(int64_t));
+    uint32_t size = buf.size() * sizeof(int64_t);
+    ASSERT_EQ(caps_schema::serialize(r, buf.data(), size - 1, flags[i]),
+        (int32_t)size);
+    ASSERT_EQ(caps_schema::serialize(r, buf.data(), size, flags[i]),
+        (int32_t)size);
+    SchemaRecord out;
+    ASSERT_EQ(caps_schema::parse(buf.data(), size, out), CAPS_SUCCESS);
+    check_record(out);
+  }
+}
+
+// 与Caps序列化的数据逐字节一致
+TEST(CapsSchema, wireCompatible) {
+  uint32_t flags[] = { 0, CAPS_FLAG_NET_BYTEORDER };
+  size_t i;
+  SchemaRecord r;
+  gen_record(r);
+  shared_ptr<Caps> caps = gen_caps();
+
+  for (i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+    uint32_t size = caps->binary_size();
+    ASSERT_EQ(caps_schema::binary_size(r), size);
+    vector<int64_t> expected(size / sizeof(int64_t));
+    vector<int64_t> buf(size / sizeof(int64_t));
+    ASSERT_EQ(caps->serialize(expected.data(), size, flags[i]), (int32_t)size);
+    ASSERT_EQ(caps_schema::serialize(r, buf.data(), size, flags[i]),
+        (int32_t)size);
+    EXPECT_EQ(memcmp(buf.data(), expected.data(), size), 0);
+
+    SchemaRecord out;
+    ASSERT_EQ(caps_schema::parse(expected.data(), size, out), CAPS_SUCCESS);
+    check_record(out);
+  }
+}
+
+TEST(CapsSchema, mismatch) {
+  SchemaRecord r;
+  SchemaPoint p;
+  gen_record(r);
+  vector<int64_t> buf(caps_schema::binary_size(r) / sizeof(int64_t));
+  uint32_t size = buf.size() * sizeof(int64_t);
+  ASSERT_EQ(caps_schema::serialize(r, buf.data(), size), (int32_t)size);
+  EXPECT_EQ(caps_schema::parse(buf.data(), size, p), CAPS_ERR_INCORRECT_TYPE);
+  EXPECT_EQ(caps_schema::parse(buf.data(), size - 8, r), CAPS_ERR_CORRUPTED);
+
+  // 成员类型不一致
+  shared_ptr<Caps> caps = Caps::new_instance();
+  caps->write(1);
+  caps->write(2.0f);
+  caps->write("name");
+  size = caps->binary_size();
+  ASSERT_LE(size, buf.size() * sizeof(int64_t));
+  caps->serialize(buf.data(), size);
+  EXPECT_EQ(caps_schema::parse(buf.data(), size, p), CAPS_ERR_INCORRECT_TYPE);
+
+  // binary size越界
+  ASSERT_EQ(caps_schema::serialize(r, buf.data(), buf.size() * 8, 0),
+      (int32_t)(buf.size() * 8));
+  size = buf.size() * sizeof(int64_t);
+  // 'blob'为第一个binary成员, 其长度位于header, long section, number section之后
+  uint32_t bad = 0x7fffffff;
+  memcpy(reinterpret_cast<int8_t*>(buf.data()) + 8 + 8 + 8, &bad, sizeof(bad));
+  EXPECT_EQ(caps_schema::parse(buf.data(), size, r), CAPS_ERR_CORRUPTED);
+}
+
+TEST(CapsSchema, nullObjectAndTruncatedArray) {
+  SchemaRecord r;
+  gen_record(r);
+  shared_ptr<Caps> caps = Caps::new_instance();
+  shared_ptr<Caps> null_obj;
+  caps->write(r.id);
+  caps->write(r.title);
+  caps->write(r.blob.data(), r.blob.size());
+  caps->write(r.timestamp);
+  caps->write_array(r.feature);
+  caps->write(null_obj);
+  caps->write(r.score);
+  caps->write_array(r.ids);
+  uint32_t size = caps->binary_size();
+  vector<int64_t> buf(size / sizeof(int64_t));
+  ASSERT_EQ(caps->serialize(buf.data(), size, 0), (int32_t)size);
+
+  SchemaRecord o;
+  ASSERT_EQ(caps_schema::parse(buf.data(), size, o), CAPS_SUCCESS);
+  EXPECT_EQ(o.point.x, 0);
+  EXPECT_EQ(o.point.y, 0.0);
+  EXPECT_TRUE(o.point.name.empty());
+  EXPECT_EQ(o.feature, r.feature);
+  EXPECT_EQ(o.ids, r.ids);
+
+  // 'feature'为第二个binary成员, 长度减1(对齐后长度不变)
+  int8_t* b = reinterpret_cast<int8_t*>(buf.data());
+  uint32_t len;
+  memcpy(&len, b + 8 + 8 + 8 + 4, sizeof(len));
+  ASSERT_EQ(len, r.feature.size() * sizeof(float));
+  --len;
+  memcpy(b + 8 + 8 + 8 + 4, &len, sizeof(len));
+  EXPECT_EQ(caps_schema::parse(buf.data(), size, o), CAPS_ERR_CORRUPTED);
+}
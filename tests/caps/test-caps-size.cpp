@@ -0,0 +1,197 @@
+#include <thread>
+#include "gtest/gtest.h"
+#include "caps-writer.h"
+
+using namespace std;
+
+static shared_ptr<Caps> build_tree(shared_ptr<Caps>& child,
+    shared_ptr<Caps>& grandchild) {
+  shared_ptr<Caps> root = Caps::new_instance();
+  child = Caps::new_instance();
+  grandchild = Caps::new_instance();
+  child->write(grandchild);
+  root->write(child);
+  root->write(child);
+  return root;
+}
+
+static shared_ptr<Caps> reparse(shared_ptr<Caps>& caps) {
+  shared_ptr<Caps> r;
+  vector<int8_t> buf(caps->binary_size());
+  EXPECT_EQ(caps->serialize(buf.data(), buf.size()), (int32_t)buf.size());
+  EXPECT_EQ(Caps::parse(buf.data(), buf.size(), r), CAPS_SUCCESS);
+  return r;
+}
+
+TEST(Caps, binarySizeCache) {
+  shared_ptr<Caps> child, grandchild;
+  shared_ptr<Caps> root = build_tree(child, grandchild);
+  uint32_t size = root->binary_size();
+  EXPECT_EQ(reparse(root)->binary_size(), size);
+
+  // 修改孙对象及子对象, 根对象的binary_size随之更新
+  grandchild->write(string(100, 'a'));
+  child->write(1);
+  shared_ptr<Caps> echild, egrandchild;
+  shared_ptr<Caps> expected = build_tree(echild, egrandchild);
+  egrandchild->write(string(100, 'a'));
+  echild->write(1);
+  EXPECT_GT(root->binary_size(), size);
+  EXPECT_EQ(root->binary_size(), expected->binary_size());
+
+  shared_ptr<Caps> rroot = reparse(root);
+  shared_ptr<Caps> rchild, rgrandchild;
+  string sv;
+  int32_t iv;
+  ASSERT_EQ(rroot->read(rchild), CAPS_SUCCESS);
+  ASSERT_EQ(rchild->read(rgrandchild), CAPS_SUCCESS);
+  ASSERT_EQ(rgrandchild->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, string(100, 'a'));
+  ASSERT_EQ(rchild->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, 1);
+}
+
+TEST(Caps, binarySizeCacheParentDestroyed) {
+  shared_ptr<Caps> child = Caps::new_instance();
+  {
+    shared_ptr<Caps> parent1 = Caps::new_instance();
+    shared_ptr<Caps> parent2 = Caps::new_instance();
+    parent1->write(child);
+    parent2->write(child);
+    parent1->binary_size();
+    parent2->binary_size();
+    caps_t c = Caps::convert(parent1);
+    caps_destroy(c);
+  }
+  // 父对象已销毁, 修改子对象不再通知父对象
+  child->write("still alive");
+  shared_ptr<Caps> parent = Caps::new_instance();
+  parent->write(child);
+  shared_ptr<Caps> rchild;
+  string sv;
+  ASSERT_EQ(reparse(parent)->read(rchild), CAPS_SUCCESS);
+  ASSERT_EQ(rchild->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "still alive");
+}
+
+// 拷贝的writer同样登记为writer子对象的父对象
+TEST(Caps, binarySizeCacheCopy) {
+  shared_ptr<Caps> child, grandchild;
+  shared_ptr<Caps> root = build_tree(child, grandchild);
+  root->binary_size();
+  shared_ptr<Caps> copy = make_shared<rokid::CapsWriter>(
+      *static_pointer_cast<rokid::CapsWriter>(root));
+  uint32_t size = copy->binary_size();
+  grandchild->write(string(100, 'a'));
+  EXPECT_GT(copy->binary_size(), size);
+  EXPECT_EQ(copy->binary_size(), root->binary_size());
+  EXPECT_EQ(reparse(copy)->binary_size(), copy->binary_size());
+
+  // 拷贝的子对象不引用原子对象的父对象
+  rokid::CapsWriter* cchild = new rokid::CapsWriter(
+      *static_pointer_cast<rokid::CapsWriter>(child));
+  root.reset();
+  copy.reset();
+  cchild->write(1);
+  rokid::CapsWriter assigned;
+  assigned = *cchild;
+  delete cchild;
+  EXPECT_EQ(assigned.size(), 2u);
+  assigned.write(2);
+}
+
+// 拷贝赋值替换全部成员, 与拷贝构造一致
+TEST(Caps, copyAssign) {
+  rokid::CapsWriter a;
+  rokid::CapsWriter b;
+  string sa;
+  string sb;
+  a.write(1);
+  b.write(2);
+  b.write("x");
+  b.binary_size();
+  b = a;
+  EXPECT_EQ(b.size(), 1u);
+  a.serialize_append(sa);
+  b.serialize_append(sb);
+  EXPECT_EQ(sb, sa);
+  b = b;
+  EXPECT_EQ(b.size(), 1u);
+
+  // 'o'为此对象的子对象
+  shared_ptr<Caps> child, grandchild;
+  shared_ptr<Caps> root = build_tree(child, grandchild);
+  rokid::CapsWriter* rw = static_cast<rokid::CapsWriter*>(root.get());
+  rokid::CapsWriter* cw = static_cast<rokid::CapsWriter*>(child.get());
+  uint32_t csize = child->binary_size();
+  child.reset();
+  grandchild.reset();
+  *rw = *cw;
+  EXPECT_EQ(root->binary_size(), csize);
+}
+
+// binary_size/serialize可在多个线程中同时调用
+TEST(Caps, binarySizeConcurrent) {
+  shared_ptr<Caps> child, grandchild;
+  shared_ptr<Caps> root = build_tree(child, grandchild);
+  grandchild->write(string(100, 'a'));
+  vector<string> results(4);
+  vector<thread> threads;
+  size_t i;
+  for (i = 0; i < results.size(); ++i) {
+    threads.emplace_back([&root, &results, i]() {
+      static_pointer_cast<rokid::CapsWriter>(root)->serialize_append(
+          results[i]);
+    });
+  }
+  for (i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  for (i = 0; i < results.size(); ++i)
+    EXPECT_EQ(results[i].size(), root->binary_size());
+}
+
+// 成员数量超过255, 末尾成员数量为varint
+TEST(Caps, manyMembers) {
+  // 最后一个成员均为字符串
+  uint32_t counts[] = { 0, 127, 129, 301, 20001 };
+  size_t i;
+  uint32_t j;
+  int32_t iv;
+  string sv;
+
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+    shared_ptr<Caps> caps = Caps::new_instance();
+    for (j = 0; j < counts[i]; ++j) {
+      if (j % 2)
+        caps->write((int32_t)j);
+      else
+        caps->write(to_string(j));
+    }
+    EXPECT_EQ(caps->size(), counts[i]);
+    shared_ptr<Caps> rcaps = reparse(caps);
+    ASSERT_EQ(rcaps->size(), counts[i]);
+    for (j = 0; j < counts[i]; ++j) {
+      if (j % 2) {
+        ASSERT_EQ(rcaps->read(iv), CAPS_SUCCESS);
+        EXPECT_EQ(iv, (int32_t)j);
+      } else {
+        ASSERT_EQ(rcaps->read(sv), CAPS_SUCCESS);
+        EXPECT_EQ(sv, to_string(j));
+      }
+    }
+    EXPECT_EQ(rcaps->read(iv), CAPS_ERR_EOO);
+    if (counts[i] > 0) {
+      ASSERT_EQ(rcaps->read_at(counts[i] - 1, sv), CAPS_SUCCESS);
+      EXPECT_EQ(sv, to_string(counts[i] - 1));
+    }
+
+    vector<struct iovec> iov;
+    string buf;
+    string data;
+    ASSERT_EQ(caps->serialize_iov(iov, buf), (int32_t)caps->binary_size());
+    for (j = 0; j < iov.size(); ++j)
+      data.append((const char*)iov[j].iov_base, iov[j].iov_len);
+    ASSERT_EQ(Caps::parse(data.data(), data.size(), rcaps), CAPS_SUCCESS);
+    EXPECT_EQ(rcaps->size(), counts[i]);
+  }
+}
@@ -0,0 +1,178 @@
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps-stream.h"
+#include "circle-stream.h"
+
+using namespace std;
+using namespace rokid;
+
+static void gen_frames(uint32_t count, string& data) {
+  uint32_t i;
+  vector<int8_t> buf;
+  for (i = 0; i < count; ++i) {
+    shared_ptr<Caps> caps = Caps::new_instance();
+    caps->write((int32_t)i);
+    caps->write(string(i * 7 % 50, 'a' + i % 26));
+    buf.resize(caps->binary_size());
+    caps->serialize(buf.data(), buf.size());
+    data.append(reinterpret_cast<const char*>(buf.data()), buf.size());
+  }
+}
+
+static void check_frame(shared_ptr<Caps>& caps, uint32_t i) {
+  int32_t iv;
+  string sv;
+  ASSERT_EQ(caps->read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(iv, (int32_t)i);
+  ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, string(i * 7 % 50, 'a' + i % 26));
+}
+
+TEST(CapsStream, wholeBuffer) {
+  string data;
+  gen_frames(20, data);
+  // 8字节对齐的输入数据, 所有帧均不拷贝
+  vector<int64_t> buf(data.size() / sizeof(int64_t) + 1);
+  memcpy(buf.data(), data.data(), data.size());
+  const char* begin = reinterpret_cast<const char*>(buf.data());
+
+  CapsStreamDecoder decoder;
+  shared_ptr<Caps> caps;
+  const char* sv;
+  int32_t iv;
+  uint32_t i = 0;
+  decoder.feed(buf.data(), data.size());
+  while (decoder.next(caps) == CAPS_SUCCESS) {
+    ASSERT_EQ(caps->read(iv), CAPS_SUCCESS);
+    EXPECT_EQ(iv, (int32_t)i);
+    ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+    EXPECT_TRUE(sv >= begin && sv < begin + data.size());
+    ++i;
+  }
+  EXPECT_EQ(i, 20u);
+  EXPECT_EQ(decoder.pending(), 0u);
+}
+
+TEST(CapsStream, chunks) {
+  string data;
+  gen_frames(50, data);
+  uint32_t chunk_sizes[] = { 1, 3, 8, 13, 64, 100 };
+  size_t i;
+  uint32_t off;
+  uint32_t n;
+  uint32_t idx;
+  int32_t r;
+
+  for (i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++i) {
+    CapsStreamDecoder decoder;
+    shared_ptr<Caps> caps;
+    idx = 0;
+    for (off = 0; off < data.size(); off += n) {
+      n = data.size() - off;
+      if (n > chunk_sizes[i])
+        n = chunk_sizes[i];
+      // 每个数据块使用独立的内存, next返回EOO后释放
+      string chunk = data.substr(off, n);
+      decoder.feed(chunk.data(), chunk.size());
+      while ((r = decoder.next(caps)) == CAPS_SUCCESS) {
+        check_frame(caps, idx);
+        ++idx;
+      }
+      ASSERT_EQ(r, CAPS_ERR_EOO);
+    }
+    EXPECT_EQ(idx, 50u);
+    EXPECT_EQ(decoder.pending(), 0u);
+  }
+}
+
+TEST(CapsStream, circleStream) {
+  string data;
+  gen_frames(100, data);
+  vector<int64_t> mem(32);
+  CircleStream stream;
+  ASSERT_TRUE(stream.create(mem.data(), mem.size() * sizeof(int64_t)));
+
+  CapsStreamDecoder decoder;
+  shared_ptr<Caps> caps;
+  uint32_t off = 0;
+  uint32_t idx = 0;
+  uint32_t n;
+  int32_t r;
+  while (idx < 100) {
+    // 模拟read系统调用, 每次写入stream剩余空间
+    n = data.size() - off;
+    if (n > stream.free_space())
+      n = stream.free_space();
+    off += stream.write(data.data() + off, n);
+    while ((r = decoder.next(stream, caps)) == CAPS_SUCCESS) {
+      check_frame(caps, idx);
+      ++idx;
+    }
+    ASSERT_EQ(r, CAPS_ERR_EOO);
+  }
+  EXPECT_EQ(off, data.size());
+}
+
+// 帧大于stream容量时逐段拷贝到内部缓冲区
+TEST(CapsStream, frameLargerThanStream) {
+  string data;
+  shared_ptr<Caps> big = Caps::new_instance();
+  big->write(string(1000, 'x'));
+  string frame(big->binary_size(), '\0');
+  big->serialize(&frame[0], frame.size());
+  gen_frames(1, data);
+  data += frame;
+  gen_frames(2, data);
+  vector<int64_t> mem(32);
+  CircleStream stream;
+  ASSERT_TRUE(stream.create(mem.data(), mem.size() * sizeof(int64_t)));
+  ASSERT_LT(stream.capacity(), frame.size());
+
+  CapsStreamDecoder decoder;
+  shared_ptr<Caps> caps;
+  vector<string> out;
+  string sv;
+  uint32_t off = 0;
+  uint32_t n;
+  int32_t r;
+  while (off < data.size()) {
+    n = data.size() - off;
+    if (n > stream.free_space())
+      n = stream.free_space();
+    off += stream.write(data.data() + off, n);
+    while ((r = decoder.next(stream, caps)) == CAPS_SUCCESS) {
+      if (out.size() == 1) {
+        ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+        out.push_back(sv);
+      } else {
+        check_frame(caps, out.size() == 0 ? 0 : out.size() - 2);
+        out.push_back("");
+      }
+    }
+    ASSERT_EQ(r, CAPS_ERR_EOO);
+  }
+  ASSERT_EQ(out.size(), 4u);
+  EXPECT_EQ(out[1], string(1000, 'x'));
+}
+
+TEST(CapsStream, corrupted) {
+  string data;
+  gen_frames(2, data);
+  string bad = data;
+  bad[1] = 'X';
+
+  CapsStreamDecoder decoder;
+  shared_ptr<Caps> caps;
+  decoder.feed(bad.data(), bad.size());
+  EXPECT_EQ(decoder.next(caps), CAPS_ERR_CORRUPTED);
+  EXPECT_EQ(decoder.next(caps), CAPS_ERR_CORRUPTED);
+  decoder.reset();
+  decoder.feed(data.data(), 3);
+  EXPECT_EQ(decoder.next(caps), CAPS_ERR_EOO);
+  decoder.feed(data.data() + 3, data.size() - 3);
+  ASSERT_EQ(decoder.next(caps), CAPS_SUCCESS);
+  check_frame(caps, 0);
+  ASSERT_EQ(decoder.next(caps), CAPS_SUCCESS);
+  check_frame(caps, 1);
+  EXPECT_EQ(decoder.next(caps), CAPS_ERR_EOO);
+}
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gtest/gtest.h"
+#include "caps.h"
+
+using namespace std;
+
+static shared_ptr<Caps> gen_caps() {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  shared_ptr<Caps> sub = Caps::new_instance();
+  vector<int32_t> iv(5, 7);
+  vector<double> dv(3, 0.5);
+  caps->write(1);
+  caps->write("string");
+  caps->write("abc", 3);
+  caps->write_array(iv);
+  caps->write((int64_t)2);
+  sub->write("sub string");
+  sub->write_array(dv);
+  sub->write(3.0f);
+  caps->write(sub);
+  // c api写入的子对象
+  caps_write_object(reinterpret_cast<caps_t>(caps.get()),
+      reinterpret_cast<caps_t>(sub.get()));
+  caps->write();
+  caps->write("");
+  caps->write(4.0);
+  return caps;
+}
+
+// 按类型读取所有成员(递归读取子对象)
+static void read_all(shared_ptr<Caps>& caps) {
+  int32_t iv;
+  float fv;
+  int64_t lv;
+  double dv;
+  const char* sv;
+  const void* bv;
+  uint32_t bl;
+  vector<int32_t> iav;
+  vector<float> fav;
+  vector<int64_t> lav;
+  vector<double> dav;
+  shared_ptr<Caps> sub;
+  int32_t type;
+
+  while ((type = caps->next_type()) > 0) {
+    switch (type) {
+      case 'i':
+        ASSERT_EQ(caps->read(iv), CAPS_SUCCESS);
+        break;
+      case 'f':
+        ASSERT_EQ(caps->read(fv), CAPS_SUCCESS);
+        break;
+      case 'l':
+        ASSERT_EQ(caps->read(lv), CAPS_SUCCESS);
+        break;
+      case 'd':
+        ASSERT_EQ(caps->read(dv), CAPS_SUCCESS);
+        break;
+      case 'S':
+        ASSERT_EQ(caps->read(sv), CAPS_SUCCESS);
+        (void)strlen(sv);
+        break;
+      case 'B':
+        ASSERT_EQ(caps->read(bv, bl), CAPS_SUCCESS);
+        if (bl > 0)
+          (void)*(reinterpret_cast<const volatile int8_t*>(bv) + bl - 1);
+        // 同caps_read_object, 可parse的binary成员作为对象读取
+        if (Caps::parse(bv, bl, sub, false) == CAPS_SUCCESS)
+          read_all(sub);
+        break;
+      case 'I':
+        ASSERT_EQ(caps->read_array(iav), CAPS_SUCCESS);
+        break;
+      case 'F':
+        ASSERT_EQ(caps->read_array(fav), CAPS_SUCCESS);
+        break;
+      case 'L':
+        ASSERT_EQ(caps->read_array(lav), CAPS_SUCCESS);
+        break;
+      case 'D':
+        ASSERT_EQ(caps->read_array(dav), CAPS_SUCCESS);
+        break;
+      case 'O':
+        ASSERT_EQ(caps->read(sub), CAPS_SUCCESS);
+        if (sub.get())
+          read_all(sub);
+        break;
+      case 'V':
+        ASSERT_EQ(caps->read(), CAPS_SUCCESS);
+        break;
+      default:
+        FAIL() << "unknown type " << type;
+    }
+  }
+}
+
+TEST(CapsValidate, valid) {
+  shared_ptr<Caps> caps = gen_caps();
+  uint32_t flags[] = { 0, CAPS_FLAG_NET_BYTEORDER };
+  size_t i;
+  for (i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+    vector<int64_t> buf(caps->binary_size() / sizeof(int64_t));
+    uint32_t size = buf.size() * sizeof(int64_t);
+    ASSERT_EQ(caps->serialize(buf.data(), size, flags[i]), (int32_t)size);
+    EXPECT_EQ(Caps::validate(buf.data(), size), CAPS_SUCCESS);
+    EXPECT_EQ(caps_validate(buf.data(), size), CAPS_SUCCESS);
+    EXPECT_EQ(Caps::validate(buf.data(), size - 8), CAPS_ERR_CORRUPTED);
+  }
+}
+
+TEST(CapsValidate, corrupted) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  caps->write("abc");
+  caps->write("def", 3);
+  vector<int64_t> buf(caps->binary_size() / sizeof(int64_t));
+  uint32_t size = buf.size() * sizeof(int64_t);
+  caps->serialize(buf.data(), size, 0);
+  int8_t* b = reinterpret_cast<int8_t*>(buf.data());
+
+  // binary长度越界
+  uint32_t bin_size = 0x7fffffff;
+  memcpy(b + 8, &bin_size, sizeof(bin_size));
+  EXPECT_EQ(Caps::validate(b, size), CAPS_ERR_CORRUPTED);
+  bin_size = 3;
+  memcpy(b + 8, &bin_size, sizeof(bin_size));
+  ASSERT_EQ(Caps::validate(b, size), CAPS_SUCCESS);
+  // 字符串没有结束符
+  char* s = reinterpret_cast<char*>(b + 16 + 8);
+  ASSERT_STREQ(s, "abc");
+  // 末尾3字节为成员声明及成员数量
+  for (; s < reinterpret_cast<char*>(b) + size - 3; ++s) {
+    if (*s == '\0')
+      *s = 'x';
+  }
+  EXPECT_EQ(Caps::validate(b, size), CAPS_ERR_CORRUPTED);
+}
+
+// c api写入的子对象为binary成员, 同样检查其结构
+TEST(CapsValidate, binaryObject) {
+  shared_ptr<Caps> sub = Caps::new_instance();
+  sub->write("abc");
+  vector<int8_t> subbuf(sub->binary_size());
+  sub->serialize(subbuf.data(), subbuf.size(), 0);
+  // 末尾2字节为成员声明及成员数量
+  size_t i;
+  for (i = 0; i < subbuf.size() - 2; ++i) {
+    if (subbuf[i] == 'c' && subbuf[i + 1] == '\0')
+      subbuf[i + 1] = 'x';
+  }
+  EXPECT_EQ(Caps::validate(subbuf.data(), subbuf.size()), CAPS_ERR_CORRUPTED);
+
+  shared_ptr<Caps> caps = Caps::new_instance();
+  caps->write(subbuf.data(), subbuf.size());
+  vector<int8_t> buf(caps->binary_size());
+  caps->serialize(buf.data(), buf.size());
+  EXPECT_EQ(Caps::validate(buf.data(), buf.size()), CAPS_ERR_CORRUPTED);
+
+  // 不是caps数据或长度不一致的binary成员不检查
+  subbuf.push_back(0);
+  caps = Caps::new_instance();
+  caps->write(subbuf.data(), subbuf.size());
+  buf.resize(caps->binary_size());
+  caps->serialize(buf.data(), buf.size());
+  EXPECT_EQ(Caps::validate(buf.data(), buf.size()), CAPS_SUCCESS);
+
+  caps_t wcaps = caps_create();
+  caps_t wsub = caps_create();
+  caps_write_string(wsub, "abc");
+  caps_write_object(wcaps, wsub);
+  caps_destroy(wsub);
+  buf.resize(caps_serialize(wcaps, nullptr, 0));
+  caps_serialize(wcaps, buf.data(), buf.size());
+  caps_destroy(wcaps);
+  EXPECT_EQ(caps_validate(buf.data(), buf.size()), CAPS_SUCCESS);
+}
+
+TEST(CapsValidate, deepNesting) {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  uint32_t i;
+  caps->write(0);
+  for (i = 0; i < 70; ++i) {
+    shared_ptr<Caps> parent = Caps::new_instance();
+    parent->write(caps);
+    caps = parent;
+  }
+  vector<int64_t> buf(caps->binary_size() / sizeof(int64_t));
+  uint32_t size = buf.size() * sizeof(int64_t);
+  caps->serialize(buf.data(), size);
+  EXPECT_EQ(Caps::validate(buf.data(), size), CAPS_ERR_CORRUPTED);
+}
+
+// 随机修改数据, 检查通过的数据全部读取不越界
+TEST(CapsValidate, randomMutation) {
+  shared_ptr<Caps> caps = gen_caps();
+  uint32_t flags[] = { 0, CAPS_FLAG_NET_BYTEORDER };
+  uint32_t size = caps->binary_size();
+  vector<int64_t> origin[2];
+  uint32_t i;
+  uint32_t j;
+  uint32_t passed = 0;
+
+  for (i = 0; i < 2; ++i) {
+    origin[i].resize(size / sizeof(int64_t));
+    caps->serialize(origin[i].data(), size, flags[i]);
+  }
+  srand(1234);
+  for (i = 0; i < 20000; ++i) {
+    // 每次拷贝到独立分配的内存, 越界访问可被检测
+    int8_t* b = new int8_t[size];
+    memcpy(b, origin[i % 2].data(), size);
+    uint32_t n = rand() % 4 + 1;
+    for (j = 0; j < n; ++j)
+      b[rand() % size] = rand();
+    if (Caps::validate(b, size) == CAPS_SUCCESS) {
+      shared_ptr<Caps> rcaps;
+      ++passed;
+      if (Caps::parse(b, size, rcaps, false) == CAPS_SUCCESS)
+        read_all(rcaps);
+      if (Caps::parse(b, size, rcaps, true) == CAPS_SUCCESS)
+        read_all(rcaps);
+    }
+    delete[] b;
+  }
+  EXPECT_GT(passed, 0u);
+}
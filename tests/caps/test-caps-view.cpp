@@ -0,0 +1,108 @@
+#include <string.h>
+#include <thread>
+#include "gtest/gtest.h"
+#include "caps-view.h"
+#include "caps-writer.h"
+
+using namespace std;
+using namespace rokid;
+
+static shared_ptr<Caps> gen_caps() {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  shared_ptr<Caps> sub = Caps::new_instance();
+  vector<int32_t> iv = { 1, 2, 3 };
+  int32_t i;
+  sub->write("sub");
+  for (i = 0; i < 100; ++i) {
+    caps->write(i);
+    caps->write(to_string(i));
+    caps->write((int64_t)i * 10);
+    caps->write_array(iv);
+    caps->write(sub);
+  }
+  return caps;
+}
+
+static void check_view(const CapsView* view, uint32_t start) {
+  CapsCursor cur;
+  int32_t iv;
+  string sv;
+  int64_t lv;
+  vector<int32_t> av;
+  shared_ptr<CapsView> sub;
+  const char* s;
+  uint32_t i;
+
+  ASSERT_EQ(view->cursor(start * 5, cur), CAPS_SUCCESS);
+  for (i = start; i < 100; ++i) {
+    ASSERT_EQ(cur.read(iv), CAPS_SUCCESS);
+    EXPECT_EQ(iv, (int32_t)i);
+    ASSERT_EQ(cur.read(sv), CAPS_SUCCESS);
+    EXPECT_EQ(sv, to_string(i));
+    ASSERT_EQ(cur.read(lv), CAPS_SUCCESS);
+    EXPECT_EQ(lv, (int64_t)i * 10);
+    ASSERT_EQ(cur.read_array(av), CAPS_SUCCESS);
+    EXPECT_EQ(av.size(), 3u);
+    ASSERT_EQ(cur.read(sub), CAPS_SUCCESS);
+    CapsCursor subcur = sub->cursor();
+    ASSERT_EQ(subcur.read(s), CAPS_SUCCESS);
+    EXPECT_STREQ(s, "sub");
+  }
+  EXPECT_EQ(cur.next_type(), CAPS_ERR_EOO);
+}
+
+TEST(CapsView, cursors) {
+  shared_ptr<Caps> caps = gen_caps();
+  vector<int8_t> buf(caps->binary_size());
+  caps->serialize(buf.data(), buf.size());
+  shared_ptr<CapsView> view;
+  ASSERT_EQ(CapsView::parse(buf.data(), buf.size(), view, false), CAPS_SUCCESS);
+  EXPECT_EQ(view->size(), 500u);
+  EXPECT_EQ(view->member_type(1), 'S');
+  EXPECT_EQ(view->member_type(500), '\0');
+
+  // 两个cursor读取位置互不影响
+  CapsCursor c1 = view->cursor();
+  CapsCursor c2 = c1;
+  int32_t iv;
+  string sv;
+  ASSERT_EQ(c1.read(iv), CAPS_SUCCESS);
+  EXPECT_EQ(c1.read(iv), CAPS_ERR_INCORRECT_TYPE);
+  ASSERT_EQ(c2.read(iv), CAPS_SUCCESS);
+  ASSERT_EQ(c2.skip(5), CAPS_SUCCESS);
+  ASSERT_EQ(c1.read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "0");
+  ASSERT_EQ(c2.read(sv), CAPS_SUCCESS);
+  EXPECT_EQ(sv, "1");
+  EXPECT_EQ(c2.seek(501), CAPS_ERR_INVAL);
+  check_view(view.get(), 0);
+
+  // 由reader及writer创建
+  shared_ptr<Caps> rcaps;
+  ASSERT_EQ(Caps::parse(buf.data(), buf.size(), rcaps), CAPS_SUCCESS);
+  ASSERT_EQ(CapsView::create(*rcaps, view), CAPS_SUCCESS);
+  rcaps.reset();
+  check_view(view.get(), 0);
+  ASSERT_EQ(CapsView::create(*caps, view), CAPS_SUCCESS);
+  check_view(view.get(), 0);
+}
+
+TEST(CapsView, multiThread) {
+  shared_ptr<Caps> caps = gen_caps();
+  vector<int8_t> buf(caps->binary_size());
+  caps->serialize(buf.data(), buf.size());
+  shared_ptr<CapsView> view;
+  ASSERT_EQ(CapsView::parse(buf.data(), buf.size(), view), CAPS_SUCCESS);
+
+  vector<thread> threads;
+  uint32_t i;
+  for (i = 0; i < 4; ++i) {
+    threads.emplace_back([&view, i]() {
+      uint32_t j;
+      for (j = 0; j < 20; ++j)
+        check_view(view.get(), (i * 7 + j) % 100);
+    });
+  }
+  for (i = 0; i < threads.size(); ++i)
+    threads[i].join();
+}
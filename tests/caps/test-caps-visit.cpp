@@ -0,0 +1,179 @@
+#include <string>
+#include "gtest/gtest.h"
+#include "caps-reader.h"
+#include "caps-writer.h"
+
+using namespace std;
+using namespace rokid;
+
+// 以文本记录遍历到的成员
+class DumpVisitor : public CapsVisitor {
+public:
+  int32_t on_integer(int32_t v) {
+    out += "i" + to_string(v) + " ";
+    return CAPS_SUCCESS;
+  }
+
+  int32_t on_double(double v) {
+    out += "d" + to_string((int32_t)v) + " ";
+    return CAPS_SUCCESS;
+  }
+
+  int32_t on_string(const char* v, uint32_t len) {
+    out += "S" + string(v, len) + " ";
+    return CAPS_SUCCESS;
+  }
+
+  template <typename T>
+  int32_t on_array(const T* v, uint32_t count) {
+    uint32_t i;
+    out += "[";
+    for (i = 0; i < count; ++i)
+      out += to_string((int64_t)v[i]) + ",";
+    out += "] ";
+    return CAPS_SUCCESS;
+  }
+
+  int32_t on_object_begin(const void* data, uint32_t len) {
+    if (len == 0) {
+      out += "null ";
+      return CAPS_VISIT_SKIP;
+    }
+    out += "{ ";
+    return skip_objects ? CAPS_VISIT_SKIP : CAPS_SUCCESS;
+  }
+
+  int32_t on_object_end() {
+    out += "} ";
+    return CAPS_SUCCESS;
+  }
+
+  string out;
+  bool skip_objects = false;
+};
+
+static shared_ptr<Caps> gen_caps() {
+  shared_ptr<Caps> caps = Caps::new_instance();
+  shared_ptr<Caps> sub = Caps::new_instance();
+  shared_ptr<Caps> subsub = Caps::new_instance();
+  shared_ptr<Caps> null_obj;
+  vector<int64_t> lv = { 1, 2 };
+  vector<int32_t> iv = { 3 };
+
+  subsub->write(string("x\0y", 3));
+  sub->write(2);
+  sub->write(subsub);
+  sub->write_array(iv);
+  caps->write(1);
+  caps->write(sub);
+  caps->write(3.0);
+  caps->write(null_obj);
+  caps->write_array(lv);
+  caps->write(4.0f);
+  caps->write();
+  return caps;
+}
+
+static const char expected_dump[] =
+  "i1 { i2 { Sx\0y } [3,] } d3 null [1,2,] ";
+
+TEST(Caps, visit) {
+  shared_ptr<Caps> caps = gen_caps();
+  string buf;
+  string expected(expected_dump, sizeof(expected_dump) - 1);
+  static_pointer_cast<CapsWriter>(caps)->serialize_append(buf);
+
+  // 网络字节序数据, 不拷贝parse, 数组拷贝并转换
+  CapsReader reader;
+  ASSERT_EQ(reader.parse(buf.data(), buf.size(), false), CAPS_SUCCESS);
+  DumpVisitor v;
+  EXPECT_EQ(reader.visit(v), CAPS_SUCCESS);
+  EXPECT_EQ(v.out, expected);
+  EXPECT_TRUE(reader.end_of_object());
+
+  // 本机字节序, 从当前读取位置开始
+  ASSERT_EQ(reader.parse(buf.data(), buf.size(), true), CAPS_SUCCESS);
+  int32_t i;
+  ASSERT_EQ(reader.read(i), CAPS_SUCCESS);
+  DumpVisitor v2;
+  v2.skip_objects = true;
+  EXPECT_EQ(reader.visit(v2), CAPS_SUCCESS);
+  EXPECT_EQ(v2.out, "{ d3 null [1,2,] ");
+}
+
+// 回调返回错误时中止遍历
+class StopVisitor : public CapsVisitor {
+public:
+  int32_t on_double(double v) {
+    return CAPS_ERR_INVAL;
+  }
+
+  int32_t on_void() {
+    ADD_FAILURE();
+    return CAPS_SUCCESS;
+  }
+};
+
+TEST(Caps, visitStop) {
+  shared_ptr<Caps> caps = gen_caps();
+  string buf;
+  static_pointer_cast<CapsWriter>(caps)->serialize_append(buf);
+  CapsReader reader;
+  ASSERT_EQ(reader.parse(buf.data(), buf.size()), CAPS_SUCCESS);
+  StopVisitor v;
+  EXPECT_EQ(reader.visit(v), CAPS_ERR_INVAL);
+  EXPECT_FALSE(reader.end_of_object());
+}
+
+// writer = reader以visit拷贝, 子对象为共享数据的reader
+TEST(Caps, visitCopy) {
+  shared_ptr<Caps> caps = gen_caps();
+  string buf;
+  string copied;
+  static_pointer_cast<CapsWriter>(caps)->serialize_append(buf, 0);
+  CapsReader reader;
+  ASSERT_EQ(reader.parse(buf.data(), buf.size()), CAPS_SUCCESS);
+  CapsWriter writer;
+  writer = reader;
+  writer.serialize_append(copied, 0);
+  EXPECT_EQ(copied, buf);
+
+  shared_ptr<Caps> sub;
+  ASSERT_EQ(reader.seek(1), CAPS_SUCCESS);
+  ASSERT_EQ(reader.read(sub), CAPS_SUCCESS);
+  EXPECT_EQ(sub->type(), CAPS_TYPE_READER);
+  // 从当前读取位置开始拷贝
+  CapsWriter w2;
+  ASSERT_EQ(reader.seek(1), CAPS_SUCCESS);
+  ASSERT_EQ(w2.append(reader), CAPS_SUCCESS);
+  EXPECT_EQ(w2.size(), reader.size() - 1);
+}
+
+// 子对象数据不正确时append返回错误码, writer不变
+TEST(Caps, visitCopyCorrupted) {
+  shared_ptr<Caps> caps = gen_caps();
+  string buf;
+  static_pointer_cast<CapsWriter>(caps)->serialize_append(buf, 0);
+  // 第一个binary成员为子对象'sub', 破坏其magic
+  CapsReader reader;
+  CapsReaderRecord rec;
+  ASSERT_EQ(reader.parse(buf.data(), buf.size(), false), CAPS_SUCCESS);
+  reader.record(rec);
+  size_t off = reinterpret_cast<const char*>(rec.binary_section) - buf.data();
+  ASSERT_EQ(buf[off + 1], 'A');
+  buf[off + 1] = 'X';
+  ASSERT_EQ(reader.parse(buf.data(), buf.size()), CAPS_SUCCESS);
+
+  CapsWriter writer;
+  string before;
+  string after;
+  EXPECT_NE(writer.append(reader), CAPS_SUCCESS);
+  EXPECT_EQ(writer.size(), 0u);
+  writer.write(7);
+  writer.serialize_append(before);
+  EXPECT_NE(writer.append(reader), CAPS_SUCCESS);
+  writer.serialize_append(after);
+  EXPECT_EQ(after, before);
+  // 读取位置不变
+  EXPECT_EQ(reader.next_type(), (int32_t)'i');
+}